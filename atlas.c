@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <SDL2/SDL_image.h>
+#include "atlas.h"
+
+#define ATLAS_MAGIC  "ATL1"
+#define PIECE_BYTES  (ATLAS_PIECE * ATLAS_PIECE * 4)
+#define LOOKUP_SIZE  4096 // power of two comfortably over ATLAS_CELLS
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x100000001b3ULL
+
+// the cell each sheet's ids ended up in, what the clips file holds
+typedef uint16_t CellTable[ATLAS_SHEETS][EMPTY_PIECE + 1];
+
+static uint64_t hashBytes(uint64_t hash, const unsigned char* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        hash = (hash ^ p[i]) * FNV_PRIME;
+
+    return hash;
+}
+
+// the files' bytes and sizes in order, so editing, adding or reordering a
+// sheet all make a new atlas
+static bool hashSheets(Atlas* a, const char* sheets[])
+{
+    unsigned char buffer[1 << 16];
+    uint64_t      hash = FNV_OFFSET;
+
+    for (int s = 0; s < a->sheets; s++)
+    {
+        FILE* fp = fopen(sheets[s], "rb");
+
+        if (fp == NULL)
+        {
+            printf("could not open sheet %s!\n", sheets[s]);
+            return false;
+        }
+
+        uint64_t size = 0;
+        size_t   n;
+
+        while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        {
+            hash = hashBytes(hash, buffer, n);
+            size += n;
+        }
+
+        fclose(fp);
+
+        hash = hashBytes(hash, (const unsigned char*)&size, sizeof(size));
+    }
+
+    a->hash = hash;
+
+    return true;
+}
+
+static void cachePath(const char* dir, uint64_t hash, const char* ext,
+                      char path[], size_t size)
+{
+    snprintf(path,
+             size,
+             "%s/%s/%016llx.%s",
+             dir,
+             ATLAS_DIR,
+             (unsigned long long)hash,
+             ext);
+}
+
+static unsigned char* cellPixels(SDL_Surface* s, int cell)
+{
+    return (unsigned char*)s->pixels +
+           (cell / ATLAS_COLUMNS) * ATLAS_PIECE * s->pitch +
+           (cell % ATLAS_COLUMNS) * ATLAS_PIECE * 4;
+}
+
+// the clips file is only read back where it was written, so it's plain
+// native integers: magic, sheet count, cell count, then the cell table
+static bool readCache(Atlas* a, const char* dir, CellTable cells)
+{
+    char path[512];
+    cachePath(dir, a->hash, "clips", path, sizeof(path));
+
+    FILE* fp = fopen(path, "rb");
+
+    if (fp == NULL)
+        return false;
+
+    char     magic[4];
+    uint32_t sheets, count;
+    size_t   n = (size_t)a->sheets * (EMPTY_PIECE + 1);
+
+    bool success = fread(magic, 1, 4, fp) == 4 &&
+                   memcmp(magic, ATLAS_MAGIC, 4) == 0 &&
+                   fread(&sheets, sizeof(sheets), 1, fp) == 1 &&
+                   fread(&count, sizeof(count), 1, fp) == 1 &&
+                   sheets == (uint32_t)a->sheets && count > 0 &&
+                   count <= ATLAS_CELLS &&
+                   fread(cells, sizeof(cells[0]), a->sheets, fp) ==
+                       (size_t)a->sheets;
+
+    fclose(fp);
+
+    for (size_t i = 0; i < n && success; i++)
+        success = cells[i / (EMPTY_PIECE + 1)][i % (EMPTY_PIECE + 1)] < count;
+
+    if (!success)
+        return false;
+
+    cachePath(dir, a->hash, "png", path, sizeof(path));
+
+    SDL_Surface* loaded = IMG_Load(path);
+
+    if (loaded == NULL)
+        return false;
+
+    a->surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+
+    int rows = (count + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+
+    if (a->surface == NULL || a->surface->w != ATLAS_COLUMNS * ATLAS_PIECE ||
+        a->surface->h < rows * ATLAS_PIECE)
+    {
+        if (a->surface != NULL)
+            SDL_FreeSurface(a->surface);
+
+        a->surface = NULL;
+        return false;
+    }
+
+    a->cells = count;
+
+    return true;
+}
+
+static bool writeCache(Atlas* a, const char* dir, CellTable cells)
+{
+    char path[512];
+    cachePath(dir, a->hash, "png", path, sizeof(path));
+
+    if (IMG_SavePNG(a->surface, path) != 0)
+        return false;
+
+    // the table goes last, without it the png is never read back
+    cachePath(dir, a->hash, "clips", path, sizeof(path));
+
+    FILE* fp = fopen(path, "wb");
+
+    if (fp == NULL)
+        return false;
+
+    uint32_t sheets = a->sheets, count = a->cells;
+
+    bool success = fwrite(ATLAS_MAGIC, 1, 4, fp) == 4 &&
+                   fwrite(&sheets, sizeof(sheets), 1, fp) == 1 &&
+                   fwrite(&count, sizeof(count), 1, fp) == 1 &&
+                   fwrite(cells, sizeof(cells[0]), a->sheets, fp) ==
+                       (size_t)a->sheets;
+
+    if (fclose(fp) != 0)
+        success = false;
+
+    if (!success)
+        remove(path);
+
+    return success;
+}
+
+// pieces are cut out of every sheet in order and each distinct one gets the
+// next cell; identical pieces, blank ones included, share a cell
+static bool pack(Atlas* a, const char* sheets[], CellTable cells)
+{
+    unsigned char* pixels = calloc(ATLAS_CELLS, PIECE_BYTES);
+    uint64_t*      hashes = malloc(ATLAS_CELLS * sizeof(uint64_t));
+    int            lookup[LOOKUP_SIZE];
+
+    if (pixels == NULL || hashes == NULL)
+    {
+        free(pixels);
+        free(hashes);
+        return false;
+    }
+
+    memset(lookup, -1, sizeof(lookup));
+
+    // cell 0 is the blank one
+    hashes[0] = hashBytes(FNV_OFFSET, pixels, PIECE_BYTES);
+    lookup[hashes[0] & (LOOKUP_SIZE - 1)] = 0;
+    a->cells                              = 1;
+
+    bool success = true;
+
+    for (int s = 0; s < a->sheets && success; s++)
+    {
+        SDL_Surface* loaded = IMG_Load(sheets[s]);
+
+        if (loaded == NULL)
+        {
+            printf("could not load image! %s\n", IMG_GetError());
+            success = false;
+            break;
+        }
+
+        SDL_Surface* sheet =
+            SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(loaded);
+
+        if (sheet == NULL)
+        {
+            success = false;
+            break;
+        }
+
+        // a piece id is a byte below EMPTY_PIECE, plus the empty piece
+        // itself, anything past that on the sheet can't be placed
+        int columns = sheet->w / ATLAS_PIECE,
+            pieces  = SDL_min(columns * (sheet->h / ATLAS_PIECE),
+                             EMPTY_PIECE + 1);
+
+        for (int id = 0; id <= EMPTY_PIECE; id++)
+        {
+            cells[s][id] = 0;
+
+            if (id >= pieces)
+                continue;
+
+            unsigned char* piece = pixels + (size_t)a->cells * PIECE_BYTES;
+            unsigned char* src   = (unsigned char*)sheet->pixels +
+                                 (id / columns) * ATLAS_PIECE * sheet->pitch +
+                                 (id % columns) * ATLAS_PIECE * 4;
+
+            for (int y = 0; y < ATLAS_PIECE; y++)
+                memcpy(piece + y * ATLAS_PIECE * 4,
+                       src + y * sheet->pitch,
+                       ATLAS_PIECE * 4);
+
+            uint64_t h    = hashBytes(FNV_OFFSET, piece, PIECE_BYTES);
+            int      slot = h & (LOOKUP_SIZE - 1);
+
+            while (lookup[slot] >= 0 &&
+                   (hashes[lookup[slot]] != h ||
+                    memcmp(pixels + (size_t)lookup[slot] * PIECE_BYTES,
+                           piece,
+                           PIECE_BYTES) != 0))
+                slot = (slot + 1) & (LOOKUP_SIZE - 1);
+
+            // a new piece keeps the cell it was copied into
+            if (lookup[slot] < 0)
+            {
+                lookup[slot]      = a->cells;
+                hashes[a->cells++] = h;
+            }
+
+            cells[s][id] = lookup[slot];
+        }
+
+        SDL_FreeSurface(sheet);
+    }
+
+    int rows = (a->cells + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+
+    if (success)
+        a->surface = SDL_CreateRGBSurfaceWithFormat(0,
+                                                    ATLAS_COLUMNS * ATLAS_PIECE,
+                                                    rows * ATLAS_PIECE,
+                                                    32,
+                                                    SDL_PIXELFORMAT_RGBA32);
+
+    if (a->surface != NULL)
+    {
+        memset(a->surface->pixels,
+               0,
+               (size_t)a->surface->pitch * a->surface->h);
+
+        for (int c = 0; c < a->cells; c++)
+        {
+            unsigned char* dst = cellPixels(a->surface, c);
+
+            for (int y = 0; y < ATLAS_PIECE; y++)
+                memcpy(dst + y * a->surface->pitch,
+                       pixels + (size_t)c * PIECE_BYTES + y * ATLAS_PIECE * 4,
+                       ATLAS_PIECE * 4);
+        }
+    }
+
+    free(pixels);
+    free(hashes);
+
+    return a->surface != NULL;
+}
+
+// clip rects and piece colours out of the cell table
+static void setCells(Atlas* a, CellTable cells)
+{
+    unsigned char average[ATLAS_CELLS][4];
+
+    for (int c = 0; c < a->cells; c++)
+    {
+        unsigned char* p      = cellPixels(a->surface, c);
+        unsigned int   sum[4] = { 0 };
+
+        for (int y = 0; y < ATLAS_PIECE; y++, p += a->surface->pitch)
+            for (int x = 0; x < ATLAS_PIECE * 4; x++)
+                sum[x & 3] += p[x];
+
+        for (int k = 0; k < 4; k++)
+            average[c][k] = sum[k] / (ATLAS_PIECE * ATLAS_PIECE);
+    }
+
+    for (int s = 0; s < a->sheets; s++)
+    {
+        for (int id = 0; id <= EMPTY_PIECE; id++)
+        {
+            int c = cells[s][id];
+
+            a->clips[s][id].x = (c % ATLAS_COLUMNS) * ATLAS_PIECE;
+            a->clips[s][id].y = (c / ATLAS_COLUMNS) * ATLAS_PIECE;
+            a->clips[s][id].w = ATLAS_PIECE;
+            a->clips[s][id].h = ATLAS_PIECE;
+
+            memcpy(a->average[s][id], average[c], 4);
+        }
+    }
+}
+
+bool atlasInit(Atlas* a, SDL_Renderer* r, const char* sheets[], int count,
+               const char* dir)
+{
+    SDL_memset(a, 0, sizeof(Atlas));
+
+    a->sheets = SDL_min(count, ATLAS_SHEETS);
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, ATLAS_DIR);
+
+    if (access(path, F_OK) != 0)
+        mkdir(path, 0700);
+
+    CellTable cells;
+
+    if (a->sheets < 1 || !hashSheets(a, sheets))
+        return false;
+
+    // a known set of sheets is read straight back, otherwise packed and
+    // kept for next time
+    if (!(a->cached = readCache(a, dir, cells)))
+    {
+        if (!pack(a, sheets, cells))
+        {
+            atlasFree(a);
+            return false;
+        }
+
+        if (!writeCache(a, dir, cells))
+            printf("Failed to cache the atlas, packing again next time.\n");
+    }
+
+    setCells(a, cells);
+
+    a->texture = SDL_CreateTextureFromSurface(r, a->surface);
+
+    if (a->texture == NULL)
+    {
+        atlasFree(a);
+        return false;
+    }
+
+    SDL_SetTextureBlendMode(a->texture, SDL_BLENDMODE_BLEND);
+
+    return true;
+}
+
+void atlasFree(Atlas* a)
+{
+    if (a->texture != NULL)
+        SDL_DestroyTexture(a->texture);
+    if (a->surface != NULL)
+        SDL_FreeSurface(a->surface);
+
+    a->texture = NULL;
+    a->surface = NULL;
+}
+
+int atlasSheet(const Atlas* a, unsigned int sheetId)
+{
+    return sheetId < (unsigned int)a->sheets ? (int)sheetId : 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "map.h"
+
+// pieces are ATLAS_PIECE square on every sheet; packed atlases are kept as
+// png under ATLAS_DIR in the maps directory, named after a hash of the
+// sheet files, so a known set of sheets is never packed twice
+#define ATLAS_SHEETS  16
+#define ATLAS_PIECE   16
+#define ATLAS_COLUMNS 64 // cells per atlas row
+#define ATLAS_CELLS   (ATLAS_SHEETS * (EMPTY_PIECE + 1) + 1)
+#define ATLAS_DIR     ".atlas"
+
+// every sheet of a project packed into one texture, piece by piece with
+// duplicates stored once, so whichever sheet a level uses it's still drawn
+// from a single texture; a level's header names its sheet and that sheet's
+// clip table maps piece ids to their cells
+typedef struct Atlas
+{
+    SDL_Surface* surface; // rgba, workers composite from it
+    SDL_Texture* texture;
+
+    int      sheets, cells; // cell 0 is blank
+    uint64_t hash;          // of the sheet files, names the cache
+    bool     cached;        // read back instead of packed
+
+    // ids a sheet doesn't have land on the blank cell
+    SDL_Rect      clips[ATLAS_SHEETS][EMPTY_PIECE + 1];
+    unsigned char average[ATLAS_SHEETS][EMPTY_PIECE + 1][4];
+} Atlas;
+
+bool atlasInit(Atlas* a, SDL_Renderer* r, const char* sheets[], int count,
+               const char* dir);
+void atlasFree(Atlas* a);
+
+// the sheet a level's header names, the first one when there's no such
+int atlasSheet(const Atlas* a, unsigned int sheetId);
+
+#endif
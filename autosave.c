@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include "autosave.h"
+
+static bool saveBack(Map* m)
+{
+    if (m->path[0] == '\0')
+        return false;
+
+    // chunk deltas where the file allows it, otherwise a full rewrite
+    if (mapSaveChanges(m, m->path))
+        return true;
+
+    return mapSaveFile(m, m->path);
+}
+
+static int autosaveThread(void* data)
+{
+    Autosave* a = data;
+
+    SDL_LockMutex(a->lock);
+
+    while (true)
+    {
+        while (!a->pending && !a->quit)
+            SDL_CondWait(a->wake, a->lock);
+
+        if (!a->pending)
+            break;
+
+        a->pending = false;
+
+        bool mapped = a->mapped;
+
+        // the back map is ours until busy drops, edits keep going on front
+        SDL_UnlockMutex(a->lock);
+
+        bool success = mapped ? mapSyncFile(a->front) : saveBack(&a->back);
+
+        SDL_AtomicSet(&a->done, success ? 1 : -1);
+
+        SDL_LockMutex(a->lock);
+
+        a->busy = false;
+        SDL_CondBroadcast(a->idle);
+    }
+
+    SDL_UnlockMutex(a->lock);
+
+    return 0;
+}
+
+bool autosaveInit(Autosave* a, Map* front)
+{
+    a->front   = front;
+    a->pending = a->busy = a->mapped = a->quit = false;
+    a->synced  = false;
+    a->last    = SDL_GetTicks();
+    a->thread  = NULL;
+
+    SDL_AtomicSet(&a->done, 0);
+
+    a->lock = SDL_CreateMutex();
+    a->wake = SDL_CreateCond();
+    a->idle = SDL_CreateCond();
+
+    if (!mapInit(&a->back, front->width, front->height, front->tileSize))
+        return false;
+
+    if (a->lock != NULL && a->wake != NULL && a->idle != NULL)
+        a->thread = SDL_CreateThread(autosaveThread, "autosave", a);
+
+    if (a->thread == NULL)
+    {
+        printf("Failed to start autosave thread! SDL Error: %s\n",
+               SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+void autosaveFree(Autosave* a)
+{
+    // a save that is already queued still gets written
+    if (a->thread != NULL)
+    {
+        SDL_LockMutex(a->lock);
+        a->quit = true;
+        SDL_CondSignal(a->wake);
+        SDL_UnlockMutex(a->lock);
+
+        SDL_WaitThread(a->thread, NULL);
+        a->thread = NULL;
+    }
+
+    if (a->idle != NULL)
+        SDL_DestroyCond(a->idle);
+    if (a->wake != NULL)
+        SDL_DestroyCond(a->wake);
+    if (a->lock != NULL)
+        SDL_DestroyMutex(a->lock);
+
+    a->idle = a->wake = NULL;
+    a->lock = NULL;
+
+    mapFree(&a->back);
+}
+
+void autosaveReset(Autosave* a)
+{
+    if (a->lock == NULL)
+        return;
+
+    SDL_LockMutex(a->lock);
+
+    while (a->busy)
+        SDL_CondWait(a->idle, a->lock);
+
+    a->synced = false;
+
+    SDL_UnlockMutex(a->lock);
+}
+
+bool autosaveRequest(Autosave* a)
+{
+    bool started = false;
+
+    // without a worker the save still happens, just on the caller's thread
+    if (a->thread == NULL)
+    {
+        bool success = a->front->grid != NULL ? mapSyncFile(a->front) :
+                                                saveBack(a->front);
+
+        SDL_AtomicSet(&a->done, success ? 1 : -1);
+        a->last = SDL_GetTicks();
+
+        return true;
+    }
+
+    SDL_LockMutex(a->lock);
+
+    if (!a->busy)
+    {
+        a->mapped = a->front->grid != NULL;
+
+        // the first snapshot after a load copies the level, later ones only
+        // what was edited in between
+        if (a->mapped || mapSnapshot(&a->back, a->front, !a->synced))
+        {
+            a->synced  = !a->mapped;
+            a->pending = a->busy = true;
+            a->last    = SDL_GetTicks();
+
+            SDL_CondSignal(a->wake);
+
+            started = true;
+        }
+    }
+
+    SDL_UnlockMutex(a->lock);
+
+    return started;
+}
+
+bool autosaveDue(Autosave* a, Uint32 interval)
+{
+    if (SDL_GetTicks() - a->last < interval)
+        return false;
+
+    return a->front->grid != NULL || a->front->dirtyCount > 0;
+}
+
+int autosavePoll(Autosave* a)
+{
+    return SDL_AtomicSet(&a->done, 0);
+}
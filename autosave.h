@@ -0,0 +1,41 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+
+// saves run on a worker thread against a second copy of the map (back), so
+// the editor only pays for copying the chunks edited since the last save;
+// a mapped level is the file already and only gets flushed there
+typedef struct Autosave
+{
+    Map  back;
+    Map* front;
+
+    SDL_Thread* thread;
+    SDL_mutex*  lock;
+    SDL_cond *  wake, *idle;
+
+    // under lock
+    bool pending, busy, mapped, quit;
+
+    bool         synced; // back holds the whole level, not only recent edits
+    Uint32       last;   // ticks of the last snapshot
+    SDL_atomic_t done;   // 1 saved, -1 failed, 0 nothing new
+} Autosave;
+
+bool autosaveInit(Autosave* a, Map* front);
+void autosaveFree(Autosave* a);
+
+// call before the front map is cleared or reloaded, waits out a running save
+void autosaveReset(Autosave* a);
+
+// snapshots the front map and hands it to the worker, false while the
+// previous save is still being written
+bool autosaveRequest(Autosave* a);
+bool autosaveDue(Autosave* a, Uint32 interval);
+
+// result of the last finished save since the previous poll, see done
+int autosavePoll(Autosave* a);
+
+#endif
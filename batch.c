@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include "batch.h"
+
+bool batchInit(Batch* b, SDL_Renderer* r, SDL_Texture* texture)
+{
+    int w, h;
+
+    SDL_memset(b, 0, sizeof(Batch));
+
+    b->renderer = r;
+    b->texture  = texture;
+
+    if (texture == NULL || SDL_QueryTexture(texture, NULL, NULL, &w, &h) < 0)
+        return false;
+
+    b->u = 1.0f / w;
+    b->v = 1.0f / h;
+
+    return true;
+}
+
+void batchFree(Batch* b)
+{
+    free(b->vertices);
+    free(b->indices);
+
+    b->vertices = NULL;
+    b->indices  = NULL;
+    b->count    = 0;
+    b->capacity = 0;
+}
+
+// index buffer only changes as the batch grows, quads always use the same
+// two triangles
+static bool batchGrow(Batch* b)
+{
+    int capacity = b->capacity ? b->capacity << 1 : 1024;
+
+    SDL_Vertex* vertices =
+        realloc(b->vertices, (size_t)capacity * 4 * sizeof(SDL_Vertex));
+
+    if (vertices == NULL)
+        return false;
+
+    b->vertices = vertices;
+
+    int* indices = realloc(b->indices, (size_t)capacity * 6 * sizeof(int));
+
+    if (indices == NULL)
+        return false;
+
+    b->indices = indices;
+
+    for (int q = b->capacity; q < capacity; q++)
+    {
+        int* i = indices + q * 6;
+        int  v = q << 2;
+
+        i[0] = v;
+        i[1] = v + 1;
+        i[2] = v + 2;
+        i[3] = v + 2;
+        i[4] = v + 1;
+        i[5] = v + 3;
+    }
+
+    b->capacity = capacity;
+
+    return true;
+}
+
+void batchAdd(Batch* b, const SDL_Rect* src, const SDL_Rect* dst)
+{
+    // out of memory, what's queued is drawn first so the order holds and
+    // the quad goes into the room that frees up
+    if (!b->legacy && b->count == b->capacity && !batchGrow(b))
+        batchFlush(b);
+
+    // only while nothing could be allocated at all
+    if (b->legacy || b->count == b->capacity)
+    {
+        SDL_RenderCopyEx(
+            b->renderer, b->texture, src, dst, 0, NULL, SDL_FLIP_NONE);
+        return;
+    }
+
+    SDL_Vertex* q = b->vertices + (b->count++ << 2);
+
+    float x0 = dst->x, y0 = dst->y, x1 = x0 + dst->w, y1 = y0 + dst->h,
+          u0 = src->x * b->u, v0 = src->y * b->v,
+          u1 = (src->x + src->w) * b->u, v1 = (src->y + src->h) * b->v;
+
+    //  0 1
+    //  2 3
+    q[0] = (SDL_Vertex){ { x0, y0 }, { 255, 255, 255, 255 }, { u0, v0 } };
+    q[1] = (SDL_Vertex){ { x1, y0 }, { 255, 255, 255, 255 }, { u1, v0 } };
+    q[2] = (SDL_Vertex){ { x0, y1 }, { 255, 255, 255, 255 }, { u0, v1 } };
+    q[3] = (SDL_Vertex){ { x1, y1 }, { 255, 255, 255, 255 }, { u1, v1 } };
+}
+
+void batchFlush(Batch* b)
+{
+    if (b->count == 0)
+        return;
+
+    // every renderer backend has geometry support since SDL 2.0.18
+    SDL_RenderGeometry(b->renderer,
+                       b->texture,
+                       b->vertices,
+                       b->count << 2,
+                       b->indices,
+                       b->count * 6);
+
+    b->count = 0;
+}
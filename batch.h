@@ -0,0 +1,31 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+// quads out of one texture, collected over a frame and submitted with a
+// single SDL_RenderGeometry call; legacy copies each quad as it's added
+// the way renderTexture did, for comparing the two
+typedef struct Batch
+{
+    SDL_Renderer* renderer;
+    SDL_Texture*  texture;
+    float         u, v; // 1 / texture size, source rects become uvs
+
+    SDL_Vertex* vertices; // four per quad
+    int*        indices;  // six per quad
+    int         count, capacity;
+
+    bool legacy;
+} Batch;
+
+bool batchInit(Batch* b, SDL_Renderer* r, SDL_Texture* texture);
+void batchFree(Batch* b);
+
+void batchAdd(Batch* b, const SDL_Rect* src, const SDL_Rect* dst);
+
+// draws what was added since the last flush
+void batchFlush(Batch* b);
+
+#endif
@@ -0,0 +1,771 @@
+// map storage and drawing benchmarks, build with `make bench` and run
+// ./map_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "mapfile.h"
+#include "batch.h"
+#include "compositor.h"
+#include "fill.h"
+#include "stamp.h"
+
+#define BENCH_RUNS 5
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int compareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static double median(double runs[])
+{
+    qsort(runs, BENCH_RUNS, sizeof(double), compareDouble);
+
+    return runs[BENCH_RUNS >> 1];
+}
+
+static void writeTestMap(const char* path, int side)
+{
+    size_t         row    = (size_t)side << 2;
+    unsigned char* buffer = malloc(row);
+    FILE*          fp     = fopen(path, "wb");
+
+    for (int y = 0; y < side; y++)
+    {
+        for (size_t i = 0; i < row; i++)
+            buffer[i] = (y + i) % EMPTY_PIECE;
+
+        fwrite(buffer, 1, row, fp);
+    }
+
+    fclose(fp);
+    free(buffer);
+}
+
+// load/save latency of the buffered path against the mapped one, the mapped
+// load includes a full read pass so both have touched every piece
+static void benchMapIo(void)
+{
+    const int   sides[] = { 32, 256, 1024, 4096 };
+    const char* path    = "bench_map.tmp";
+
+    printf("map i/o, median of %d runs (ms)\n", BENCH_RUNS);
+    printf("%8s %10s %10s %10s %10s %10s\n",
+           "tiles",
+           "MB",
+           "load",
+           "save",
+           "mmap load",
+           "mmap save");
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int side = sides[s];
+
+        double load[BENCH_RUNS], save[BENCH_RUNS], mload[BENCH_RUNS],
+            msave[BENCH_RUNS];
+
+        unsigned char* buffer = malloc((size_t)side << 2);
+        unsigned long  sum    = 0;
+
+        Map m;
+        mapInit(&m, side, side, 32);
+
+        writeTestMap(path, side);
+
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            double t = now();
+            mapLoadFile(&m, path);
+            load[r] = now() - t;
+
+            mapSetPiece(&m, r, r, r);
+
+            t = now();
+            mapSaveRawFile(&m, path, buffer);
+            save[r] = now() - t;
+
+            t = now();
+            mapOpenFile(&m, path);
+            for (size_t i = 0; i < m.gridSize; i++)
+                sum += m.grid[i];
+            mload[r] = now() - t;
+
+            mapSetPiece(&m, r, r, r);
+
+            t = now();
+            mapSyncFile(&m);
+            msave[r] = now() - t;
+
+            mapClear(&m);
+        }
+
+        printf("%8d %10.1f %10.3f %10.3f %10.3f %10.3f\n",
+               side,
+               (((double)side * side) * 4) / (1024 * 1024),
+               median(load),
+               median(save),
+               median(mload),
+               median(msave));
+
+        if (sum == 0)
+            printf("(empty)\n");
+
+        mapFree(&m);
+        free(buffer);
+    }
+
+    remove(path);
+}
+
+static long fileSize(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+
+    if (fp == NULL)
+        return -1;
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+
+    return size;
+}
+
+// raw dump against the chunked container on levels with ~3% painted
+static void benchMapFormat(void)
+{
+    const int   sides[] = { 256, 1024, 4096 };
+    const char* raw     = "bench_map.tmp";
+    const char* packed  = "bench_map.lvl";
+
+    printf("map format, ~3%% painted, median of %d runs\n", BENCH_RUNS);
+    printf("%8s %12s %12s %10s %10s\n",
+           "tiles",
+           "raw bytes",
+           "lvl bytes",
+           "save ms",
+           "load ms");
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int side = sides[s];
+
+        double save[BENCH_RUNS], load[BENCH_RUNS];
+
+        unsigned char* buffer = malloc((size_t)side << 2);
+
+        Map m;
+        mapInit(&m, side, side, 32);
+
+        // a few painted blobs, the way real levels cluster
+        srand(side);
+        for (int b = 0; b < side / 16; b++)
+        {
+            int x = rand() % (side << 1), y = rand() % (side << 1);
+
+            for (int i = 0; i < side * 2; i++)
+                mapSetPiece(&m, x + (i % 40), y + (i / 40), i % EMPTY_PIECE);
+        }
+
+        mapSaveRawFile(&m, raw, buffer);
+
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            double t = now();
+            mapSaveFile(&m, packed);
+            save[r] = now() - t;
+
+            t = now();
+            mapLoadFile(&m, packed);
+            load[r] = now() - t;
+        }
+
+        printf("%8d %12ld %12ld %10.3f %10.3f\n",
+               side,
+               fileSize(raw),
+               fileSize(packed),
+               median(save),
+               median(load));
+
+        mapFree(&m);
+        free(buffer);
+    }
+
+    remove(raw);
+    remove(packed);
+}
+
+// a small edit on a large level, full rewrite against writing back only the
+// chunks it touched
+static void benchMapSave(void)
+{
+    const int   sides[] = { 1024, 4096 };
+    const char* paths[] = { "bench_map.tmp", "bench_map.lvl" };
+
+    printf("map save after a 16 piece edit, median of %d runs (ms)\n",
+           BENCH_RUNS);
+    printf("%8s %10s %10s %10s %10s\n",
+           "tiles",
+           "raw full",
+           "raw delta",
+           "lvl full",
+           "lvl delta");
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int side = sides[s];
+
+        double full[2][BENCH_RUNS], delta[2][BENCH_RUNS];
+
+        unsigned char* buffer = malloc((size_t)side << 2);
+
+        Map m;
+        mapInit(&m, side, side, 32);
+
+        srand(side);
+        for (int i = 0; i < side * side / 8; i++)
+            mapSetPiece(&m, rand() % (side << 1), rand() % (side << 1), i % 64);
+
+        for (int f = 0; f < 2; f++)
+        {
+            for (int r = 0; r < BENCH_RUNS; r++)
+            {
+                double t = now();
+                if (f == 0)
+                    mapSaveRawFile(&m, paths[f], buffer);
+                else
+                    mapSaveFile(&m, paths[f]);
+                full[f][r] = now() - t;
+
+                for (int i = 0; i < 16; i++)
+                    mapSetPiece(&m, r * 16 + i, r * 3, i);
+
+                t = now();
+                mapSaveChanges(&m, paths[f]);
+                delta[f][r] = now() - t;
+            }
+        }
+
+        printf("%8d %10.3f %10.3f %10.3f %10.3f\n",
+               side,
+               median(full[0]),
+               median(delta[0]),
+               median(full[1]),
+               median(delta[1]));
+
+        mapFree(&m);
+        free(buffer);
+    }
+
+    remove(paths[0]);
+    remove(paths[1]);
+}
+
+// the tile record maps used to be stored as, kept here for comparison
+typedef struct legacyTile
+{
+    short set[4];
+    int   x, y, w, h;
+} legacyTile;
+
+// full-map scan counting painted pieces, what thumbnails and stats do
+static void benchMapScan(void)
+{
+    const int sides[] = { 256, 1024, 2048 };
+
+    printf("map scan, fully painted, median of %d runs\n", BENCH_RUNS);
+    printf("%8s %12s %12s %10s %10s\n",
+           "tiles",
+           "struct B",
+           "grid B",
+           "struct ms",
+           "grid ms");
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int    side  = sides[s];
+        size_t tiles = (size_t)side * side;
+
+        double before[BENCH_RUNS], after[BENCH_RUNS];
+        long   sum = 0;
+
+        legacyTile* old = malloc(tiles * sizeof(legacyTile));
+
+        Map m;
+        mapInit(&m, side, side, 32);
+
+        for (size_t i = 0; i < tiles; i++)
+        {
+            int tx = i % side, ty = i / side;
+
+            for (int k = 0; k < 4; k++)
+            {
+                old[i].set[k] = (i + k) % (EMPTY_PIECE + 1);
+                mapSetPiece(&m,
+                            (tx << 1) + (k & 1),
+                            (ty << 1) + (k >> 1),
+                            old[i].set[k]);
+            }
+
+            old[i].x = tx << 5;
+            old[i].y = ty << 5;
+            old[i].w = old[i].h = 32;
+        }
+
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            double t = now();
+            for (size_t i = 0; i < tiles; i++)
+                for (int k = 0; k < 4; k++)
+                    sum += old[i].set[k] != EMPTY_PIECE;
+            before[r] = now() - t;
+
+            t = now();
+            for (int cy = 0; cy < (side + CHUNK_MASK) >> CHUNK_SHIFT; cy++)
+            {
+                for (int cx = 0; cx < (side + CHUNK_MASK) >> CHUNK_SHIFT; cx++)
+                {
+                    unsigned char* p = mapChunkData(&m, cx, cy, false);
+
+                    if (p == NULL)
+                        continue;
+
+                    for (int i = 0; i < CHUNK_BYTES; i++)
+                        sum += p[i] != EMPTY_PIECE;
+                }
+            }
+            after[r] = now() - t;
+        }
+
+        printf("%8d %12zu %12zu %10.3f %10.3f\n",
+               side,
+               tiles * sizeof(legacyTile),
+               mapChunkBytes(&m),
+               median(before),
+               median(after));
+
+        if (sum == 0)
+            printf("(empty)\n");
+
+        mapFree(&m);
+        free(old);
+    }
+}
+
+// finding the painted tiles in a screen sized window, checking every tile's
+// pieces the way renderTiles used to against walking the occupancy bits
+static void benchMapCull(void)
+{
+    const int sides[] = { 1024, 4096 };
+    const int viewW = 41, viewH = 24; // tiles on screen, unzoomed
+    const int views = 4096;
+
+    printf("map cull, ~3%% painted, %d windows, median of %d runs\n",
+           views,
+           BENCH_RUNS);
+    printf("%8s %10s %10s %10s\n", "tiles", "painted", "tile ms", "bits ms");
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int side = sides[s];
+
+        double before[BENCH_RUNS], after[BENCH_RUNS];
+        long   found[2] = { 0, 0 };
+
+        Map m;
+        mapInit(&m, side, side, 32);
+
+        // sparse blobs, as in benchMapFormat
+        srand(side);
+        for (int b = 0; b < side / 16; b++)
+        {
+            int x = rand() % (side << 1), y = rand() % (side << 1);
+
+            for (int i = 0; i < side * 2; i++)
+                mapSetPiece(&m, x + (i % 40), y + (i / 40), i % EMPTY_PIECE);
+        }
+
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            for (int pass = 0; pass < 2; pass++)
+            {
+                found[pass] = 0;
+                srand(r);
+
+                double t = now();
+                for (int v = 0; v < views; v++)
+                {
+                    int x0 = rand() % (side - viewW),
+                        y0 = rand() % (side - viewH), x1 = x0 + viewW,
+                        y1 = y0 + viewH;
+
+                    for (int cy = y0 >> CHUNK_SHIFT;
+                         cy <= (y1 - 1) >> CHUNK_SHIFT;
+                         cy++)
+                    {
+                        for (int cx = x0 >> CHUNK_SHIFT;
+                             cx <= (x1 - 1) >> CHUNK_SHIFT;
+                             cx++)
+                        {
+                            int ox = cx << CHUNK_SHIFT, oy = cy << CHUNK_SHIFT,
+                                a  = x0 > ox ? x0 : ox,
+                                b  = x1 < ox + CHUNK_TILES ? x1 :
+                                                             ox + CHUNK_TILES,
+                                c  = y0 > oy ? y0 : oy,
+                                d  = y1 < oy + CHUNK_TILES ? y1 :
+                                                             oy + CHUNK_TILES;
+
+                            uint32_t rows[CHUNK_TILES];
+
+                            if (!mapChunkRows(&m, cx, cy, rows))
+                                continue;
+
+                            uint32_t window =
+                                (uint32_t)(((uint64_t)1 << (b - ox)) - 1) &
+                                ~(((uint32_t)1 << (a - ox)) - 1);
+
+                            for (int ty = c; ty < d; ty++)
+                            {
+                                if (pass == 1)
+                                {
+                                    found[1] += __builtin_popcount(
+                                        rows[ty & CHUNK_MASK] & window);
+                                    continue;
+                                }
+
+                                unsigned char* p = mapGetTile(&m, a, ty);
+
+                                for (int tx = a; tx < b; tx++, p += 4)
+                                    found[0] += p[0] != EMPTY_PIECE ||
+                                                p[1] != EMPTY_PIECE ||
+                                                p[2] != EMPTY_PIECE ||
+                                                p[3] != EMPTY_PIECE;
+                            }
+                        }
+                    }
+                }
+                (pass == 0 ? before : after)[r] = now() - t;
+            }
+        }
+
+        if (found[0] != found[1])
+            printf("(mismatch %ld %ld)\n", found[0], found[1]);
+
+        printf("%8d %10ld %10.3f %10.3f\n",
+               side,
+               found[0],
+               median(before),
+               median(after));
+
+        mapFree(&m);
+    }
+}
+
+// the visible tiles' pieces through a batch, as renderTiles draws them
+// when there's no chunk cache
+static void drawPieces(Batch* b, Map* m, SDL_Rect clips[], SDL_Rect* camera,
+                       float scale)
+{
+    int tx0 = camera->x / scale, ty0 = camera->y / scale,
+        tx1 = (camera->x + camera->w) / scale + 1,
+        ty1 = (camera->y + camera->h) / scale + 1;
+
+    for (int ty = ty0; ty < ty1; ty++)
+    {
+        int y = (int)(ty * scale) - camera->y,
+            y2 = (int)((ty + 1) * scale) - camera->y, my = (y + y2) >> 1;
+
+        for (int tx = tx0; tx < tx1; tx++)
+        {
+            unsigned char* t = mapGetTile(m, tx, ty);
+
+            int x = (int)(tx * scale) - camera->x,
+                x2 = (int)((tx + 1) * scale) - camera->x, mx = (x + x2) >> 1;
+
+            batchAdd(b, &clips[t[0]], &(SDL_Rect){ x, y, mx - x, my - y });
+            batchAdd(b, &clips[t[1]], &(SDL_Rect){ mx, y, x2 - mx, my - y });
+            batchAdd(b, &clips[t[2]], &(SDL_Rect){ x, my, mx - x, y2 - my });
+            batchAdd(b, &clips[t[3]], &(SDL_Rect){ mx, my, x2 - mx, y2 - my });
+        }
+    }
+
+    batchFlush(b);
+}
+
+// a fully painted screen on the software renderer, with no display: one
+// copy per piece, the pieces as one geometry call, and the cpu compositor
+static void benchDraw(void)
+{
+    const int   width = 1280, height = 720, frames = 30;
+    const float zooms[] = { 0.5f, 1.0f, 2.0f };
+
+    SDL_Surface* screen = SDL_CreateRGBSurfaceWithFormat(
+        0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+    SDL_Surface* sheet =
+        SDL_CreateRGBSurfaceWithFormat(0, 1024, 48, 32, SDL_PIXELFORMAT_RGBA32);
+    SDL_Renderer* r =
+        screen != NULL ? SDL_CreateSoftwareRenderer(screen) : NULL;
+
+    if (r == NULL || sheet == NULL)
+    {
+        printf("draw skipped, no software renderer! %s\n", SDL_GetError());
+        return;
+    }
+
+    // an atlas sized sheet of noise, some of it see-through
+    unsigned char* p = sheet->pixels;
+
+    srand(0);
+    for (int i = 0; i < sheet->pitch * sheet->h; i++)
+        p[i] = (i & 3) == 3 && (i >> 8) % 5 == 0 ? 0x80 : rand();
+
+    SDL_Rect clips[EMPTY_PIECE + 1];
+
+    for (int i = 0; i <= EMPTY_PIECE; i++)
+        clips[i] = (SDL_Rect){ (i % 64) << 4, (i / 64) << 4, 16, 16 };
+
+    SDL_Texture* texture = SDL_CreateTextureFromSurface(r, sheet);
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+    Batch      batch;
+    Compositor compositor;
+
+    batchInit(&batch, r, texture);
+    compositorInit(&compositor, r, sheet, width, height);
+
+    Map m;
+    mapInit(&m, 256, 256, 32);
+
+    for (int y = 0; y < 512; y++)
+        for (int x = 0; x < 512; x++)
+            mapSetPiece(&m, x, y, rand() % EMPTY_PIECE);
+
+    printf("draw, %dx%d fully painted, software renderer, %d workers, "
+           "median of %d runs\n",
+           width,
+           height,
+           compositor.workerCount,
+           BENCH_RUNS);
+    printf("%8s %10s %10s %10s\n", "zoom", "copy ms", "geom ms", "cpu ms");
+
+    for (size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); z++)
+    {
+        float    scale  = 32 * zooms[z];
+        SDL_Rect camera = { 64, 64, width, height };
+
+        double runs[3][BENCH_RUNS];
+
+        for (int run = 0; run < BENCH_RUNS; run++)
+        {
+            for (int path = 0; path < 3; path++)
+            {
+                batch.legacy = path == 0;
+
+                double t = now();
+                for (int f = 0; f < frames; f++)
+                {
+                    SDL_SetRenderDrawColor(r, 0, 0, 0, 0xff);
+                    SDL_RenderClear(r);
+
+                    if (path < 2)
+                        drawPieces(&batch, &m, clips, &camera, scale);
+                    else
+                        compositorDraw(
+                            &compositor, &m, clips, &camera, scale);
+
+                    SDL_RenderPresent(r);
+                }
+                runs[path][run] = (now() - t) / frames;
+            }
+        }
+
+        printf("%8.2f %10.3f %10.3f %10.3f\n",
+               zooms[z],
+               median(runs[0]),
+               median(runs[1]),
+               median(runs[2]));
+    }
+
+    mapFree(&m);
+    compositorFree(&compositor);
+    batchFree(&batch);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(r);
+    SDL_FreeSurface(sheet);
+    SDL_FreeSurface(screen);
+}
+
+// bucket fills of an open level and of one walled into a single winding
+// corridor, the worst case for the span stack
+static void benchFill(void)
+{
+    const int sides[] = { 256, 1024 };
+
+    printf("fill, median of %d runs\n", BENCH_RUNS);
+    printf("%8s %10s %10s %10s %10s\n",
+           "tiles",
+           "pieces",
+           "edges ms",
+           "corners ms",
+           "maze ms");
+
+    Fill f;
+
+    if (!fillInit(&f))
+        return;
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int side = sides[s], pieces = side << 1;
+
+        double edges[BENCH_RUNS], corners[BENCH_RUNS], maze[BENCH_RUNS];
+        long   count = 0;
+
+        Map m;
+        mapInit(&m, side, side, 32);
+
+        // each run fills over the last one's piece
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            double t = now();
+            fillPieces(&f, &m, 0, 0, r << 1, false);
+            edges[r] = now() - t;
+
+            t = now();
+            fillPieces(&f, &m, 0, 0, (r << 1) + 1, true);
+            corners[r] = now() - t;
+
+            count = f.count;
+        }
+
+        // every other column is a wall open at alternate ends
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            mapClear(&m);
+
+            for (int x = 1; x < pieces; x += 2)
+                for (int y = 0; y < pieces; y++)
+                    if (y != ((x >> 1) & 1 ? 0 : pieces - 1))
+                        mapSetPiece(&m, x, y, 0);
+
+            double t = now();
+            fillPieces(&f, &m, 0, 0, 1, false);
+            maze[r] = now() - t;
+        }
+
+        printf("%8d %10ld %10.3f %10.3f %10.3f\n",
+               side,
+               count,
+               median(edges),
+               median(corners),
+               median(maze));
+
+        mapFree(&m);
+    }
+
+    fillFree(&f);
+}
+
+// a stamp dragged corner to corner over a level, one copy per piece moved
+// so copies overlap the way they never do while editing; the masked blend
+// against the same pieces written one at a time through mapSetPiece
+static void benchStamp(void)
+{
+    const int sides[] = { 16, 64, STAMP_SIDE }, steps = 1000;
+
+    printf("stamp, %d copies, median of %d runs\n", steps, BENCH_RUNS);
+    printf("%8s %12s %12s\n", "pieces", "blend ms", "pieces ms");
+
+    Map m;
+    mapInit(&m, 1024, 1024, 32);
+
+    for (size_t s = 0; s < sizeof(sides) / sizeof(sides[0]); s++)
+    {
+        int            side = sides[s];
+        unsigned char* ids  = malloc((size_t)side * side);
+        Stamp          st;
+
+        if (ids == NULL)
+            break;
+
+        // every seventh cell see-through
+        for (int i = 0; i < side * side; i++)
+            ids[i] = i % 7 == 0 ? STAMP_CLEAR : i % EMPTY_PIECE;
+
+        stampInit(&st);
+        stampFromPieces(&st, ids, side, side);
+
+        double blend[BENCH_RUNS], pieces[BENCH_RUNS];
+
+        for (int r = 0; r < BENCH_RUNS; r++)
+        {
+            mapClear(&m);
+
+            double t = now();
+
+            for (int i = 0; i < steps; i++)
+                stampApply(&st, &m, i << 1, i << 1);
+
+            blend[r] = now() - t;
+
+            mapClear(&m);
+
+            t = now();
+
+            for (int i = 0; i < steps; i++)
+                for (int y = 0; y < side; y++)
+                    for (int x = 0; x < side; x++)
+                        if (ids[y * side + x] != STAMP_CLEAR)
+                            mapSetPiece(&m,
+                                        (i << 1) + x,
+                                        (i << 1) + y,
+                                        ids[y * side + x]);
+
+            pieces[r] = now() - t;
+        }
+
+        printf("%8d %12.3f %12.3f\n", side, median(blend), median(pieces));
+
+        stampFree(&st);
+        free(ids);
+    }
+
+    mapFree(&m);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* only = argc > 1 ? argv[1] : NULL;
+
+    if (only == NULL || strcmp(only, "io") == 0)
+        benchMapIo();
+    if (only == NULL || strcmp(only, "format") == 0)
+        benchMapFormat();
+    if (only == NULL || strcmp(only, "save") == 0)
+        benchMapSave();
+    if (only == NULL || strcmp(only, "scan") == 0)
+        benchMapScan();
+    if (only == NULL || strcmp(only, "cull") == 0)
+        benchMapCull();
+    if (only == NULL || strcmp(only, "draw") == 0)
+        benchDraw();
+    if (only == NULL || strcmp(only, "fill") == 0)
+        benchFill();
+    if (only == NULL || strcmp(only, "stamp") == 0)
+        benchStamp();
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <SDL2/SDL_image.h>
+#include "capture.h"
+
+bool captureInit(Capture* c, const char* dir)
+{
+    SDL_memset(c, 0, sizeof(Capture));
+
+    strncat(c->dir, dir, sizeof(c->dir) - 1);
+
+    if (access(dir, F_OK) != 0)
+        mkdir(dir, 0700);
+
+    return access(dir, W_OK) == 0;
+}
+
+void captureScene(Capture* c, const char* scene)
+{
+    c->scene[0] = '\0';
+    strncat(c->scene, scene, sizeof(c->scene) - 1);
+
+    c->total  = 0;
+    c->best   = 0;
+    c->worst  = 0;
+    c->frames = 0;
+}
+
+void captureFrameStart(Capture* c)
+{
+    c->start = SDL_GetPerformanceCounter();
+}
+
+void captureFrameEnd(Capture* c)
+{
+    double ms = (SDL_GetPerformanceCounter() - c->start) * 1000.0 /
+                SDL_GetPerformanceFrequency();
+
+    if (c->frames == 0 || ms < c->best)
+        c->best = ms;
+    if (ms > c->worst)
+        c->worst = ms;
+
+    c->total += ms;
+    c->frames++;
+}
+
+bool captureSave(Capture* c, SDL_Renderer* r)
+{
+    int w, h;
+
+    if (SDL_GetRendererOutputSize(r, &w, &h) < 0)
+        return false;
+
+    SDL_Surface* s =
+        SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGB888);
+
+    if (s == NULL)
+        return false;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.png", c->dir, c->scene);
+
+    bool success = SDL_RenderReadPixels(r,
+                                        NULL,
+                                        SDL_PIXELFORMAT_RGB888,
+                                        s->pixels,
+                                        s->pitch) == 0 &&
+                   IMG_SavePNG(s, path) == 0;
+
+    SDL_FreeSurface(s);
+
+    if (!success)
+        printf("Failed to capture %s! %s\n", path, SDL_GetError());
+
+    return success;
+}
+
+void captureReport(Capture* c)
+{
+    if (c->frames == 0)
+        return;
+
+    printf("%-8s %4d frames  avg %7.3f ms  best %7.3f ms  worst %7.3f ms\n",
+           c->scene,
+           c->frames,
+           c->total / c->frames,
+           c->best,
+           c->worst);
+}
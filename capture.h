@@ -0,0 +1,33 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+// frames read back from the renderer as png, plus how long each took to
+// draw; --headless runs its scenes through this since nothing is shown
+typedef struct Capture
+{
+    char dir[256];
+
+    char   scene[32];
+    Uint64 start;              // counter at captureFrameStart
+    double total, best, worst; // ms, over the scene's frames
+    int    frames;
+} Capture;
+
+bool captureInit(Capture* c, const char* dir);
+
+// starts timing a new scene, counts restart from zero
+void captureScene(Capture* c, const char* scene);
+
+void captureFrameStart(Capture* c);
+void captureFrameEnd(Capture* c);
+
+// writes what the renderer's current target holds to dir/scene.png
+bool captureSave(Capture* c, SDL_Renderer* r);
+
+// one line per scene on stdout
+void captureReport(Capture* c);
+
+#endif
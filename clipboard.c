@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include "clipboard.h"
+
+bool clipboardInit(Clipboard* c, SDL_Renderer* r, const Atlas* atlas)
+{
+    SDL_memset(c, 0, sizeof(Clipboard));
+
+    c->renderer    = r;
+    c->atlas       = atlas;
+    c->previewSlot = -1;
+
+    if (atlas->surface == NULL)
+        return false;
+
+    for (int i = 0; i < CLIPBOARD_SLOTS; i++)
+    {
+        if (!mapInit(&c->clips[i], 0, 0, 0))
+        {
+            clipboardFree(c);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void clipboardFree(Clipboard* c)
+{
+    for (int i = 0; i < CLIPBOARD_SLOTS; i++)
+        mapFree(&c->clips[i]);
+
+    if (c->preview != NULL)
+        SDL_DestroyTexture(c->preview);
+
+    c->preview     = NULL;
+    c->previewSlot = -1;
+}
+
+bool clipboardCopy(Clipboard* c, Map* m, SDL_Rect tiles)
+{
+    Map* clip = &c->clips[c->slot];
+
+    mapFree(clip);
+    c->previewSlot = -1;
+
+    if (!mapInit(clip, tiles.w, tiles.h, m->tileSize))
+    {
+        mapInit(clip, 0, 0, 0);
+        return false;
+    }
+
+    if (!mapCopyTiles(clip, 0, 0, m, tiles.x, tiles.y, tiles.w, tiles.h))
+    {
+        mapClear(clip);
+        clip->width = clip->height = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool clipboardPaste(Clipboard* c, Map* m, int tx, int ty)
+{
+    Map* clip = &c->clips[c->slot];
+
+    if (clip->width == 0)
+        return false;
+
+    return mapCopyTiles(m, tx, ty, clip, 0, 0, clip->width, clip->height);
+}
+
+SDL_Rect clipboardSize(const Clipboard* c)
+{
+    const Map* clip = &c->clips[c->slot];
+
+    return (SDL_Rect){ 0, 0, clip->width, clip->height };
+}
+
+// w x h pixels with one sample point each, taking the average colour of
+// the piece it lands on, for copies too big to give every piece a pixel
+static void samplePreview(Clipboard* c, Map* clip, int sheet, Uint32* pixels,
+                          int w, int h)
+{
+    float s = 1.0f / c->previewPiece;
+
+    for (int v = 0; v < h; v++)
+    {
+        int py = SDL_min((int)((v + 0.5f) * s), (clip->height << 1) - 1);
+
+        for (int u = 0; u < w; u++)
+        {
+            int px = SDL_min((int)((u + 0.5f) * s), (clip->width << 1) - 1);
+            int id = mapGetPiece(clip, px, py);
+
+            if (id > EMPTY_PIECE)
+                id = EMPTY_PIECE;
+
+            SDL_memcpy(pixels + v * w + u, c->atlas->average[sheet][id], 4);
+        }
+    }
+}
+
+// each piece previewPiece pixels square, sampled nearest from its cell, or
+// its average colour once it's down to a pixel
+static void drawPreview(Clipboard* c, Map* clip, int sheet, Uint32* pixels,
+                        int pitch)
+{
+    const SDL_Surface* atlas = c->atlas->surface;
+    int                p     = (int)c->previewPiece;
+
+    for (int py = 0; py < clip->height << 1; py++)
+    {
+        for (int px = 0; px < clip->width << 1; px++)
+        {
+            int     id  = mapGetPiece(clip, px, py);
+            Uint32* dst = pixels + py * p * pitch + px * p;
+
+            if (id > EMPTY_PIECE)
+                id = EMPTY_PIECE;
+
+            if (p == 1)
+            {
+                SDL_memcpy(dst, c->atlas->average[sheet][id], 4);
+                continue;
+            }
+
+            const SDL_Rect* cell = &c->atlas->clips[sheet][id];
+
+            for (int y = 0; y < p; y++)
+            {
+                const Uint32* row =
+                    (const Uint32*)((const unsigned char*)atlas->pixels +
+                                    (cell->y + y * cell->h / p) *
+                                        atlas->pitch) +
+                    cell->x;
+
+                for (int x = 0; x < p; x++)
+                    dst[y * pitch + x] = row[x * cell->w / p];
+            }
+        }
+    }
+}
+
+SDL_Texture* clipboardPreview(Clipboard* c, int sheet)
+{
+    Map* clip = &c->clips[c->slot];
+
+    if (clip->width == 0)
+        return NULL;
+
+    if (c->previewSlot == c->slot && c->previewSheet == sheet)
+        return c->preview;
+
+    if (c->preview != NULL)
+        SDL_DestroyTexture(c->preview);
+
+    // whole pixels per piece while they fit, a fraction of one after that
+    int   side = SDL_max(clip->width, clip->height) << 1;
+    float p    = side <= CLIPBOARD_PREVIEW ?
+                     SDL_min(CLIPBOARD_PREVIEW / side, ATLAS_PIECE) :
+                     (float)CLIPBOARD_PREVIEW / side;
+    int   w    = SDL_max((int)((clip->width << 1) * p), 1),
+          h    = SDL_max((int)((clip->height << 1) * p), 1);
+
+    c->previewPiece = p;
+    c->previewSlot  = c->slot;
+    c->previewSheet = sheet;
+
+    Uint32* pixels = malloc((size_t)w * h * 4);
+
+    c->preview = pixels != NULL ? SDL_CreateTexture(c->renderer,
+                                                    SDL_PIXELFORMAT_RGBA32,
+                                                    SDL_TEXTUREACCESS_STATIC,
+                                                    w,
+                                                    h) :
+                                  NULL;
+
+    if (c->preview != NULL)
+    {
+        if (p < 1.0f)
+            samplePreview(c, clip, sheet, pixels, w, h);
+        else
+            drawPreview(c, clip, sheet, pixels, w);
+
+        SDL_UpdateTexture(c->preview, NULL, pixels, w * 4);
+        SDL_SetTextureBlendMode(c->preview, SDL_BLENDMODE_BLEND);
+        SDL_SetTextureAlphaMod(c->preview, 0xa0);
+    }
+
+    free(pixels);
+
+    return c->preview;
+}
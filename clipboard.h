@@ -0,0 +1,46 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "atlas.h"
+
+// a few copies are kept at once, one is current; previews are at most
+// CLIPBOARD_PREVIEW pixels a side, pieces shrink to fit and past that a
+// pixel stands for several of them
+#define CLIPBOARD_SLOTS   4
+#define CLIPBOARD_PREVIEW 2048
+
+// copied parts of a level, each a small sparse map of its own so unpainted
+// areas cost nothing and copying in or out is a memcpy per chunk row
+typedef struct Clipboard
+{
+    SDL_Renderer* renderer;
+    const Atlas*  atlas;
+
+    Map clips[CLIPBOARD_SLOTS]; // in tiles, 0 wide while empty
+    int slot;                   // copies go in and pastes come out of it
+
+    // the current slot drawn from one sheet, remade when either changes
+    SDL_Texture* preview;
+    float        previewPiece; // pixels per piece, under 1 for big copies
+    int          previewSlot, previewSheet;
+} Clipboard;
+
+bool clipboardInit(Clipboard* c, SDL_Renderer* r, const Atlas* atlas);
+void clipboardFree(Clipboard* c);
+
+// tiles of m into the current slot, whatever it held before is dropped
+bool clipboardCopy(Clipboard* c, Map* m, SDL_Rect tiles);
+
+// the current slot over m with its top left at tile (tx, ty), cut to the
+// level; false when the slot is empty or a chunk couldn't be made
+bool clipboardPaste(Clipboard* c, Map* m, int tx, int ty);
+
+// the current slot, 0 by 0 while empty
+SDL_Rect clipboardSize(const Clipboard* c);
+
+// the current slot's preview in sheet's pieces, NULL while it's empty
+SDL_Texture* clipboardPreview(Clipboard* c, int sheet);
+
+#endif
@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COMPOSITOR_AVX2
+#endif
+#include "compositor.h"
+
+static void copyPixels(Uint32* dst, const Uint32* src, int n)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i*)(dst + i),
+                         _mm_loadu_si128((const __m128i*)(src + i)));
+#endif
+
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+
+#ifdef COMPOSITOR_AVX2
+// built for avx2 whatever the compiler targets, only picked when the cpu
+// says it has it
+__attribute__((target("avx2"))) static void copyPixelsAvx2(Uint32*       dst,
+                                                            const Uint32* src,
+                                                            int           n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                            _mm256_loadu_si256((const __m256i*)(src + i)));
+
+    for (; i < n; i++)
+        dst[i] = src[i];
+}
+#endif
+
+// the piece at clip drawn into (x, y) to (x2, y2), cut to rows y0 to y1 of
+// the area; 1:1 pieces are plain row copies, scaled ones are sampled
+// nearest and a row is only sampled once however many times it repeats
+static int drawPiece(Compositor* c, const SDL_Rect* clip, int x, int y,
+                     int x2, int y2, int y0, int y1)
+{
+    int w = x2 - x, h = y2 - y;
+
+    int cx0 = SDL_max(x, c->area.x), cx1 = SDL_min(x2, c->area.x + c->area.w),
+        cy0 = SDL_max(y, y0), cy1 = SDL_min(y2, y1), n = cx1 - cx0;
+
+    if (n <= 0 || cy0 >= cy1 || w > COMPOSITOR_SPAN)
+        return 0;
+
+    int           spitch = c->sheet->pitch >> 2;
+    const Uint32* src =
+        (const Uint32*)c->sheet->pixels + clip->y * spitch + clip->x;
+    Uint32* dst =
+        c->pixels + (cy0 - c->area.y) * c->pitch + (cx0 - c->area.x);
+
+    if (w == clip->w && h == clip->h)
+    {
+        src += (cy0 - y) * spitch + (cx0 - x);
+
+        for (int r = cy0; r < cy1; r++, dst += c->pitch, src += spitch)
+            c->copy(dst, src, n);
+
+        return 1;
+    }
+
+    int xs[COMPOSITOR_SPAN];
+
+    for (int i = 0; i < n; i++)
+        xs[i] = (cx0 - x + i) * clip->w / w;
+
+    int     last = -1;
+    Uint32* prev = NULL;
+
+    for (int r = cy0; r < cy1; r++, prev = dst, dst += c->pitch)
+    {
+        int sy = (r - y) * clip->h / h;
+
+        if (sy == last)
+        {
+            c->copy(dst, prev, n);
+            continue;
+        }
+
+        const Uint32* row = src + sy * spitch;
+
+        for (int i = 0; i < n; i++)
+            dst[i] = row[xs[i]];
+
+        last = sy;
+    }
+
+    return 1;
+}
+
+// pieces never overlap, so the band is cleared and each is copied in
+// rather than blended; the texture is blended over the grid once, when it's
+// drawn, which comes out the same as blending every piece
+static void drawBand(Compositor* c, int band)
+{
+    int y0 = c->area.y + c->area.h * band / COMPOSITOR_BANDS,
+        y1 = c->area.y + c->area.h * (band + 1) / COMPOSITOR_BANDS;
+
+    for (int y = y0; y < y1; y++)
+        memset(c->pixels + (y - c->area.y) * c->pitch, 0, c->area.w * 4);
+
+    float s      = c->scale;
+    int   pieces = 0;
+
+    for (int i = 0; i < c->chunkCount; i++)
+    {
+        CompositorChunk* k = &c->chunks[i];
+
+        for (int r = 0; r < CHUNK_TILES; r++)
+        {
+            if (k->rows[r] == 0)
+                continue;
+
+            int ty = k->oy + r, y = (int)(ty * s) - c->cameraY,
+                y2 = (int)((ty + 1) * s) - c->cameraY;
+
+            if (y2 <= y0 || y >= y1)
+                continue;
+
+            int my = (y + y2) >> 1;
+
+            for (uint32_t bits = k->rows[r]; bits != 0; bits &= bits - 1)
+            {
+                int tx = __builtin_ctz(bits),
+                    x  = (int)((k->ox + tx) * s) - c->cameraX,
+                    x2 = (int)((k->ox + tx + 1) * s) - c->cameraX,
+                    mx = (x + x2) >> 1;
+
+                const unsigned char* set = k->tiles[r] + (tx << 2);
+
+                // same split as renderTileTexture
+                pieces += drawPiece(c, &c->clips[set[0]], x, y, mx, my, y0, y1);
+                pieces +=
+                    drawPiece(c, &c->clips[set[1]], mx, y, x2, my, y0, y1);
+                pieces +=
+                    drawPiece(c, &c->clips[set[2]], x, my, mx, y2, y0, y1);
+                pieces +=
+                    drawPiece(c, &c->clips[set[3]], mx, my, x2, y2, y0, y1);
+            }
+        }
+    }
+
+    SDL_AtomicAdd(&c->pieces, pieces);
+}
+
+// bands until there are none left to take; called with lock held
+static void drawBands(Compositor* c)
+{
+    while (c->next < COMPOSITOR_BANDS)
+    {
+        int band = c->next++;
+
+        SDL_UnlockMutex(c->lock);
+        drawBand(c, band);
+        SDL_LockMutex(c->lock);
+
+        if (++c->done == COMPOSITOR_BANDS)
+            SDL_CondSignal(c->finished);
+    }
+}
+
+static int compositorThread(void* data)
+{
+    Compositor* c = data;
+
+    SDL_LockMutex(c->lock);
+
+    while (true)
+    {
+        while (c->next >= COMPOSITOR_BANDS && !c->quit)
+            SDL_CondWait(c->wake, c->lock);
+
+        if (c->quit)
+            break;
+
+        drawBands(c);
+    }
+
+    SDL_UnlockMutex(c->lock);
+
+    return 0;
+}
+
+bool compositorInit(Compositor* c, SDL_Renderer* r, SDL_Surface* atlas,
+                    int width, int height)
+{
+    SDL_memset(c, 0, sizeof(Compositor));
+
+    c->renderer = r;
+    c->width    = width;
+    c->height   = height;
+    c->next     = COMPOSITOR_BANDS;
+    c->copy     = copyPixels;
+
+#ifdef COMPOSITOR_AVX2
+    if (SDL_HasAVX2())
+        c->copy = copyPixelsAvx2;
+#endif
+
+    if (atlas == NULL)
+        return false;
+
+    c->sheet   = SDL_ConvertSurfaceFormat(atlas, SDL_PIXELFORMAT_ARGB8888, 0);
+    c->texture = SDL_CreateTexture(r,
+                                   SDL_PIXELFORMAT_ARGB8888,
+                                   SDL_TEXTUREACCESS_STREAMING,
+                                   width,
+                                   height);
+    c->lock     = SDL_CreateMutex();
+    c->wake     = SDL_CreateCond();
+    c->finished = SDL_CreateCond();
+
+    if (c->sheet == NULL || c->texture == NULL || c->lock == NULL ||
+        c->wake == NULL || c->finished == NULL)
+    {
+        compositorFree(c);
+        return false;
+    }
+
+    SDL_SetTextureBlendMode(c->texture, SDL_BLENDMODE_BLEND);
+
+    // the main thread draws bands too, so one core needs no workers
+    int count = SDL_min(SDL_GetCPUCount() - 1, COMPOSITOR_WORKERS);
+
+    for (int i = 0; i < count; i++)
+    {
+        c->workers[c->workerCount] =
+            SDL_CreateThread(compositorThread, "compositor", c);
+
+        if (c->workers[c->workerCount] != NULL)
+            c->workerCount++;
+    }
+
+    return true;
+}
+
+void compositorFree(Compositor* c)
+{
+    if (c->lock != NULL)
+    {
+        SDL_LockMutex(c->lock);
+        c->quit = true;
+        SDL_CondBroadcast(c->wake);
+        SDL_UnlockMutex(c->lock);
+    }
+
+    for (int i = 0; i < c->workerCount; i++)
+        SDL_WaitThread(c->workers[i], NULL);
+
+    if (c->finished != NULL)
+        SDL_DestroyCond(c->finished);
+    if (c->wake != NULL)
+        SDL_DestroyCond(c->wake);
+    if (c->lock != NULL)
+        SDL_DestroyMutex(c->lock);
+    if (c->texture != NULL)
+        SDL_DestroyTexture(c->texture);
+    if (c->sheet != NULL)
+        SDL_FreeSurface(c->sheet);
+
+    SDL_memset(c, 0, sizeof(Compositor));
+}
+
+// the painted tiles of every chunk crossing the area, with their rows
+// looked up ahead so the workers never touch the map
+static bool gather(Compositor* c, Map* m, const SDL_Rect* camera, float s)
+{
+    int tx0 = SDL_max((int)((camera->x + c->area.x) / s), 0),
+        ty0 = SDL_max((int)((camera->y + c->area.y) / s), 0),
+        tx1 = SDL_min((int)((camera->x + c->area.x + c->area.w) / s) + 1,
+                      m->width),
+        ty1 = SDL_min((int)((camera->y + c->area.y + c->area.h) / s) + 1,
+                      m->height);
+
+    c->chunkCount = 0;
+
+    for (int cy = ty0 >> CHUNK_SHIFT; cy <= (ty1 - 1) >> CHUNK_SHIFT; cy++)
+    {
+        for (int cx = tx0 >> CHUNK_SHIFT; cx <= (tx1 - 1) >> CHUNK_SHIFT; cx++)
+        {
+            if (c->chunkCount == COMPOSITOR_CHUNKS)
+                return false;
+
+            CompositorChunk* k = &c->chunks[c->chunkCount];
+
+            if (!mapChunkRows(m, cx, cy, k->rows))
+                continue;
+
+            k->ox = cx << CHUNK_SHIFT;
+            k->oy = cy << CHUNK_SHIFT;
+
+            int c0 = SDL_max(tx0, k->ox) - k->ox,
+                c1 = SDL_min(tx1, k->ox + CHUNK_TILES) - k->ox;
+
+            uint32_t window = (uint32_t)(((uint64_t)1 << c1) - 1) &
+                              ~(((uint32_t)1 << c0) - 1),
+                     painted = 0;
+
+            for (int r = 0; r < CHUNK_TILES; r++)
+            {
+                int ty = k->oy + r;
+
+                if (ty < ty0 || ty >= ty1)
+                    k->rows[r] = 0;
+
+                if ((k->rows[r] &= window) != 0)
+                    k->tiles[r] = mapGetTile(m, k->ox, ty);
+
+                painted |= k->rows[r];
+            }
+
+            if (painted != 0)
+                c->chunkCount++;
+        }
+    }
+
+    return true;
+}
+
+bool compositorDraw(Compositor* c, Map* m, const SDL_Rect clips[],
+                    const SDL_Rect* camera, float scale)
+{
+    if (c->texture == NULL)
+        return false;
+
+    // only the part being redrawn, the whole screen without a clip rect
+    SDL_Rect screen = { 0, 0, c->width, c->height };
+
+    SDL_RenderGetClipRect(c->renderer, &c->area);
+
+    if (SDL_RectEmpty(&c->area))
+        c->area = screen;
+    else if (!SDL_IntersectRect(&c->area, &screen, &c->area))
+        return true;
+
+    c->clips   = clips;
+    c->scale   = scale;
+    c->cameraX = camera->x;
+    c->cameraY = camera->y;
+
+    if (!gather(c, m, camera, scale))
+        return false;
+
+    void* pixels;
+    int   pitch;
+
+    if (SDL_LockTexture(c->texture, &c->area, &pixels, &pitch) < 0)
+        return false;
+
+    c->pixels = pixels;
+    c->pitch  = pitch >> 2;
+
+    SDL_AtomicSet(&c->pieces, 0);
+
+    SDL_LockMutex(c->lock);
+
+    c->next = 0;
+    c->done = 0;
+    SDL_CondBroadcast(c->wake);
+
+    drawBands(c);
+
+    while (c->done < COMPOSITOR_BANDS)
+        SDL_CondWait(c->finished, c->lock);
+
+    SDL_UnlockMutex(c->lock);
+
+    // one upload and one copy for the whole layer
+    SDL_UnlockTexture(c->texture);
+    SDL_RenderCopy(c->renderer, c->texture, &c->area, &c->area);
+
+    return true;
+}
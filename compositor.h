@@ -0,0 +1,67 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+
+// a frame is split into COMPOSITOR_BANDS rows of bands shared out between
+// the workers and the main thread; visible chunks past COMPOSITOR_CHUNKS
+// make compositorDraw refuse, which only happens zoomed out past LOD_ZOOM
+#define COMPOSITOR_BANDS   16
+#define COMPOSITOR_WORKERS 8
+#define COMPOSITOR_CHUNKS  64
+#define COMPOSITOR_SPAN    512 // widest piece on screen, in pixels
+
+typedef struct CompositorChunk
+{
+    int            ox, oy;             // first tile
+    uint32_t       rows[CHUNK_TILES];  // painted and visible tiles
+    unsigned char* tiles[CHUNK_TILES]; // first tile of each row with any
+} CompositorChunk;
+
+// the level layer drawn on the cpu straight into one streaming texture and
+// copied out once; software renderers pay for every copy separately, so
+// this beats handing them one copy per piece by a wide margin
+typedef struct Compositor
+{
+    SDL_Renderer* renderer;
+    SDL_Texture*  texture; // screen sized, argb
+    SDL_Surface*  sheet;   // the atlas in the texture's format
+    int           width, height;
+
+    // sse2 or avx2 row copy, whichever the cpu has
+    void (*copy)(Uint32* dst, const Uint32* src, int n);
+
+    // the frame being drawn, only read by the workers; the map is gathered
+    // into chunks on the main thread since reading its rows isn't
+    const SDL_Rect* clips;
+    CompositorChunk chunks[COMPOSITOR_CHUNKS];
+    int             chunkCount, cameraX, cameraY;
+    float           scale;  // tile size on screen
+    SDL_Rect        area;   // being redrawn, the renderer's clip rect
+    Uint32*         pixels; // locked texture at area's top left
+    int             pitch;  // in pixels
+
+    SDL_Thread* workers[COMPOSITOR_WORKERS];
+    int         workerCount;
+    SDL_mutex*  lock;
+    SDL_cond *  wake, *finished;
+
+    // under lock, bands handed out and finished this frame
+    int  next, done;
+    bool quit;
+
+    SDL_atomic_t pieces; // drawn last frame
+} Compositor;
+
+bool compositorInit(Compositor* c, SDL_Renderer* r, SDL_Surface* atlas,
+                    int width, int height);
+void compositorFree(Compositor* c);
+
+// the pieces of m as seen through camera, scale being a tile's size on
+// screen, drawn over whatever is below them; false when it can't, and the
+// caller draws them itself
+bool compositorDraw(Compositor* c, Map* m, const SDL_Rect clips[],
+                    const SDL_Rect* camera, float scale);
+
+#endif
@@ -1,4 +1,3 @@
-#include <dirent.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -7,6 +6,25 @@
 //#include <SDL2/SDL_image.h>
 //#include <SDL2/SDL_ttf.h>
 #include "SDL_FontCache.h"
+#include "map.h"
+#include "autosave.h"
+#include "loader.h"
+#include "stream.h"
+#include "mapindex.h"
+#include "thumbs.h"
+#include "batch.h"
+#include "tilecache.h"
+#include "lod.h"
+#include "capture.h"
+#include "export.h"
+#include "atlas.h"
+#include "compositor.h"
+#include "fill.h"
+#include "clipboard.h"
+#include "undo.h"
+#include "stamp.h"
+
+#define SHEET_FILE "../assets/sheet.png"
 
 const int SCREEN_WIDTH  = 1280;
 const int SCREEN_HEIGHT = 720;
@@ -14,11 +32,30 @@ const int SCREEN_HEIGHT = 720;
 const int FPS   = 60;
 const int TICKS = 1000 / FPS;
 
-typedef struct tile
-{
-    short    set[4];
-    SDL_Rect box;
-} tile;
+// load screen list, rows are only drawn while they are on screen
+const int LIST_ROW    = 20;
+const int LIST_HEIGHT = 130;
+
+// edits are written back in the background this often
+const Uint32 AUTOSAVE_TICKS = 30000;
+
+// with nothing to redraw the loop sleeps until input, waking this often to
+// pick up autosaves and other background results
+const Uint32 IDLE_TICKS = 250;
+
+// zoom moves in quarter octaves from a pixel per tile up to 8x, below
+// LOD_ZOOM chunks are drawn from their averaged colours instead of pieces
+const int   ZOOM_STEPS = 4;
+const int   ZOOM_MIN   = -20;
+const int   ZOOM_MAX   = 12;
+const float LOD_ZOOM   = 0.5f;
+
+// grid lines closer together than this are left out
+const float GRID_MIN = 4.0f;
+
+// motion events kept per frame for a stroke, past this the newest replaces
+// the last so the stroke stays joined up however fast the mouse reports
+const int STROKE_POINTS = 64;
 
 typedef struct hudTile
 {
@@ -47,6 +84,21 @@ enum EDITOR_STATE {
 
 enum BUTTON_TYPE { B_NEW, B_LOAD, B_EXIT, B_BACK, B_C_OK, B_C_CANCEL };
 
+// what --headless draws, in order; zoom is in zoomView steps
+typedef struct HeadlessScene
+{
+    enum EDITOR_STATE state;
+    int               zoom;
+    const char*       name;
+} HeadlessScene;
+
+const HeadlessScene HEADLESS_SCENES[] = {
+    { E_LOAD, 0, "load" },
+    { E_EDIT, 0, "edit" },
+    { E_EDIT, 8, "near" },
+    { E_EDIT, -12, "far" },
+};
+
 typedef struct EDITOR_CONTROL
 {
     enum EDITOR_STATE state;
@@ -59,18 +111,55 @@ typedef struct EDITOR_CONTROL
 
     hudTile hudShortcuts[10];
 
-    tile* tileSet;
+    Map*        map;
+    Autosave*   autosave;
+    Loader*     loader;
+    Stream*     stream;
+    Thumbs*     thumbs;
+    TileCache*  tiles;
+    Lod*        lod;
+    Export*     exporter;
+    Atlas*      atlas;
+    Compositor* compositor;
+    Fill*       filler;
+    Clipboard*  clipboard;
+    Undo*       history;
+    Stamp*      stamps; // one per shortcut, empty while it holds one piece
+    Batch*      pieces; // sheet quads, flushed once per layer
 
     unsigned char *fileBuffer, saveCounter;
     char*          fileName;
 
     int viewX, viewY, mouseX, mouseY;
 
-    short mapX, mapY, tileX, tileY, tileScaled, selectedTileX, selectedTileY,
-        mButton, setIndex, pieceIndex, shortcutIndex, grid;
+    int mapX, mapY;
+
+    int listScroll, listHover; // load screen, in pixels and the row index
+
+    float zoom;     // screen pixels per level pixel
+    float drawTime; // ms spent submitting the tiles and hud last frame
+
+    SDL_Rect damage; // screen area that needs redrawing, empty when current
 
-    bool pressed : 1, hold : 1, zoom : 1, quit : 1, input : 1, create : 1,
-        save : 1;
+    short tileX, tileY, zoomLevel, selectedTileX, selectedTileY, mButton,
+        shortcutIndex, grid;
+
+    int strokeX, strokeY; // last piece the held button painted
+
+    // a stamp stroke's first copy and the last grid cell stamped from it,
+    // and the palette piece a stamp is being picked from
+    int stampX, stampY, cellX, cellY, paletteX, paletteY;
+
+    // tiles: the marquee, empty while there's none, and the corner it was
+    // started from; a paste follows the cursor held at grab inside it, a
+    // move puts back what it cut from moveFrom when cancelled
+    SDL_Rect selection, moveFrom;
+    int      selectX, selectY, grabX, grabY;
+
+    bool pressed : 1, hold : 1, quit : 1, input : 1, create : 1, save : 1,
+        saveQueued : 1, stats : 1, continuous : 1, composite : 1,
+        stroking : 1, bucket : 1, diagonal : 1, selecting : 1, pasting : 1,
+        moving : 1, picking : 1, aiming : 1;
 
 } Editor;
 
@@ -80,12 +169,6 @@ typedef struct StartButton
     SDL_Rect box;
 } Button;
 
-typedef struct ListFile
-{
-    char     str[256];
-    SDL_Rect box;
-} L_File;
-
 typedef struct StringInput
 {
     char* string;
@@ -97,87 +180,147 @@ typedef struct StringInput
 
 typedef struct LevelInfo
 {
-    short width, height, width_z, height_z, tile_size, tile_size_z, total_tiles,
-        tile_pieces, total_tile_pieces, tile_piece_size, tile_piece_size_z;
+    int width, height, tile_size, total_tiles, tile_pieces, total_tile_pieces,
+        tile_piece_size, tiles_x, tiles_y;
 } Level;
 
-bool initSdl(void);
+bool initSdl(bool headless);
 void closeSdl(void);
 
-bool initTextureMap(texture* sheet, char* str);
-void initLevel(Level* l);
+void initLevel(Level* l, int tilesX, int tilesY);
 void initEditor(Editor* e, Level l);
 void initButtons(Button btns[]);
+void resizeLevel(Editor* e, Level* l);
+void useSheet(Editor* e);
+void zoomView(Editor* e, Level l, int steps, int x, int y);
 
 void startInputs(Editor* e, SDL_Event event, Button buttons[],
-                 const size_t size, L_File* list);
+                 MapIndex* index);
 void editInputs(Editor* e, SDL_Event event, Level l);
-void loadInputs(Editor* e, SDL_Event event, Button buttons[], L_File* file_list,
-                Level level);
+void moveCursor(Editor* e, Level l, SDL_Point points[], int count);
+void paintTo(Editor* e, Level l, int px, int py);
+void fillAt(Editor* e, Level l);
+bool chunkReady(void* data, int cx, int cy);
+void chunkTouched(void* data, int cx, int cy);
+void fillRun(void* data, int x0, int x1, int py, short old, short id);
+void recordTiles(Editor* e, SDL_Rect tiles, Map* src);
+void finishEdit(Editor* e);
+void undoEdit(Editor* e, Level l, bool redo);
+Stamp* heldStamp(Editor* e);
+SDL_Rect stampPieces(Stamp* s, int px, int py);
+void stampAt(Editor* e, Level l, int px, int py);
+void stampChanged(void* data, int px, int py, short old, short id);
+void captureStamp(Editor* e);
+void pickStamp(Editor* e);
+SDL_Rect stampRect(Editor* e, Level l);
+short heldPiece(Editor* e);
+bool copySelection(Editor* e, Level l, bool cut);
+void startPaste(Editor* e, Level l, bool move);
+void endPaste(Editor* e, Level l, bool place);
+SDL_Rect markedTiles(Editor* e);
+SDL_Rect tilesRect(Editor* e, Level l, SDL_Rect tiles);
+bool canPaintTiles(Editor* e, SDL_Rect tiles);
+void tilesChanged(Editor* e, Level l, SDL_Rect tiles);
+void loadInputs(Editor* e, SDL_Event event, Button buttons[], MapIndex* index,
+                Level* level);
 void newInputs(Editor* e, SDL_Event event, Button buttons[], S_Input* input,
                Level* l);
-void menuInputs(Editor* e, SDL_Event event, Button buttons[],
-                const size_t bsize);
+void menuInputs(Editor* e, SDL_Event event, Button buttons[], Level level);
 
 bool createNewMap(Editor* e, Level l, const char* filename);
-bool saveMap(tile set[], unsigned char buffer[], const size_t size, char str[]);
-bool loadMap(tile set[], unsigned char buffer[], Level level, char str[]);
+bool loadMap(Editor* e, Level level, char str[]);
+bool canPaint(Editor* e);
+bool canPaintPiece(Editor* e, int px, int py);
+void setPiece(Editor* e, int px, int py, short id);
+void pickPiece(Editor* e, Level l, int x, int y);
+SDL_Rect pieceRect(Editor* e, Level l, int px, int py);
+
+void exportLevel(Editor* e);
+
+void damageRect(Editor* e, SDL_Rect box);
+void damageAll(Editor* e);
 
 void startRender(Editor* e, SDL_Renderer* renderer, FC_Font* texture,
                  Button buttons[]);
-void editRender(Editor* e, SDL_Renderer* renderer, texture texture, FC_Font* f,
-                Level level);
+void editRender(Editor* e, SDL_Renderer* renderer, FC_Font* f, Level level);
 void loadRender(Editor* e, SDL_Renderer* r, FC_Font* t, Button btns[],
-                SDL_Rect fload, L_File list[]);
+                SDL_Rect fload, MapIndex* index);
 void menuRender(Editor* e, SDL_Renderer* r, FC_Font* t, Button btns[]);
 void newRender(Editor* e, SDL_Renderer* r, FC_Font* t, Button btns[],
                S_Input input);
 
+void renderThumb(SDL_Renderer* r, SDL_Texture* thumb, SDL_Rect box);
+
 void freeTexture(texture* text);
 void renderTexture(texture* text, int x, int y, SDL_Rect* clip,
-                   const SDL_RendererFlip flip, bool zoom);
+                   const SDL_RendererFlip flip, float zoom);
 
 SDL_Texture* loadTexture(char path[16]);
 
-void renderTiles(texture* sheet, Editor editor, Level level);
-void renderTileTexture(texture* sheet, Editor editor, int i, int x, int y,
-                       int x2, int y2);
-void renderCurrentTile(texture* sheet, tile tileSet, SDL_Rect* tileClips);
-void renderTilePieces(texture* sheet, SDL_Rect* clips, Level level);
+void renderTiles(Batch* sheet, Editor editor, Level level);
+void renderTileTexture(Batch* sheet, Editor editor, unsigned char set[], int x,
+                       int y, int x2, int y2);
+void renderCurrentTile(texture* sheet, unsigned char set[], SDL_Rect* clips);
+void renderTilePieces(Batch* sheet, SDL_Rect* clips, Level level);
 
-void setCamera(SDL_Rect* screen, short x, short y);
+void setCamera(SDL_Rect* screen, int x, int y);
 
-void renderGrid(SDL_Renderer* r, SDL_Rect* c, short draw, bool zoom,
+void renderGrid(SDL_Renderer* r, SDL_Rect* c, short draw, float zoom,
                 Level level);
-void renderShortcuts(SDL_Renderer* r, texture* sheet, hudTile hudTile[],
-                     SDL_Rect* clips);
+void renderShortcuts(SDL_Renderer* r, Batch* sheet, hudTile hudTile[],
+                     Stamp stamps[], SDL_Rect* clips);
+void renderStamps(Editor* e, SDL_Renderer* r);
 
 void selectTile(SDL_Rect tileClips[]);
 
-bool checkCollision(SDL_Rect a, SDL_Rect b, bool zoom);
-bool listMapFiles(L_File* list, Button buttons[]);
-
 SDL_Window*   window   = NULL;
 SDL_Renderer* renderer = NULL;
+SDL_Surface*  screen   = NULL; // headless frames are drawn into this
 
 //////////////////////////////////
 //      MAIN FUNCTION !!!       //
 //                              //
-int main()
+int main(int argc, char* argv[])
 {
     Level* level = calloc(1, sizeof(Level));
 
     S_Input input_string;
-    char    fileNameBuffer[20];
-
-    tile     tileSet[240];
-    SDL_Rect tilePieceClips[136];
-
-    size_t fileBufferSize = 960;
-
-    unsigned char fileBuffer[fileBufferSize];
-
-    L_File* file_list = calloc(20, sizeof(L_File));
+    char    fileNameBuffer[MAP_NAME_SIZE];
+
+    Map      tileMap;
+    Autosave autosave;
+    Loader   loader;
+    Stream   stream;
+
+    size_t fileBufferSize = 0;
+
+    SDL_Texture* frame   = NULL; // last frame, kept so damage can be patched
+    bool         wasBusy = false;
+
+    Capture     capture;
+    bool        headless       = false;
+    int         headlessFrames = 60, scene = -1;
+    const char* captureDir     = "capture";
+    char*       headlessMap    = NULL;
+
+    MapIndex mapIndex;
+    Thumbs   thumbs;
+
+    TileCache  tileCache;
+    Lod        lod;
+    Export     exporter;
+    Atlas      atlas;
+    Compositor compositor;
+    Fill       filler;
+    Clipboard  clipboard;
+    Undo       history;
+    size_t     undoBudget = UNDO_BUDGET;
+    Stamp      stamps[10];
+    Batch      sheetBatch;
+
+    // the piece sheets, a level's header picks one by its place here
+    const char* sheetFiles[ATLAS_SHEETS] = { SHEET_FILE };
+    int         sheetCount               = 0;
 
     SDL_Event e;
 
@@ -185,19 +328,29 @@ int main()
 
     editor->state = E_INIT;
 
-    editor->tileSet        = tileSet;
-    editor->tilePieceClips = tilePieceClips;
-    editor->fileBuffer     = fileBuffer;
+    editor->map            = &tileMap;
+    editor->autosave       = &autosave;
+    editor->loader         = &loader;
+    editor->stream         = &stream;
+    editor->thumbs         = &thumbs;
+    editor->tiles          = &tileCache;
+    editor->lod            = &lod;
+    editor->exporter       = &exporter;
+    editor->atlas          = &atlas;
+    editor->compositor     = &compositor;
+    editor->filler         = &filler;
+    editor->clipboard      = &clipboard;
+    editor->history        = &history;
+    editor->stamps         = stamps;
+    editor->pieces         = &sheetBatch;
     editor->fileName       = fileNameBuffer;
 
-    texture sheetTexture;
-
     FC_Font* fontTexture = FC_CreateFont();
 
     SDL_Rect fileLoader;
 
     fileLoader.w = SCREEN_WIDTH >> 2;
-    fileLoader.h = 130;
+    fileLoader.h = LIST_HEIGHT;
     fileLoader.x = (SCREEN_WIDTH >> 1) - (SCREEN_WIDTH >> 3);
     fileLoader.y = (SCREEN_HEIGHT >> 1) - (SCREEN_HEIGHT >> 3);
 
@@ -210,11 +363,33 @@ int main()
     input_string.str_selection_len = 0;
     input_string.cursor_count      = 0;
 
-    if (initSdl())
+    // the video driver has to be picked before anything starts, and the
+    // sheets before anything draws; --sheet adds one, in order, otherwise
+    // it's SHEET_FILE alone
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--sheet") == 0 && i + 1 < argc &&
+                 sheetCount < ATLAS_SHEETS)
+            sheetFiles[sheetCount++] = argv[++i];
+    }
+
+    if (initSdl(headless))
     {
         initButtons(buttons);
 
-        initTextureMap(&sheetTexture, "");
+        // the level list is kept up to date from here on, see mapIndexRefresh
+        if (!mapIndexOpen(&mapIndex, "maps"))
+            printf("Failed to write the map index!\n");
+
+        // every sheet in one texture, packed once and read back after
+        if (!atlasInit(&atlas, renderer, sheetFiles, SDL_max(sheetCount, 1),
+                       "maps"))
+            printf("Failed to load the piece sheets!\n");
+
+        editor->tilePieceClips = atlas.clips[0];
+        batchInit(&sheetBatch, renderer, atlas.texture);
 
         FC_LoadFont(fontTexture,
                     renderer,
@@ -225,20 +400,204 @@ int main()
 
         int timer = 0;
 
-        initLevel(level);
+        initLevel(level, 20, 12);
         initEditor(editor, *level);
 
+        mapInit(&tileMap, level->tiles_x, level->tiles_y, level->tile_size);
+
+        // chunks are drawn from baked textures when the renderer can
+        if (!tileCacheInit(&tileCache,
+                           renderer,
+                           &sheetBatch,
+                           editor->tilePieceClips,
+                           level->tile_piece_size))
+            printf("No render targets, drawing tiles one by one.\n");
+
+        // previews for the load screen, made off the main thread; raw files
+        // are drawn at the default level width
+        if (!thumbsInit(&thumbs, &atlas, "maps", level->tiles_x))
+            printf("Failed to start thumbnails, listing names only.\n");
+
+        // far out chunks are drawn from the same piece averages
+        if (!lodInit(&lod, renderer, atlas.average[0]))
+            printf("No level of detail atlas, far zoom draws every chunk.\n");
+
+        // full size png of the level on F5, made off the main thread
+        if (!exportInit(&exporter, atlas.surface))
+            printf("Failed to set up exporting.\n");
+
+        // the software renderer pays for every copy, with --composite the
+        // level is composited on the cpu and drawn as one texture instead;
+        // map_bench draw compares it with the other paths
+        if (!compositorInit(&compositor,
+                            renderer,
+                            atlas.surface,
+                            SCREEN_WIDTH,
+                            SCREEN_HEIGHT))
+            printf("Failed to set up the compositor.\n");
+
+        // the bucket tool, only paints where the brush could
+        if (fillInit(&filler))
+        {
+            filler.allowed = chunkReady;
+            filler.touched = chunkTouched;
+            filler.run     = fillRun;
+            filler.data    = editor;
+        }
+        else
+            printf("Failed to set up filling.\n");
+
+        // copies of parts of a level, ctrl+1 to 4 pick which
+        if (!clipboardInit(&clipboard, renderer, &atlas))
+            printf("Failed to set up the clipboard.\n");
+
+        // shortcuts hold single pieces until given a stamp
+        for (int i = 0; i < 10; i++)
+        {
+            stampInit(&stamps[i]);
+
+            stamps[i].changed = stampChanged;
+            stamps[i].data    = editor;
+        }
+
+        streamInit(&stream, STREAM_BUDGET);
+
+        // --mmap edits the map file in place instead of copying it in and
+        // out, --stream keeps only the chunks around the camera in memory
+        // (--budget, in MB), --legacy-draw copies pieces one at a time
+        // instead of batching them (F4 switches while editing),
+        // --composite draws pieces on the cpu, meant for the software
+        // renderer (F6 switches),
+        // --continuous redraws every frame instead of only on changes,
+        // --undo-budget caps the undo history (in MB);
+        // --headless draws HEADLESS_SCENES without a display, --frames times
+        // each (60 by default), the last is saved to --capture (a directory)
+        // and --map picks the level, otherwise it's a blank one
+        for (int i = 1; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--mmap") == 0)
+                tileMap.io = MAP_IO_MMAP;
+            else if (strcmp(argv[i], "--stream") == 0)
+                tileMap.io = MAP_IO_STREAM;
+            else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+                stream.budget = (size_t)atoi(argv[++i]) << 20;
+            else if (strcmp(argv[i], "--legacy-draw") == 0)
+                sheetBatch.legacy = true;
+            else if (strcmp(argv[i], "--composite") == 0)
+                editor->composite = compositor.texture != NULL;
+            else if (strcmp(argv[i], "--continuous") == 0)
+                editor->continuous = true;
+            else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+                headlessFrames = SDL_max(atoi(argv[++i]), 1);
+            else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+                captureDir = argv[++i];
+            else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc)
+                headlessMap = argv[++i];
+            else if (strcmp(argv[i], "--undo-budget") == 0 && i + 1 < argc)
+                undoBudget = (size_t)SDL_max(atoi(argv[++i]), 1) << 20;
+        }
+
+        // every edit goes through the history, without it nothing is kept
+        if (undoInit(&history, undoBudget))
+        {
+            history.allowed = chunkReady;
+            history.touched = chunkTouched;
+            history.data    = editor;
+        }
+        else
+            printf("Failed to set up undo, edits can't be taken back.\n");
+
+        if (!autosaveInit(&autosave, &tileMap))
+            printf("Failed to start autosave, saving on the main thread.\n");
+
+        if (!loaderInit(&loader))
+            printf("Failed to start loader, loading on the main thread.\n");
+
+        // one row of tiles, map files are streamed through it
+        fileBufferSize     = level->tiles_x << 2;
+        editor->fileBuffer = calloc(fileBufferSize, sizeof(unsigned char));
+
+        // without render targets every redraw is a full one
+        if (SDL_RenderTargetSupported(renderer))
+            frame = SDL_CreateTexture(renderer,
+                                      SDL_PIXELFORMAT_ARGB8888,
+                                      SDL_TEXTUREACCESS_TARGET,
+                                      SCREEN_WIDTH,
+                                      SCREEN_HEIGHT);
+
         editor->state = E_START;
+        damageAll(editor);
+
+        // scenes are drawn back to back, never waiting on input
+        if (headless)
+        {
+            editor->continuous = true;
+
+            if (!captureInit(&capture, captureDir))
+                printf("Failed to open %s, frames are only timed.\n",
+                       captureDir);
+
+            if (headlessMap != NULL)
+            {
+                autosaveReset(&autosave);
+
+                if (loadMap(editor, *level, headlessMap))
+                {
+                    resizeLevel(editor, level);
+                    snprintf(
+                        editor->fileName, MAP_NAME_SIZE, "%s", headlessMap);
+                }
+                else
+                    printf("Failed to load map %s!\n", headlessMap);
+            }
+
+            editor->viewX = editor->levelRect.w >> 1;
+            editor->viewY = editor->levelRect.h >> 1;
+        }
 
         while (!editor->quit)
         {
             timer = SDL_GetTicks();
 
+            // next headless scene once this one has its frames
+            if (headless && (scene < 0 || capture.frames == headlessFrames))
+            {
+                if (scene >= 0)
+                    captureReport(&capture);
+
+                if (++scene == (int)SDL_arraysize(HEADLESS_SCENES))
+                {
+                    editor->quit = true;
+                    continue;
+                }
+
+                editor->state = HEADLESS_SCENES[scene].state;
+
+                zoomView(editor,
+                         *level,
+                         HEADLESS_SCENES[scene].zoom - editor->zoomLevel,
+                         SCREEN_WIDTH >> 1,
+                         SCREEN_HEIGHT >> 1);
+
+                captureScene(&capture, HEADLESS_SCENES[scene].name);
+            }
+
+            // menus are cheap and redrawn on any event, the editor tracks
+            // its own damage; the window and lost targets need everything
+            SDL_PumpEvents();
+
+            if (SDL_HasEvent(SDL_WINDOWEVENT) ||
+                SDL_HasEvents(SDL_RENDER_TARGETS_RESET,
+                              SDL_RENDER_DEVICE_RESET) ||
+                (editor->state != E_EDIT &&
+                 SDL_HasEvents(SDL_FIRSTEVENT, SDL_LASTEVENT)))
+                damageAll(editor);
+
             // read inputs based on state
             switch (editor->state)
             {
             case E_START:
-                startInputs(editor, e, buttons, fileBufferSize, file_list);
+                startInputs(editor, e, buttons, &mapIndex);
                 break;
             case E_NEW:
                 newInputs(editor, e, buttons, &input_string, level);
@@ -247,18 +606,119 @@ int main()
                 editInputs(editor, e, *level);
                 break;
             case E_MENU:
-                menuInputs(editor, e, buttons, fileBufferSize);
+                menuInputs(editor, e, buttons, *level);
                 break;
             case E_LOAD:
-                loadInputs(editor, e, buttons, file_list, *level);
+                loadInputs(editor, e, buttons, &mapIndex, level);
                 break;
             default:
                 break;
             }
 
-            // clear renderer
+            // chunks decoded by the loader since the last frame
+            if (loaderActive(&loader) &&
+                !loaderPump(&loader, &tileMap, LOADER_BUDGET))
+            {
+                printf("Failed to load map %s!\n", editor->fileName);
+
+                mapClear(&tileMap);
+                tileCacheClear(&tileCache);
+                lodClear(&lod);
+                undoClear(&history);
+                editor->state = E_START;
+            }
+
+            // streamed levels page chunks in and out around the camera
+            if (streamActive(&stream))
+                streamUpdate(&stream,
+                             &tileMap,
+                             editor->camera,
+                             level->tile_size * editor->zoom,
+                             editor->viewX,
+                             editor->viewY);
+
+            // hand edits to the save thread, the overlay shows once it's done;
+            // a half loaded map waits
+            if (!loaderActive(&loader) &&
+                (editor->saveQueued ||
+                 (editor->state == E_EDIT &&
+                  autosaveDue(&autosave, AUTOSAVE_TICKS))))
+            {
+                // a streamed level is its own file, edits are written back
+                if (streamActive(&stream))
+                {
+                    streamFlush(&stream, &tileMap);
+                    autosave.last      = SDL_GetTicks();
+                    editor->saveQueued = false;
+                }
+                else if (autosaveRequest(&autosave))
+                    editor->saveQueued = false;
+            }
+
+            int saved = autosavePoll(&autosave);
+
+            if (saved == 0)
+                saved = streamPoll(&stream);
+
+            switch (saved)
+            {
+            case 1:
+                editor->save        = true;
+                editor->saveCounter = 0;
+                break;
+            case -1:
+                printf("Failed to save map %s!\n", editor->fileName);
+                break;
+            }
+
+            switch (exportPoll(&exporter))
+            {
+            case 1:
+                printf("Exported %s in %.1f s\n",
+                       exporter.path,
+                       (SDL_GetPerformanceCounter() - exporter.start) /
+                           (double)SDL_GetPerformanceFrequency());
+                break;
+            case -1:
+                printf("Failed to export %s!\n", exporter.path);
+                break;
+            }
+
+            // anything that changes the screen without input keeps frames
+            // coming, plus one more once it stops to show the final state
+            bool busyLoading =
+                loaderActive(&loader) || streamBusy(&stream) ||
+                (editor->state == E_LOAD && thumbsBusy(&thumbs));
+
+            bool busy = editor->continuous || editor->save || editor->stats ||
+                        busyLoading;
+
+            if (busy || wasBusy)
+                damageAll(editor);
+
+            wasBusy = busy;
+
+            // nothing changed, sleep until something does
+            if (SDL_RectEmpty(&editor->damage))
+            {
+                SDL_WaitEventTimeout(NULL, IDLE_TICKS);
+                continue;
+            }
+
+            if (headless)
+                captureFrameStart(&capture);
+
+            // redraw the damage into the kept frame, or everything
             SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
-            SDL_RenderClear(renderer);
+
+            if (frame != NULL)
+            {
+                SDL_SetRenderTarget(renderer, frame);
+                SDL_RenderSetClipRect(renderer, &editor->damage);
+                SDL_RenderFillRect(renderer, &editor->damage);
+            }
+            else
+                SDL_RenderClear(renderer);
 
             // render based on state
             switch (editor->state)
@@ -270,7 +730,7 @@ int main()
                 newRender(editor, renderer, fontTexture, buttons, input_string);
                 break;
             case E_EDIT:
-                editRender(editor, renderer, sheetTexture, fontTexture, *level);
+                editRender(editor, renderer, fontTexture, *level);
                 break;
             case E_MENU:
                 menuRender(editor, renderer, fontTexture, buttons);
@@ -281,22 +741,63 @@ int main()
                            fontTexture,
                            buttons,
                            fileLoader,
-                           file_list);
+                           &mapIndex);
                 break;
             default:
                 break;
             }
 
+            if (frame != NULL)
+            {
+                SDL_RenderSetClipRect(renderer, NULL);
+                SDL_SetRenderTarget(renderer, NULL);
+                SDL_RenderCopy(renderer, frame, NULL, NULL);
+            }
+
+            editor->damage = (SDL_Rect){ 0, 0, 0, 0 };
+
+            // frames drawn while something is still loading aren't counted,
+            // the last counted one is saved
+            if (headless && !busyLoading)
+            {
+                captureFrameEnd(&capture);
+
+                if (capture.frames == headlessFrames && capture.dir[0] != '\0')
+                    captureSave(&capture, renderer);
+            }
+
             // put it all together
             SDL_RenderPresent(renderer);
 
-            // limit framerate to ~60 fps
+            // limit framerate to ~60 fps, headless runs flat out
             int delta = SDL_GetTicks() - timer;
-            if (delta < TICKS)
+            if (!headless && delta < TICKS)
                 SDL_Delay(TICKS - delta);
         }
 
-        freeTexture(&sheetTexture);
+        if (frame != NULL)
+            SDL_DestroyTexture(frame);
+
+        tileCacheFree(&tileCache);
+        lodFree(&lod);
+        exportFree(&exporter);
+        compositorFree(&compositor);
+        fillFree(&filler);
+        clipboardFree(&clipboard);
+        undoFree(&history);
+
+        for (int i = 0; i < 10; i++)
+            stampFree(&stamps[i]);
+        batchFree(&sheetBatch);
+        thumbsFree(&thumbs);
+        mapIndexClose(&mapIndex);
+        streamClose(&stream);
+        loaderFree(&loader);
+        autosaveFree(&autosave);
+        mapFree(&tileMap);
+        free(editor->fileBuffer);
+
+        atlasFree(&atlas);
         FC_FreeFont(fontTexture);
     }
     else
@@ -310,11 +811,15 @@ int main()
 //      MAIN FUNCTION !!!       //
 //////////////////////////////////
 
-bool initSdl(void)
+bool initSdl(bool headless)
 {
     //Initialization flag
     bool success = true;
 
+    // no display needed, the dummy driver's window is never shown
+    if (headless)
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+
     //Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
@@ -329,7 +834,8 @@ bool initSdl(void)
                                   SDL_WINDOWPOS_UNDEFINED,
                                   SCREEN_WIDTH,
                                   SCREEN_HEIGHT,
-                                  SDL_WINDOW_SHOWN);
+                                  headless ? SDL_WINDOW_HIDDEN :
+                                             SDL_WINDOW_SHOWN);
         if (window == NULL)
         {
             printf("Window could not be created! SDL Error: %s\n",
@@ -338,7 +844,25 @@ bool initSdl(void)
         }
         else
         {
-            renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+            // headless frames are drawn in software into an offscreen
+            // surface, machines without a gpu still get a window
+            if (headless)
+            {
+                screen = SDL_CreateRGBSurfaceWithFormat(
+                    0,
+                    SCREEN_WIDTH,
+                    SCREEN_HEIGHT,
+                    32,
+                    SDL_PIXELFORMAT_ARGB8888);
+
+                if (screen != NULL)
+                    renderer = SDL_CreateSoftwareRenderer(screen);
+            }
+            else if ((renderer = SDL_CreateRenderer(
+                          window, -1, SDL_RENDERER_ACCELERATED)) == NULL)
+                renderer =
+                    SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+
             if (renderer == NULL)
             {
                 printf("Could not create renderer! %s\n", SDL_GetError());
@@ -368,47 +892,28 @@ void closeSdl(void)
 {
     SDL_DestroyWindow(window);
     SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(screen);
     window   = NULL;
     renderer = NULL;
+    screen   = NULL;
 
     IMG_Quit();
     SDL_Quit();
 }
 
-bool initTextureMap(texture* sheet, char* str)
+void initLevel(Level* l, int tilesX, int tilesY)
 {
-    bool success = true;
-
-    // make it possible to pick any map
-    sheet->mTexture = loadTexture("../assets/sheet.png");
-
-    if (sheet->mTexture == NULL)
-        success = false;
-    else
-    {
-        sheet->mWidth  = 272;
-        sheet->mHeight = 128;
-    }
+    l->tiles_x = tilesX;
+    l->tiles_y = tilesY;
 
-    return success;
-}
-
-void initLevel(Level* l)
-{
-    l->width  = 640;
-    l->height = 384;
+    l->width  = tilesX << 5;
+    l->height = tilesY << 5;
 
-    l->width_z  = l->width << 1;
-    l->height_z = l->height << 1;
-
-    l->total_tiles       = 240;
+    l->total_tiles       = tilesX * tilesY;
     l->tile_size         = 32;
-    l->tile_size_z       = l->tile_size << 1;
-    l->tile_piece_size_z = l->tile_size << 1;
 
     l->tile_pieces       = 136;
     l->tile_piece_size   = 16;
-    l->tile_piece_size_z = l->tile_piece_size << 1;
 
     l->total_tile_pieces = l->total_tiles << 2;
 }
@@ -424,7 +929,7 @@ void initEditor(Editor* editor, Level level)
     //editor->mapY = 0,
     //editor->tileX = 0,
     //editor->tileY = 0,
-    editor->tileScaled = 4;
+    editor->zoom = 1.0f;
 
     for (int i = 0; i < 10; i++)
     {
@@ -460,35 +965,17 @@ void initEditor(Editor* editor, Level level)
     //editor->selectedTileX = 0;
     //editor->selectedTileY = 0;
     //editor->mButton = 0;
-    //editor->setIndex = 0,
-    //editor->pieceIndex = 0;
     //editor->shortcutIndex = 0;
     editor->grid = 1;
 
     //editor->pressed = false;
     //editor->hold = false;
-    //editor->zoom = false;
     //editor->quit = false;
     //editor->input = false;
     //editor->save = false;
     //editor->create = false;
 
     //editor->saveCounter = 0;
-
-    short clipy = -1; // test for loop
-
-    // !!! EXPERIMENTAL - MIGHT BE MESSED UP !!! //
-    for (int i = 0; i < level.tile_pieces; i++)
-    {
-        if ((i % 17) == 0)
-            clipy++;
-
-        editor->tilePieceClips[i].x = (i % 17) * level.tile_piece_size;
-        editor->tilePieceClips[i].y = (clipy * level.tile_piece_size);
-        editor->tilePieceClips[i].w = level.tile_piece_size;
-        editor->tilePieceClips[i].h = level.tile_piece_size;
-    }
-    // !!! EXPERIMENTAL - WORKS FOR NOW     !!! //
 }
 
 void initButtons(Button buttons[])
@@ -513,8 +1000,80 @@ void initButtons(Button buttons[])
     buttons[B_EXIT].box.y = (SCREEN_HEIGHT >> 1) + (SCREEN_HEIGHT >> 3);
 }
 
+// the level follows the dimensions and sheet of whatever map was loaded last
+void resizeLevel(Editor* e, Level* l)
+{
+    useSheet(e);
+
+    // the clipboard is kept, it can be pasted into the new level
+    e->selection = (SDL_Rect){ 0, 0, 0, 0 };
+    e->selecting = false;
+    e->pasting   = false;
+    e->moving    = false;
+
+    if (l->tiles_x == e->map->width && l->tiles_y == e->map->height)
+        return;
+
+    initLevel(l, e->map->width, e->map->height);
+
+    e->levelRect.w = l->width * e->zoom;
+    e->levelRect.h = l->height * e->zoom;
+
+    free(e->fileBuffer);
+    e->fileBuffer = calloc(l->tiles_x << 2, sizeof(unsigned char));
+}
+
+// the clip table and colours of the sheet the level's header names; the
+// atlas holds every sheet so nothing is reloaded, only rebaked
+void useSheet(Editor* e)
+{
+    int sheet = atlasSheet(e->atlas, e->map->sheetId);
+
+    if (e->tilePieceClips == e->atlas->clips[sheet])
+        return;
+
+    e->tilePieceClips = e->atlas->clips[sheet];
+    e->tiles->clips   = e->tilePieceClips;
+
+    tileCacheClear(e->tiles);
+    lodColours(e->lod, e->atlas->average[sheet]);
+    damageAll(e);
+}
+
+// steps are quarter octaves, the level point under (x, y) stays put
+void zoomView(Editor* e, Level l, int steps, int x, int y)
+{
+    // without the atlas far zoom would rebake every chunk each frame, so it
+    // stops at LOD_ZOOM
+    int lowest    = e->lod->atlas != NULL ? ZOOM_MIN : -ZOOM_STEPS,
+        zoomLevel = SDL_max(SDL_min(e->zoomLevel + steps, ZOOM_MAX), lowest);
+
+    if (zoomLevel == e->zoomLevel)
+        return;
+
+    float zoom = SDL_pow(2.0, (double)zoomLevel / ZOOM_STEPS),
+          k    = zoom / e->zoom;
+
+    int dx = x - (SCREEN_WIDTH >> 1), dy = y - (SCREEN_HEIGHT >> 1);
+
+    e->viewX = (e->viewX + dx) * k - dx;
+    e->viewY = (e->viewY + dy) * k - dy;
+
+    e->zoomLevel = zoomLevel;
+    e->zoom      = zoom;
+
+    e->levelRect.w = l.width * zoom;
+    e->levelRect.h = l.height * zoom;
+
+    setCamera(&e->camera, e->viewX, e->viewY);
+
+    // the palette keeps its own selection
+    if (x >= 272 || y >= 128)
+        e->selectedBox = pieceRect(e, l, e->mapX, e->mapY);
+}
+
 void startInputs(Editor* editor, SDL_Event e, Button buttons[],
-                 const size_t size, L_File* list)
+                 MapIndex* index)
 {
     while (SDL_PollEvent(&e) != 0)
     {
@@ -559,11 +1118,12 @@ void startInputs(Editor* editor, SDL_Event e, Button buttons[],
                         editor->state = E_NEW;
                         break;
                     case B_LOAD:
-                        if (listMapFiles(list, buttons))
-                        {
-                            buttons[B_LOAD].hover = false;
-                            editor->state         = E_LOAD;
-                        }
+                        mapIndexRescan(index);
+
+                        buttons[B_LOAD].hover = false;
+                        editor->listScroll    = 0;
+                        editor->listHover     = -1;
+                        editor->state         = E_LOAD;
                         break;
                     case B_EXIT:
                         editor->quit = true;
@@ -578,22 +1138,47 @@ void startInputs(Editor* editor, SDL_Event e, Button buttons[],
 
 void editInputs(Editor* editor, SDL_Event e, Level l)
 {
+    SDL_Point moves[STROKE_POINTS];
+    int       moveCount = 0;
+
     while (SDL_PollEvent(&e) != 0)
     {
+        // motion is gathered up and handled once, any other event sees it
+        // handled first so clicks and keys land where they happened
+        if (e.type == SDL_MOUSEMOTION)
+        {
+            moveCount = SDL_min(moveCount + 1, STROKE_POINTS);
+            moves[moveCount - 1] = (SDL_Point){ e.motion.x, e.motion.y };
+            continue;
+        }
+
+        if (moveCount > 0)
+        {
+            moveCursor(editor, l, moves, moveCount);
+            moveCount = 0;
+        }
+
         switch (e.type)
         {
         case SDL_QUIT:
             editor->quit = true;
             break;
         case SDL_KEYDOWN:
+            // holding ctrl only arms dragging, other keys change what's shown
+            if (e.key.keysym.sym != SDLK_LCTRL)
+                damageAll(editor);
+
             switch (e.key.keysym.sym)
             {
             case SDLK_ESCAPE:
-                editor->state = E_MENU;
+                if (editor->pasting)
+                    endPaste(editor, l, false);
+                else
+                    editor->state = E_MENU;
                 break;
             case SDLK_TAB:
-                editor->viewX = editor->zoom ? l.width_z >> 1 : l.width >> 1;
-                editor->viewY = editor->zoom ? l.height_z >> 1 : l.height >> 1;
+                editor->viewX = editor->levelRect.w >> 1;
+                editor->viewY = editor->levelRect.h >> 1;
                 break;
             case SDLK_LALT:
                 if (editor->grid++ > 1)
@@ -602,6 +1187,52 @@ void editInputs(Editor* editor, SDL_Event e, Level l)
             case SDLK_LCTRL:
                 editor->hold = true;
                 break;
+            case SDLK_F3:
+                editor->stats = !editor->stats;
+                break;
+            case SDLK_F4:
+                editor->pieces->legacy = !editor->pieces->legacy;
+                break;
+            case SDLK_F5:
+                exportLevel(editor);
+                break;
+            case SDLK_F6:
+                editor->composite =
+                    !editor->composite && editor->compositor->texture != NULL;
+                damageAll(editor);
+                break;
+            case SDLK_b:
+                editor->bucket = !editor->bucket;
+                break;
+            case SDLK_n:
+                editor->diagonal = !editor->diagonal;
+                break;
+            case SDLK_c:
+                if (e.key.keysym.mod & KMOD_CTRL)
+                    copySelection(editor, l, false);
+                break;
+            case SDLK_x:
+                if (e.key.keysym.mod & KMOD_CTRL)
+                    copySelection(editor, l, true);
+                break;
+            case SDLK_v:
+                if (e.key.keysym.mod & KMOD_CTRL)
+                    startPaste(editor, l, false);
+                break;
+            case SDLK_m:
+                startPaste(editor, l, true);
+                break;
+            case SDLK_t:
+                captureStamp(editor);
+                break;
+            case SDLK_z:
+                if (e.key.keysym.mod & KMOD_CTRL)
+                    undoEdit(editor, l, e.key.keysym.mod & KMOD_SHIFT);
+                break;
+            case SDLK_y:
+                if (e.key.keysym.mod & KMOD_CTRL)
+                    undoEdit(editor, l, true);
+                break;
             case SDLK_1:
             case SDLK_2:
             case SDLK_3:
@@ -611,6 +1242,14 @@ void editInputs(Editor* editor, SDL_Event e, Level l)
             case SDLK_7:
             case SDLK_8:
             case SDLK_9:
+                // with ctrl the first few pick a clipboard slot instead
+                if (e.key.keysym.mod & KMOD_CTRL)
+                {
+                    if (e.key.keysym.sym - SDLK_1 < CLIPBOARD_SLOTS)
+                        editor->clipboard->slot = e.key.keysym.sym - SDLK_1;
+                    break;
+                }
+
                 editor->shortcutIndex       = e.key.keysym.sym - SDLK_1;
                 editor->hudShortcutSelect.x = (e.key.keysym.sym - SDLK_1) << 5;
                 break;
@@ -628,176 +1267,705 @@ void editInputs(Editor* editor, SDL_Event e, Level l)
                 break;
             }
             break;
-        case SDL_MOUSEMOTION:
+        case SDL_MOUSEBUTTONDOWN:
             if (!editor->hold)
             {
-                short lx = editor->zoom ? l.width_z - editor->camera.x :
-                                          l.width - editor->camera.x,
-                      ly = editor->zoom ? l.height_z - editor->camera.y :
-                                          l.height - editor->camera.y;
+                int lx = editor->levelRect.w - editor->camera.x,
+                    ly = editor->levelRect.h - editor->camera.y;
 
                 if (((e.motion.x < 272) && (e.motion.x >= 0)) &&
                     ((e.motion.y < 128) && (e.motion.y >= 0)))
                 {
-                    editor->tileX = e.motion.x >> 4;
-                    editor->tileY = e.motion.y >> 4;
+                    // shift and drag picks a block of pieces as a stamp
+                    if (SDL_GetModState() & KMOD_SHIFT)
+                    {
+                        editor->picking  = true;
+                        editor->paletteX = editor->tileX;
+                        editor->paletteY = editor->tileY;
+                    }
+                    else
+                    {
+                        editor->hudShortcuts[editor->shortcutIndex].id =
+                            (editor->tileY * 17) + editor->tileX;
 
-                    editor->selectedBox.x = editor->tileX << 4;
-                    editor->selectedBox.y = editor->tileY << 4;
+                        stampFree(&editor->stamps[editor->shortcutIndex]);
+                    }
 
-                    editor->selectedBox.w = l.tile_piece_size;
-                    editor->selectedBox.h = l.tile_piece_size;
+                    damageAll(editor);
                 }
 
-                else if (((e.motion.x < lx) &&
+                else if (canPaint(editor) &&
+                         ((e.motion.x < lx) &&
                           (e.motion.x > 0 - editor->camera.x)) &&
                          ((e.motion.y < ly) &&
                           (e.motion.y > 0 - editor->camera.y)))
                 {
-                    editor->selectedBox.w =
-                        editor->zoom ? l.tile_size : l.tile_piece_size;
-                    editor->selectedBox.h =
-                        editor->zoom ? l.tile_size : l.tile_piece_size;
-
-                    // so proud of this lol, trial and error
-                    editor->mapX =
-                        (e.motion.x + editor->camera.x + l.width - l.width) >>
-                        editor->tileScaled;
-                    editor->mapY =
-                        (e.motion.y + editor->camera.y + l.height - l.height) >>
-                        editor->tileScaled;
-
-                    editor->selectedBox.x =
-                        (editor->mapX << editor->tileScaled) - editor->camera.x;
-                    editor->selectedBox.y =
-                        (editor->mapY << editor->tileScaled) - editor->camera.y;
-
-                    editor->pieceIndex =
-                        ((editor->mapY >> 1) * 20) + (editor->mapX >> 1);
-                    editor->setIndex =
-                        ((editor->mapY % 2) * 2) + (editor->mapX % 2);
-
-                    if (editor->pressed)
+                    damageRect(editor, editor->selectedBox);
+
+                    // a paste goes down on left and is dropped on right,
+                    // shift and left starts a marquee
+                    if (editor->pasting)
+                        endPaste(
+                            editor, l, e.button.button == SDL_BUTTON_LEFT);
+                    else if (e.button.button == SDL_BUTTON_LEFT &&
+                             (SDL_GetModState() & KMOD_SHIFT))
                     {
-                        if (editor->mButton == SDL_BUTTON_LEFT)
-                        {
-                            editor->tileSet[editor->pieceIndex]
-                                .set[editor->setIndex] =
-                                editor->hudShortcuts[editor->shortcutIndex].id;
-                        }
-                        else if (editor->mButton == SDL_BUTTON_RIGHT)
-                        {
-                            editor->tileSet[editor->pieceIndex]
-                                .set[editor->setIndex] = 135;
-                        }
+                        damageRect(editor,
+                                   tilesRect(editor, l, editor->selection));
+
+                        editor->selecting = true;
+                        editor->selectX   = editor->mapX >> 1;
+                        editor->selectY   = editor->mapY >> 1;
+                        editor->selection = (SDL_Rect){
+                            editor->selectX, editor->selectY, 1, 1
+                        };
+
+                        damageRect(editor,
+                                   tilesRect(editor, l, editor->selection));
+                    }
+                    else if ((e.button.button == SDL_BUTTON_LEFT ||
+                              e.button.button == SDL_BUTTON_RIGHT) &&
+                             editor->bucket)
+                    {
+                        editor->mButton = e.button.button;
+                        fillAt(editor, l);
+                    }
+                    else if (e.button.button == SDL_BUTTON_LEFT ||
+                             e.button.button == SDL_BUTTON_RIGHT)
+                    {
+                        editor->mButton  = e.button.button;
+                        editor->pressed  = true;
+                        editor->stroking = false;
+
+                        // the whole stroke is undone at once
+                        undoBegin(editor->history, false);
+                        paintTo(editor, l, editor->mapX, editor->mapY);
                     }
                 }
             }
             else
             {
-                if (editor->pressed)
+                if (e.button.button == SDL_BUTTON_LEFT)
                 {
-                    editor->viewX -= e.motion.x - editor->mouseX;
-                    editor->viewY -= e.motion.y - editor->mouseY;
+                    editor->mouseX = e.motion.x;
+                    editor->mouseY = e.motion.y;
+
+                    editor->mButton = SDL_BUTTON_LEFT;
+                    editor->pressed = true;
+                }
+            }
+            break;
+        case SDL_MOUSEBUTTONUP:
+            finishEdit(editor);
+
+            if (editor->picking)
+            {
+                pickStamp(editor);
+                damageAll(editor);
+            }
+
+            editor->mButton   = 0;
+            editor->pressed   = false;
+            editor->stroking  = false;
+            editor->selecting = false;
+            editor->picking   = false;
+            break;
+        case SDL_MOUSEWHEEL:
+            damageAll(editor);
+
+            // towards whatever is under the cursor
+            {
+                int x, y;
+
+                SDL_GetMouseState(&x, &y);
+                zoomView(editor, l, e.wheel.y, x, y);
+            }
+            break;
+        }
+    }
+
+    if (moveCount > 0)
+        moveCursor(editor, l, moves, moveCount);
+}
+
+// a frame's motion events as one move: the selection follows the last
+// point, a held button paints along all of them and ctrl drags the view
+void moveCursor(Editor* e, Level l, SDL_Point points[], int count)
+{
+    SDL_Point last = points[count - 1];
+
+    if (e->hold)
+    {
+        if (e->pressed)
+        {
+            damageAll(e);
+
+            e->viewX -= last.x - e->mouseX;
+            e->viewY -= last.y - e->mouseY;
+
+            e->mouseX = last.x;
+            e->mouseY = last.y;
+        }
+        return;
+    }
+
+    // where the selection was and where it ends up, painting stays inside
+    // the latter; the same for the marquee or paste
+    SDL_Rect marked = markedTiles(e);
+
+    damageRect(e, e->selectedBox);
+    damageRect(e, stampRect(e, l));
+
+    int lx = e->levelRect.w - e->camera.x, ly = e->levelRect.h - e->camera.y;
+
+    for (int i = 0; i < count; i++)
+    {
+        SDL_Point p = points[i];
+
+        bool palette = p.x < 272 && p.x >= 0 && p.y < 128 && p.y >= 0,
+             level   = p.x < lx && p.x > 0 - e->camera.x && p.y < ly &&
+                     p.y > 0 - e->camera.y;
+
+        // leaving the level ends the stroke, coming back starts a new one
+        if (palette || !level)
+        {
+            e->stroking = false;
+
+            if (i == count - 1)
+                e->aiming = false;
+
+            // picking a stamp boxes every piece from where it started
+            if (palette && i == count - 1)
+            {
+                e->tileX = p.x >> 4;
+                e->tileY = p.y >> 4;
+
+                int x0 = e->picking ? SDL_min(e->tileX, e->paletteX) : e->tileX,
+                    y0 = e->picking ? SDL_min(e->tileY, e->paletteY) : e->tileY,
+                    x1 = e->picking ? SDL_max(e->tileX, e->paletteX) : e->tileX,
+                    y1 = e->picking ? SDL_max(e->tileY, e->paletteY) : e->tileY;
+
+                e->selectedBox.x = x0 << 4;
+                e->selectedBox.y = y0 << 4;
+
+                e->selectedBox.w = (x1 - x0 + 1) * l.tile_piece_size;
+                e->selectedBox.h = (y1 - y0 + 1) * l.tile_piece_size;
+            }
+            continue;
+        }
+
+        pickPiece(e, l, p.x, p.y);
+
+        if (e->pressed)
+            paintTo(e, l, e->mapX, e->mapY);
+
+        if (i == count - 1)
+        {
+            e->selectedBox = pieceRect(e, l, e->mapX, e->mapY);
+            e->aiming      = true;
+        }
+    }
+
+    damageRect(e, e->selectedBox);
+    damageRect(e, stampRect(e, l));
+
+    if (e->selecting)
+    {
+        int tx = e->mapX >> 1, ty = e->mapY >> 1;
+
+        e->selection = (SDL_Rect){ SDL_min(tx, e->selectX),
+                                   SDL_min(ty, e->selectY),
+                                   abs(tx - e->selectX) + 1,
+                                   abs(ty - e->selectY) + 1 };
+    }
+
+    if (e->selecting || e->pasting)
+    {
+        damageRect(e, tilesRect(e, l, marked));
+        damageRect(e, tilesRect(e, l, markedTiles(e)));
+    }
+}
+
+// paints from the stroke's last piece to (px, py) with no gaps, Bresenham
+// over the piece grid, then damages the box around the line once
+void paintTo(Editor* e, Level l, int px, int py)
+{
+    short  id    = heldPiece(e);
+    Stamp* stamp = e->mButton == SDL_BUTTON_LEFT ? heldStamp(e) : NULL;
+
+    int x = e->stroking ? e->strokeX : px, y = e->stroking ? e->strokeY : py;
+
+    // the start was painted by the call before
+    if (e->stroking && x == px && y == py)
+        return;
+
+    int dx = abs(px - x), dy = -abs(py - y), sx = x < px ? 1 : -1,
+        sy = y < py ? 1 : -1, err = dx + dy;
+
+    SDL_Rect box = pieceRect(e, l, x, y), end = pieceRect(e, l, px, py);
+
+    for (bool first = e->stroking; true; first = false)
+    {
+        if (!first && stamp != NULL)
+            stampAt(e, l, x, y);
+        else if (!first && canPaintPiece(e, x, y))
+            setPiece(e, x, y, id);
+
+        if (x == px && y == py)
+            break;
+
+        int e2 = err << 1;
+
+        if (e2 >= dy)
+        {
+            err += dy;
+            x += sx;
+        }
+        if (e2 <= dx)
+        {
+            err += dx;
+            y += sy;
+        }
+    }
+
+    SDL_UnionRect(&box, &end, &box);
+    damageRect(e, box);
+
+    e->strokeX  = px;
+    e->strokeY  = py;
+    e->stroking = true;
+}
+
+// the selected shortcut's stamp, NULL while it holds a single piece
+Stamp* heldStamp(Editor* e)
+{
+    Stamp* s = &e->stamps[e->shortcutIndex];
+
+    return s->w > 0 ? s : NULL;
+}
+
+// where the held stamp goes down with the cursor at (px, py), in pieces
+SDL_Rect stampPieces(Stamp* s, int px, int py)
+{
+    return (SDL_Rect){ px - (s->w >> 1), py - (s->h >> 1), s->w, s->h };
+}
+
+// the held stamp centred on (px, py); a drag lays copies side by side on a
+// grid from its first one, each cell stamped once however long the cursor
+// stays in it
+void stampAt(Editor* e, Level l, int px, int py)
+{
+    Stamp*   s  = heldStamp(e);
+    SDL_Rect at = stampPieces(s, px, py);
+    int      cx = 0, cy = 0;
+
+    if (e->stroking)
+    {
+        int dx = at.x - e->stampX, dy = at.y - e->stampY;
+
+        // rounding down either side of the first copy
+        cx = (dx >= 0 ? dx : dx - s->w + 1) / s->w;
+        cy = (dy >= 0 ? dy : dy - s->h + 1) / s->h;
+
+        if (cx == e->cellX && cy == e->cellY)
+            return;
+
+        at.x = e->stampX + cx * s->w;
+        at.y = e->stampY + cy * s->h;
+    }
+    else
+    {
+        e->stampX = at.x;
+        e->stampY = at.y;
+    }
+
+    e->cellX = cx;
+    e->cellY = cy;
+
+    SDL_Rect tiles = { at.x >> 1,
+                       at.y >> 1,
+                       ((at.x + at.w - 1) >> 1) - (at.x >> 1) + 1,
+                       ((at.y + at.h - 1) >> 1) - (at.y >> 1) + 1 };
+
+    if (!canPaintTiles(e, tiles))
+        return;
+
+    if (!stampApply(s, e->map, at.x, at.y))
+        printf("Out of memory, the stamp only went down in part.\n");
+
+    tilesChanged(e, l, tiles);
+}
+
+// stamps write tiles in bulk and report each piece they changed for undo
+void stampChanged(void* data, int px, int py, short old, short id)
+{
+    Editor* e = data;
+
+    undoRecord(e->history, e->map, px, py, 1, old, id);
+}
+
+// T turns the marquee into a stamp on the selected shortcut, its empty
+// pieces see-through
+void captureStamp(Editor* e)
+{
+    SDL_Rect level = { 0, 0, e->map->width, e->map->height }, tiles;
+
+    if (e->pasting || !SDL_IntersectRect(&e->selection, &level, &tiles))
+        return;
+
+    if ((tiles.w << 1) > STAMP_SIDE || (tiles.h << 1) > STAMP_SIDE)
+    {
+        printf("Stamps are at most %d pieces a side.\n", STAMP_SIDE);
+        return;
+    }
+
+    if (!stampFromMap(&e->stamps[e->shortcutIndex],
+                      e->map,
+                      tiles.x << 1,
+                      tiles.y << 1,
+                      tiles.w << 1,
+                      tiles.h << 1))
+        printf("Failed to make a stamp.\n");
+}
+
+// the palette pieces shift and drag went over, one of them is a plain
+// shortcut and more a stamp
+void pickStamp(Editor* e)
+{
+    int x0 = SDL_min(e->tileX, e->paletteX),
+        y0 = SDL_min(e->tileY, e->paletteY),
+        w  = abs(e->tileX - e->paletteX) + 1,
+        h  = abs(e->tileY - e->paletteY) + 1;
+
+    e->picking = false;
+
+    if (w == 1 && h == 1)
+    {
+        e->hudShortcuts[e->shortcutIndex].id = y0 * 17 + x0;
+        stampFree(&e->stamps[e->shortcutIndex]);
+        return;
+    }
+
+    unsigned char ids[17 * 8];
+
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            ids[y * w + x] = (y0 + y) * 17 + x0 + x;
+
+    if (!stampFromPieces(&e->stamps[e->shortcutIndex], ids, w, h))
+        printf("Failed to make a stamp.\n");
+}
+
+// the held stamp around the cursor on screen, empty without one or while
+// the cursor is off the level
+SDL_Rect stampRect(Editor* e, Level l)
+{
+    Stamp* s = heldStamp(e);
+
+    if (s == NULL || !e->aiming || e->pasting || e->bucket)
+        return (SDL_Rect){ 0, 0, 0, 0 };
+
+    SDL_Rect at  = stampPieces(s, e->mapX, e->mapY),
+             box = pieceRect(e, l, at.x, at.y),
+             end = pieceRect(e, l, at.x + at.w - 1, at.y + at.h - 1);
+
+    SDL_UnionRect(&box, &end, &box);
+
+    return box;
+}
+
+// left paints the selected shortcut, right erases
+short heldPiece(Editor* e)
+{
+    return e->mButton == SDL_BUTTON_LEFT ?
+               e->hudShortcuts[e->shortcutIndex].id :
+               EMPTY_PIECE;
+}
+
+// the region under the cursor, B switches to it and N between edges only
+// and corners too; only the chunks written to are rebaked and the damage is
+// the box around what was filled
+void fillAt(Editor* e, Level l)
+{
+    if (e->filler->spans == NULL)
+        return;
+
+    undoBegin(e->history, false);
+
+    bool complete = fillPieces(
+        e->filler, e->map, e->mapX, e->mapY, heldPiece(e), e->diagonal);
+
+    finishEdit(e);
+
+    if (!complete)
+        printf("Fill too intricate, stopped after %ld pieces.\n",
+               e->filler->count);
+
+    if (e->filler->count == 0)
+        return;
+
+    SDL_Rect box = pieceRect(e, l, e->filler->left, e->filler->top),
+             end = pieceRect(e, l, e->filler->right, e->filler->bottom);
+
+    SDL_UnionRect(&box, &end, &box);
+    damageRect(e, box);
+}
+
+// bulk edits stop at chunks the brush couldn't paint either
+bool chunkReady(void* data, int cx, int cy)
+{
+    Editor* e = data;
+
+    return !loaderActive(e->loader) && streamReady(e->stream, cx, cy);
+}
+
+void chunkTouched(void* data, int cx, int cy)
+{
+    Editor* e = data;
+
+    tileCacheInvalidate(
+        e->tiles, cx << (CHUNK_SHIFT + 1), cy << (CHUNK_SHIFT + 1));
+    lodInvalidate(e->lod, cx << (CHUNK_SHIFT + 1), cy << (CHUNK_SHIFT + 1));
+}
+
+// fills go into the history a run at a time
+void fillRun(void* data, int x0, int x1, int py, short old, short id)
+{
+    Editor* e = data;
+
+    undoRecord(e->history, e->map, x0, py, x1 - x0 + 1, old, id);
+}
+
+// what copying src over tiles of the level would change, or clearing them
+// when src is NULL; called before the copy, while the old pieces are there
+void recordTiles(Editor* e, SDL_Rect tiles, Map* src)
+{
+    SDL_Rect level = { 0, 0, e->map->width, e->map->height }, cut;
+
+    if (!SDL_IntersectRect(&tiles, &level, &cut))
+        return;
+
+    for (int py = cut.y << 1; py < (cut.y + cut.h) << 1; py++)
+    {
+        for (int px = cut.x << 1; px < (cut.x + cut.w) << 1; px++)
+        {
+            short id = src != NULL ? mapGetPiece(src,
+                                                 px - (tiles.x << 1),
+                                                 py - (tiles.y << 1)) :
+                                     EMPTY_PIECE;
+
+            undoRecord(
+                e->history, e->map, px, py, 1, mapGetPiece(e->map, px, py), id);
+        }
+    }
+}
+
+// closes the entry being recorded, if any
+void finishEdit(Editor* e)
+{
+    undoEnd(e->history);
+
+    if (undoLost(e->history))
+        printf("Edit too big to undo, the history was cleared.\n");
+}
+
+// ctrl+z and ctrl+y; a paste in progress is dropped first, so undoing in
+// the middle of a move puts everything back where it started
+void undoEdit(Editor* e, Level l, bool redo)
+{
+    if (e->pasting)
+        endPaste(e, l, false);
+
+    // a held button starts over with its next click
+    e->pressed  = false;
+    e->stroking = false;
+
+    if (redo ? undoRedo(e->history, e->map) : undoUndo(e->history, e->map))
+        damageAll(e);
+}
+
+// the marquee into the clipboard's current slot, cutting clears it after
+bool copySelection(Editor* e, Level l, bool cut)
+{
+    if (SDL_RectEmpty(&e->selection))
+        return false;
+
+    if (!canPaintTiles(e, e->selection))
+    {
+        printf("Part of the selection is still loading.\n");
+        return false;
+    }
+
+    if (!clipboardCopy(e->clipboard, e->map, e->selection))
+    {
+        printf("Failed to copy the selection.\n");
+        return false;
+    }
+
+    if (cut)
+    {
+        undoBegin(e->history, false);
+        recordTiles(e, e->selection, NULL);
+
+        mapCopyTiles(e->map,
+                     e->selection.x,
+                     e->selection.y,
+                     NULL,
+                     0,
+                     0,
+                     e->selection.w,
+                     e->selection.h);
+        tilesChanged(e, l, e->selection);
+
+        finishEdit(e);
+    }
+
+    return true;
+}
+
+// the current clipboard slot follows the cursor until a click puts it down;
+// a move cuts the marquee first and carries it from where it was grabbed
+void startPaste(Editor* e, Level l, bool move)
+{
+    if (e->pasting || (move && !copySelection(e, l, true)))
+        return;
+
+    e->grabX = 0;
+    e->grabY = 0;
+
+    if (move)
+    {
+        e->moveFrom = e->selection;
+        e->grabX    = SDL_max(
+            SDL_min((e->mapX >> 1) - e->selection.x, e->selection.w - 1), 0);
+        e->grabY = SDL_max(
+            SDL_min((e->mapY >> 1) - e->selection.y, e->selection.h - 1), 0);
+    }
+
+    SDL_Rect size = clipboardSize(e->clipboard);
+
+    damageRect(e, tilesRect(e, l, e->selection));
+
+    e->selection = (SDL_Rect){ 0, 0, 0, 0 };
+    e->pasting   = !SDL_RectEmpty(&size);
+    e->moving    = move && e->pasting;
+
+    damageRect(e, tilesRect(e, l, markedTiles(e)));
+}
+
+// places the paste, or drops it; a dropped move goes back where it was, and
+// whatever was put down becomes the marquee
+void endPaste(Editor* e, Level l, bool place)
+{
+    SDL_Rect to = place ? markedTiles(e) : e->moveFrom;
+
+    if (place || e->moving)
+    {
+        if (!canPaintTiles(e, to))
+        {
+            printf("Can't paste over a part of the level still loading.\n");
+            return;
+        }
+
+        SDL_Rect level = { 0, 0, e->map->width, e->map->height };
+
+        // a move's cut and paste are undone together
+        undoBegin(e->history, e->moving);
+        recordTiles(e, to, &e->clipboard->clips[e->clipboard->slot]);
+
+        if (clipboardPaste(e->clipboard, e->map, to.x, to.y))
+        {
+            tilesChanged(e, l, to);
+            SDL_IntersectRect(&to, &level, &e->selection);
+        }
 
-                    editor->mouseX = e.motion.x;
-                    editor->mouseY = e.motion.y;
-                }
-            }
-            break;
-        case SDL_MOUSEBUTTONDOWN:
-            if (!editor->hold)
-            {
-                short lx = editor->zoom ? l.width_z - editor->camera.x :
-                                          l.width - editor->camera.x,
-                      ly = editor->zoom ? l.height_z - editor->camera.y :
-                                          l.height - editor->camera.y;
+        finishEdit(e);
+    }
 
-                if (((e.motion.x < 272) && (e.motion.x >= 0)) &&
-                    ((e.motion.y < 128) && (e.motion.y >= 0)))
-                {
-                    editor->hudShortcuts[editor->shortcutIndex].id =
-                        (editor->tileY * 17) + editor->tileX;
-                }
+    damageRect(e, tilesRect(e, l, markedTiles(e)));
 
-                else if (((e.motion.x < lx) &&
-                          (e.motion.x > 0 - editor->camera.x)) &&
-                         ((e.motion.y < ly) &&
-                          (e.motion.y > 0 - editor->camera.y)))
-                {
-                    editor->pieceIndex =
-                        ((editor->mapY >> 1) * 20) + (editor->mapX >> 1);
-                    editor->setIndex =
-                        ((editor->mapY % 2) * 2) + (editor->mapX % 2);
+    e->pasting = false;
+    e->moving  = false;
+}
 
-                    if (e.button.button == SDL_BUTTON_LEFT)
-                    {
-                        editor->tileSet[editor->pieceIndex]
-                            .set[editor->setIndex] =
-                            editor->hudShortcuts[editor->shortcutIndex].id;
+// tiles outlined on screen: the paste under the cursor, else the marquee
+SDL_Rect markedTiles(Editor* e)
+{
+    if (!e->pasting)
+        return e->selection;
 
-                        editor->mButton = SDL_BUTTON_LEFT;
-                        editor->pressed = true;
-                    }
-                    else if (e.button.button == SDL_BUTTON_RIGHT)
-                    {
-                        editor->tileSet[editor->pieceIndex]
-                            .set[editor->setIndex] = 135;
+    SDL_Rect size = clipboardSize(e->clipboard);
 
-                        editor->mButton = SDL_BUTTON_RIGHT;
-                        editor->pressed = true;
-                    }
-                }
-            }
-            else
-            {
-                if (e.button.button == SDL_BUTTON_LEFT)
-                {
-                    editor->mouseX = e.motion.x;
-                    editor->mouseY = e.motion.y;
+    return (SDL_Rect){ (e->mapX >> 1) - e->grabX,
+                       (e->mapY >> 1) - e->grabY,
+                       size.w,
+                       size.h };
+}
 
-                    editor->mButton = SDL_BUTTON_LEFT;
-                    editor->pressed = true;
-                }
-            }
-            break;
-        case SDL_MOUSEBUTTONUP:
-            editor->mButton = 0;
-            editor->pressed = false;
-            break;
-        case SDL_MOUSEWHEEL:
-            if (e.wheel.y < 0 && editor->zoom)
-            {
-                editor->zoom = false;
+// where tiles are on screen, edges as pieceRect puts them
+SDL_Rect tilesRect(Editor* e, Level l, SDL_Rect tiles)
+{
+    if (SDL_RectEmpty(&tiles))
+        return tiles;
 
-                editor->tileScaled = 4;
+    SDL_Rect box = pieceRect(e, l, tiles.x << 1, tiles.y << 1),
+             end = pieceRect(e,
+                             l,
+                             ((tiles.x + tiles.w) << 1) - 1,
+                             ((tiles.y + tiles.h) << 1) - 1);
 
-                editor->levelRect.w = editor->levelRect.w >> 1;
-                editor->levelRect.h = editor->levelRect.h >> 1;
+    SDL_UnionRect(&box, &end, &box);
 
-                editor->selectedBox.w = l.tile_size;
-                editor->selectedBox.h = l.tile_size;
-            }
-            else if (e.wheel.y > 0 && !editor->zoom)
-            {
-                editor->zoom = true;
+    return box;
+}
 
-                editor->tileScaled = 5;
+bool canPaintTiles(Editor* e, SDL_Rect tiles)
+{
+    SDL_Rect level = { 0, 0, e->map->width, e->map->height };
 
-                editor->levelRect.w = editor->levelRect.w << 1;
-                editor->levelRect.h = editor->levelRect.h << 1;
+    if (!SDL_IntersectRect(&tiles, &level, &tiles))
+        return true;
 
-                editor->selectedBox.w = l.tile_size;
-                editor->selectedBox.h = l.tile_size;
-            }
-            break;
-        }
-    }
+    for (int cy = tiles.y >> CHUNK_SHIFT;
+         cy <= (tiles.y + tiles.h - 1) >> CHUNK_SHIFT;
+         cy++)
+        for (int cx = tiles.x >> CHUNK_SHIFT;
+             cx <= (tiles.x + tiles.w - 1) >> CHUNK_SHIFT;
+             cx++)
+            if (!chunkReady(e, cx, cy))
+                return false;
+
+    return true;
 }
 
-void loadInputs(Editor* edit, SDL_Event event, Button buttons[], L_File* list,
-                Level level)
+// bulk edits rebake every chunk the tiles cross and damage where they are
+void tilesChanged(Editor* e, Level l, SDL_Rect tiles)
+{
+    SDL_Rect level = { 0, 0, e->map->width, e->map->height };
+
+    if (!SDL_IntersectRect(&tiles, &level, &tiles))
+        return;
+
+    for (int cy = tiles.y >> CHUNK_SHIFT;
+         cy <= (tiles.y + tiles.h - 1) >> CHUNK_SHIFT;
+         cy++)
+        for (int cx = tiles.x >> CHUNK_SHIFT;
+             cx <= (tiles.x + tiles.w - 1) >> CHUNK_SHIFT;
+             cx++)
+            chunkTouched(e, cx, cy);
+
+    damageRect(e, tilesRect(e, l, tiles));
+}
+
+void loadInputs(Editor* edit, SDL_Event event, Button buttons[],
+                MapIndex* index, Level* level)
 {
+    // files written or removed while the list is open, an unwatched
+    // directory is only walked now and then
+    mapIndexRefresh(index);
+
+    int maxScroll = SDL_max((int)index->count * LIST_ROW - LIST_HEIGHT, 0);
+
     while (SDL_PollEvent(&event) != 0)
     {
         switch (event.type)
@@ -820,6 +1988,17 @@ void loadInputs(Editor* edit, SDL_Event event, Button buttons[], L_File* list,
             }
             else
                 buttons[B_EXIT].hover = 0;
+
+            // row under the cursor gets the big preview
+            if (event.motion.x > buttons[B_NEW].box.x &&
+                event.motion.x <= buttons[B_NEW].box.x + buttons[B_NEW].box.w &&
+                event.motion.y > buttons[B_NEW].box.y &&
+                event.motion.y <= buttons[B_NEW].box.y + LIST_HEIGHT)
+                edit->listHover =
+                    (event.motion.y - buttons[B_NEW].box.y + edit->listScroll) /
+                    LIST_ROW;
+            else
+                edit->listHover = -1;
             break;
         case SDL_MOUSEBUTTONDOWN:
             if ((event.motion.x > buttons[B_EXIT].box.x &&
@@ -837,30 +2016,34 @@ void loadInputs(Editor* edit, SDL_Event event, Button buttons[], L_File* list,
                           buttons[B_NEW].box.x + buttons[B_NEW].box.w) &&
                      event.motion.y > buttons[B_NEW].box.y &&
                      event.motion.y <=
-                         buttons[B_NEW].box.y + 130) // list box size
+                         buttons[B_NEW].box.y + LIST_HEIGHT) // list box size
             {
-                for (int i = 0; i < 20; i++)
+                // rows follow from the scroll offset, nothing is laid out
+                size_t row =
+                    (event.motion.y - buttons[B_NEW].box.y + edit->listScroll) /
+                    LIST_ROW;
+
+                if (row < index->count)
                 {
-                    if ((event.motion.x > list[i].box.x &&
-                         event.motion.x <= list[i].box.x + list[i].box.w) &&
-                        event.motion.y > list[i].box.y &&
-                        event.motion.y <= list[i].box.y + list[i].box.h)
-                    {
-                        if (loadMap(edit->tileSet,
-                                    edit->fileBuffer,
-                                    level,
-                                    list[i].str)) // only for testing !!!
-                        {
-                            printf("Successfully loaded map! \n");
-                            strcpy(edit->fileName, list[i].str);
-                            edit->state = E_EDIT;
-                        }
+                    char* name = index->entries[row].name;
 
-                        break;
+                    autosaveReset(edit->autosave);
+
+                    if (loadMap(edit, *level, name)) // only for testing !!!
+                    {
+                        printf("Successfully loaded map! \n");
+                        resizeLevel(edit, level);
+                        strcpy(edit->fileName, name);
+                        edit->state = E_EDIT;
                     }
                 }
             }
             break;
+        case SDL_MOUSEWHEEL:
+            edit->listScroll -= event.wheel.y * LIST_ROW;
+            edit->listScroll =
+                SDL_min(SDL_max(edit->listScroll, 0), maxScroll);
+            break;
         }
     }
 }
@@ -923,9 +2106,11 @@ void newInputs(Editor* e, SDL_Event event, Button buttons[], S_Input* input,
                     {
                         if (createNewMap(e, *l, input->string))
                         {
-                            if (loadMap(
-                                    e->tileSet, e->fileBuffer, *l, e->fileName))
+                            if (loadMap(e, *l, e->fileName))
+                            {
+                                resizeLevel(e, l);
                                 e->state = E_EDIT;
+                            }
 
                             else
                                 printf("Error loading file! \n");
@@ -992,8 +2177,7 @@ void newInputs(Editor* e, SDL_Event event, Button buttons[], S_Input* input,
     }
 }
 
-void menuInputs(Editor* e, SDL_Event event, Button buttons[],
-                const size_t bsize)
+void menuInputs(Editor* e, SDL_Event event, Button buttons[], Level level)
 {
     while (SDL_PollEvent(&event) != 0)
     {
@@ -1045,11 +2229,9 @@ void menuInputs(Editor* e, SDL_Event event, Button buttons[],
                      event.motion.y <=
                          buttons[B_LOAD].box.y + buttons[B_LOAD].box.h)
             {
-                if (saveMap(e->tileSet, e->fileBuffer, bsize, e->fileName))
-                {
-                    e->state = E_EDIT;
-                    e->save  = true;
-                }
+                // written on the save thread, see autosaveRequest
+                e->state      = E_EDIT;
+                e->saveQueued = true;
             }
             break;
         }
@@ -1062,101 +2244,163 @@ bool createNewMap(Editor* e, Level l, const char* filename)
 
     bool success = true;
 
+    streamClose(e->stream);
+    loaderCancel(e->loader);
+    autosaveReset(e->autosave);
+    tileCacheClear(e->tiles);
+    lodClear(e->lod);
+    undoClear(e->history);
+
     if (access("maps", F_OK) != 0)
         mkdir("maps", 0700);
     char file[256] = "maps/";
     strncat(file, filename, 256 - strlen(filename));
 
-    FILE* fp = fopen(file, "wb");
+    // a new level starts at the default size and sheet, not the last one's
+    mapClear(e->map);
 
-    if (fp == NULL)
-        success = false;
-    else
-    {
-        for (int i = 0; i < l.total_tile_pieces; i++)
-            e->fileBuffer[i] = 135;
+    e->map->width   = e->map->baseWidth;
+    e->map->height  = e->map->baseHeight;
+    e->map->sheetId = 0;
 
-        fwrite(
-            e->fileBuffer, sizeof(e->fileBuffer[0]), l.total_tile_pieces, fp);
+    // mapped editing needs the raw layout, otherwise write the container
+    if (e->map->io == MAP_IO_MMAP)
+        success = mapSaveRawFile(e->map, file, e->fileBuffer);
+    else
+        success = mapSaveFile(e->map, file);
 
+    if (success)
         strcpy(e->fileName, filename);
-    }
-
-    fclose(fp);
 
     return success;
 }
 
-bool loadMap(tile set[], unsigned char buffer[], Level level, char str[])
+bool loadMap(Editor* e, Level level, char str[])
 {
-    bool success = true;
-
-    short n = -1, t = -1;
-
     char file[256] = "maps/";
     strncat(file, str, 256 - strlen(str));
 
-    FILE* map = fopen(file, "rb");
-
-    if (map == NULL)
-        success = false;
-    else
-    {
-        fread(buffer, sizeof(buffer[0]), level.total_tile_pieces, map);
+    streamClose(e->stream);
+    loaderCancel(e->loader);
+    tileCacheClear(e->tiles);
+    lodClear(e->lod);
+    undoClear(e->history);
 
-        for (int i = 0; i < level.total_tile_pieces; i++)
-        {
-            if ((i % 4) == 0)
-                t++;
+    // falls back to buffered reads when the file can't be mapped
+    if (e->map->io == MAP_IO_MMAP && mapOpenFile(e->map, file))
+        return true;
 
-            if ((i % 80) == 0)
-                n++;
+    // only containers can be streamed, raw levels are loaded whole
+    if (e->map->io == MAP_IO_STREAM && streamOpen(e->stream, e->map, file))
+        return true;
 
-            set[t].box.w = 32;
-            set[t].box.h = 32;
+    // the map fills in over the next frames, see loaderPump
+    if (loaderStart(e->loader, e->map, file))
+        return true;
 
-            set[t].box.x =
-                (((t % 20) + 1) << 5) -
-                level.tile_size; // weird bit hacking, is it faster though?
-            set[t].box.y = ((n + 1) << 5) - level.tile_size;
+    return mapLoadFile(e->map, file);
+}
 
-            set[t].set[i % 4] = buffer[i];
-        }
-    }
+// the chunk under the cursor has to be in memory before it can be painted
+bool canPaint(Editor* e)
+{
+    return canPaintPiece(e, e->mapX, e->mapY);
+}
 
-    fclose(map);
+// the same for any piece, strokes and bulk edits check each one
+bool canPaintPiece(Editor* e, int px, int py)
+{
+    return !loaderActive(e->loader) &&
+           streamReady(
+               e->stream, px >> (CHUNK_SHIFT + 1), py >> (CHUNK_SHIFT + 1));
+}
 
-    return success;
+// edits go through here so the chunk's baked texture is redone
+void setPiece(Editor* e, int px, int py, short id)
+{
+    undoRecord(e->history, e->map, px, py, 1, mapGetPiece(e->map, px, py), id);
+    mapSetPiece(e->map, px, py, id);
+    tileCacheInvalidate(e->tiles, px, py);
+    lodInvalidate(e->lod, px, py);
 }
 
-bool saveMap(tile set[], unsigned char buffer[], const size_t size, char str[])
+// writes exports/<name>.png, kept out of maps so the load list only shows
+// levels; streamed levels fill in the chunks not in memory from their file
+void exportLevel(Editor* e)
 {
-    bool success = true;
+    char path[512], source[512];
 
-    char file[256] = "maps/";
-    strncat(file, str, 256 - strlen(str));
+    if (access("exports", F_OK) != 0)
+        mkdir("exports", 0700);
 
-    FILE* map = fopen(file, "wb");
+    snprintf(path,
+             sizeof(path),
+             "exports/%s.png",
+             e->fileName[0] != '\0' ? e->fileName : "level");
+    snprintf(source, sizeof(source), "maps/%s", e->fileName);
 
-    if (map == NULL)
-        success = false;
-    else
+    // the stream thread is still writing evicted chunks back, they have to
+    // be on disk before the export reads the file
+    if (streamActive(e->stream) && !streamSync(e->stream, e->map))
     {
-        short n = -1;
+        printf("Failed to save %s before exporting!\n", source);
+        return;
+    }
 
-        for (int i = 0; i < size; i++)
-        {
-            if (i % 4 == 0)
-                n++;
-            buffer[i] = set[n].set[i % 4];
-        }
+    if (exportStart(e->exporter,
+                    e->map,
+                    e->tilePieceClips,
+                    path,
+                    streamActive(e->stream) ? source : NULL))
+        printf("Exporting %s...\n", path);
+    else
+        printf("Failed to start exporting %s!\n", path);
+}
 
-        fwrite(buffer, sizeof(buffer[0]), size, map);
-    }
+// the piece under screen point (x, y), whose edges are wherever
+// renderTiles puts them
+void pickPiece(Editor* e, Level l, int x, int y)
+{
+    float s  = l.tile_piece_size * e->zoom;
+    int   lx = x + e->camera.x, ly = y + e->camera.y;
+    int   px = (int)(lx / s), py = (int)(ly / s);
+
+    // truncated edges can land a pixel short of the division, and far out
+    // several pieces share a pixel, the last one wins as it does on screen
+    while ((int)((px + 1) * s) <= lx)
+        px++;
+    while ((int)((py + 1) * s) <= ly)
+        py++;
+
+    e->mapX = SDL_min(px, (l.width / l.tile_piece_size) - 1);
+    e->mapY = SDL_min(py, (l.height / l.tile_piece_size) - 1);
+}
+
+// screen box of piece (px, py), at least a pixel however far out
+SDL_Rect pieceRect(Editor* e, Level l, int px, int py)
+{
+    float s  = l.tile_piece_size * e->zoom;
+    int   x0 = (int)(px * s), y0 = (int)(py * s), x1 = (int)((px + 1) * s),
+        y1 = (int)((py + 1) * s);
+
+    return (SDL_Rect){ x0 - e->camera.x,
+                       y0 - e->camera.y,
+                       SDL_max(x1 - x0, 1),
+                       SDL_max(y1 - y0, 1) };
+}
 
-    fclose(map);
+// screen rects changed since the last frame, only those are redrawn
+void damageRect(Editor* e, SDL_Rect box)
+{
+    if (SDL_RectEmpty(&e->damage))
+        e->damage = box;
+    else
+        SDL_UnionRect(&e->damage, &box, &e->damage);
+}
 
-    return success;
+void damageAll(Editor* e)
+{
+    e->damage = (SDL_Rect){ 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
 }
 
 void startRender(Editor* e, SDL_Renderer* renderer, FC_Font* texture,
@@ -1198,33 +2442,146 @@ void startRender(Editor* e, SDL_Renderer* renderer, FC_Font* texture,
     }
 }
 
-void editRender(Editor* editor, SDL_Renderer* renderer, texture sheet,
-                FC_Font* font, Level level)
+void editRender(Editor* editor, SDL_Renderer* renderer, FC_Font* font,
+                Level level)
 {
     // set the viewport camera
     setCamera(&editor->camera, editor->viewX, editor->viewY);
-    editor->levelRect.x =
-        editor->tileSet[0].box.x - editor->camera.x; // set level rect
-    editor->levelRect.y = editor->tileSet[0].box.y - editor->camera.y; //
+    editor->levelRect.x = -editor->camera.x; // set level rect
+    editor->levelRect.y = -editor->camera.y; //
 
     // draw grid lines
     SDL_SetRenderDrawColor(renderer, 0x99, 0x99, 0x99, 0x00);
     SDL_RenderDrawRect(renderer, &editor->levelRect);
     renderGrid(renderer, &editor->camera, editor->grid, editor->zoom, level);
 
+    Uint64 start = SDL_GetPerformanceCounter();
+
     // render all map tiles
-    renderTiles(&sheet, *editor, level);
+    renderTiles(editor->pieces, *editor, level);
+
+    // draw hud stuff, the palette and shortcuts go out in one batch
+    renderTilePieces(editor->pieces, editor->tilePieceClips, level);
+    renderShortcuts(renderer,
+                    editor->pieces,
+                    editor->hudShortcuts,
+                    editor->stamps,
+                    editor->tilePieceClips);
+    batchFlush(editor->pieces);
+    renderStamps(editor, renderer);
+
+    editor->drawTime = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                       SDL_GetPerformanceFrequency();
 
-    // draw hud stuff
-    renderTilePieces(&sheet, editor->tilePieceClips, level);
-    renderShortcuts(
-        renderer, &sheet, editor->hudShortcuts, editor->tilePieceClips);
     SDL_RenderDrawRect(renderer, &editor->hudShortcutSelect);
 
     // draw selected rect
     SDL_SetRenderDrawColor(renderer, 0x00, 0xff, 0x00, 0xff);
     SDL_RenderDrawRect(renderer, &editor->selectedBox);
 
+    // the marquee, or the paste see-through under the cursor
+    if (editor->pasting)
+    {
+        SDL_Rect box   = tilesRect(editor, level, markedTiles(editor));
+        int      sheet = atlasSheet(editor->atlas, editor->map->sheetId);
+        texture  preview = { clipboardPreview(editor->clipboard, sheet), 0, 0 };
+
+        if (preview.mTexture != NULL)
+        {
+            int w, h;
+
+            SDL_QueryTexture(preview.mTexture, NULL, NULL, &w, &h);
+
+            SDL_Rect clip = { 0, 0, w, h };
+
+            renderTexture(&preview,
+                          box.x,
+                          box.y,
+                          &clip,
+                          SDL_FLIP_NONE,
+                          level.tile_piece_size * editor->zoom /
+                              editor->clipboard->previewPiece);
+        }
+
+        SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0x00, 0xff);
+        SDL_RenderDrawRect(renderer, &box);
+    }
+    else if (!SDL_RectEmpty(&editor->selection))
+    {
+        SDL_Rect box = tilesRect(editor, level, editor->selection);
+
+        SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0x00, 0xff);
+        SDL_RenderDrawRect(renderer, &box);
+    }
+
+    // the held stamp see-through under the cursor, one copy of its cached
+    // preview however big it is
+    SDL_Rect stampBox = stampRect(editor, level);
+
+    if (!SDL_RectEmpty(&stampBox))
+    {
+        int          sheet   = atlasSheet(editor->atlas, editor->map->sheetId);
+        SDL_Texture* preview = stampPreview(
+            heldStamp(editor), renderer, editor->atlas, sheet);
+
+        if (preview != NULL)
+        {
+            SDL_SetTextureAlphaMod(preview, 0xa0);
+            SDL_RenderCopy(renderer, preview, NULL, &stampBox);
+        }
+
+        SDL_SetRenderDrawColor(renderer, 0x00, 0xff, 0xff, 0xff);
+        SDL_RenderDrawRect(renderer, &stampBox);
+    }
+
+    // progress of a level still loading in the background
+    if (loaderActive(editor->loader))
+    {
+        float    done = loaderProgress(editor->loader);
+        SDL_Rect bar  = { SCREEN_WIDTH >> 2, SCREEN_HEIGHT - 24,
+                          SCREEN_WIDTH >> 1, 8 };
+
+        SDL_SetRenderDrawColor(renderer, 0x40, 0x40, 0x40, 0xff);
+        SDL_RenderFillRect(renderer, &bar);
+
+        bar.w *= done;
+        SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
+        SDL_RenderFillRect(renderer, &bar);
+
+        FC_DrawColor(font,
+                     renderer,
+                     SCREEN_WIDTH >> 2,
+                     SCREEN_HEIGHT - 48,
+                     FC_MakeColor(0xff, 0xff, 0xff, 0xff),
+                     "Loading %s %d%%",
+                     editor->fileName,
+                     (int)(done * 100));
+    }
+
+    // chunk cache counters for this frame, toggled with F3
+    if (editor->stats)
+        FC_DrawColor(font,
+                     renderer,
+                     SCREEN_WIDTH - 320,
+                     SCREEN_HEIGHT - 64,
+                     FC_MakeColor(0xff, 0xff, 0xff, 0xff),
+                     "chunks drawn %d baked %d (%lu total)\n"
+                     "lod drawn %d baked %d, zoom %.3g\n%s %.2f ms, %s",
+                     editor->tiles->draws,
+                     editor->tiles->bakes,
+                     editor->tiles->totalBakes,
+                     editor->lod->draws,
+                     editor->lod->bakes,
+                     editor->zoom,
+                     editor->composite      ? "composited" :
+                     editor->pieces->legacy ? "legacy" :
+                                              "batched",
+                     editor->drawTime,
+                     editor->bucket && editor->diagonal ? "fill 8" :
+                     editor->bucket                     ? "fill 4" :
+                     heldStamp(editor) != NULL          ? "stamp" :
+                                                          "brush");
+
     // draw text when file is saved
     if (editor->save) // maybe move somewhere else?
     {
@@ -1247,22 +2604,98 @@ void editRender(Editor* editor, SDL_Renderer* renderer, texture sheet,
 }
 
 void loadRender(Editor* e, SDL_Renderer* renderer, FC_Font* texture,
-                Button buttons[], SDL_Rect fileLoader, L_File list[])
+                Button buttons[], SDL_Rect fileLoader, MapIndex* index)
 {
     // file window
     SDL_SetRenderDrawColor(renderer, 0x80, 0x80, 0x80, 0xff);
     SDL_RenderFillRect(renderer, &fileLoader);
 
-    for (int i = 0; i < 20; i++)
+    // only the rows inside the window, however long the list is
+    size_t first = e->listScroll / LIST_ROW,
+           last  = (e->listScroll + fileLoader.h) / LIST_ROW + 1;
+
+    if (last > index->count)
+        last = index->count;
+
+    // previews finished since the last frame
+    thumbsUpdate(e->thumbs, renderer, index);
+
+    // rows are cut to the window, inside whatever damage is being redrawn
+    SDL_Rect clip, list = fileLoader;
+    SDL_bool clipped = SDL_RenderIsClipEnabled(renderer);
+
+    SDL_RenderGetClipRect(renderer, &clip);
+
+    if (clipped && !SDL_IntersectRect(&fileLoader, &clip, &list))
+        list.w = list.h = 0;
+
+    SDL_RenderSetClipRect(renderer, &list);
+
+    for (size_t i = first; i < last; i++)
     {
-        if (list[i].box.x == 0)
-            continue;
+        MapEntry* entry = &index->entries[i];
+
+        int y = fileLoader.y + (int)i * LIST_ROW - e->listScroll;
+
+        SDL_Rect icon = { fileLoader.x + 1, y + 1, LIST_ROW - 2, LIST_ROW - 2 };
+        renderThumb(renderer, thumbsGet(e->thumbs, renderer, entry), icon);
+
+        FC_Draw(
+            texture, renderer, fileLoader.x + LIST_ROW, y, "%s", entry->name);
+
+        // the size is known once its file has been read
+        if (entry->pending)
+            FC_DrawAlign(texture,
+                         renderer,
+                         fileLoader.x + fileLoader.w - 8,
+                         y,
+                         FC_ALIGN_RIGHT,
+                         "...");
+        else if (entry->width > 0)
+            FC_DrawAlign(texture,
+                         renderer,
+                         fileLoader.x + fileLoader.w - 8,
+                         y,
+                         FC_ALIGN_RIGHT,
+                         "%dx%d",
+                         entry->width,
+                         entry->height);
         else
-        {
-            SDL_RenderFillRect(renderer, &list[i].box);
-            FC_Draw(
-                texture, renderer, list[i].box.x, list[i].box.y, list[i].str);
-        }
+            FC_DrawAlign(texture,
+                         renderer,
+                         fileLoader.x + fileLoader.w - 8,
+                         y,
+                         FC_ALIGN_RIGHT,
+                         "raw %lluK",
+                         (unsigned long long)(entry->size >> 10));
+    }
+
+    SDL_RenderSetClipRect(renderer, clipped ? &clip : NULL);
+
+    if (e->listHover >= 0 && (size_t)e->listHover < index->count)
+    {
+        SDL_Rect preview = { fileLoader.x + fileLoader.w + 16,
+                             fileLoader.y,
+                             THUMB_SIZE,
+                             THUMB_SIZE };
+
+        MapEntry* entry = &index->entries[e->listHover];
+
+        renderThumb(renderer, thumbsGet(e->thumbs, renderer, entry), preview);
+    }
+
+    // scroll bar once the list doesn't fit
+    if ((int)index->count * LIST_ROW > fileLoader.h)
+    {
+        int total = index->count * LIST_ROW;
+
+        SDL_Rect bar = { fileLoader.x + fileLoader.w - 4,
+                         fileLoader.y + e->listScroll * fileLoader.h / total,
+                         4,
+                         SDL_max(fileLoader.h * fileLoader.h / total, 8) };
+
+        SDL_SetRenderDrawColor(renderer, 0xc0, 0xc0, 0xc0, 0xff);
+        SDL_RenderFillRect(renderer, &bar);
     }
 
     if (buttons[B_EXIT].hover)
@@ -1353,6 +2786,27 @@ void newRender(Editor* e, SDL_Renderer* r, FC_Font* t, Button btns[],
             "Cancel");
 }
 
+// fits a preview into box keeping its aspect, nothing while it's not ready
+void renderThumb(SDL_Renderer* r, SDL_Texture* thumb, SDL_Rect box)
+{
+    int w, h;
+
+    if (thumb == NULL || SDL_QueryTexture(thumb, NULL, NULL, &w, &h) != 0)
+        return;
+
+    SDL_Rect dst = box;
+
+    if (w > h)
+        dst.h = SDL_max(box.h * h / w, 1);
+    else
+        dst.w = SDL_max(box.w * w / h, 1);
+
+    dst.x += (box.w - dst.w) >> 1;
+    dst.y += (box.h - dst.h) >> 1;
+
+    SDL_RenderCopy(r, thumb, NULL, &dst);
+}
+
 void freeTexture(texture* text)
 {
     if (text->mTexture != NULL)
@@ -1366,14 +2820,14 @@ void freeTexture(texture* text)
 }
 
 void renderTexture(texture* text, int x, int y, SDL_Rect* clip,
-                   const SDL_RendererFlip flip, bool zoom)
+                   const SDL_RendererFlip flip, float zoom)
 {
     SDL_Rect renderQuad = { x, y, text->mWidth, text->mHeight };
 
     if (clip != NULL)
     {
-        renderQuad.w = zoom ? clip->w << 1 : clip->w;
-        renderQuad.h = zoom ? clip->h << 1 : clip->h;
+        renderQuad.w = clip->w * zoom;
+        renderQuad.h = clip->h * zoom;
     }
 
     SDL_RenderCopyEx(
@@ -1401,85 +2855,137 @@ SDL_Texture* loadTexture(char path[16])
     return newTexture;
 }
 
-void renderTiles(texture* sheet, Editor editor, Level level)
+// tile edges are truncated from tx * scale so neighbours always meet,
+// however the zoom divides; far out chunks come from the lod atlas in one
+// batch, closer in from their baked textures
+void renderTiles(Batch* sheet, Editor editor, Level level)
 {
-    int x, x2, y, y2;
-
-    //  test tile rendering here!!! //
-    for (int i = 0; i < level.total_tiles; i++)
+    float scale = level.tile_size * editor.zoom;
+    bool  far   = editor.zoom < LOD_ZOOM;
+
+    // visible tile range
+    int tx0 = SDL_max((int)(editor.camera.x / scale), 0),
+        ty0 = SDL_max((int)(editor.camera.y / scale), 0),
+        tx1 = SDL_min((int)((editor.camera.x + editor.camera.w) / scale) + 1,
+                      level.tiles_x),
+        ty1 = SDL_min((int)((editor.camera.y + editor.camera.h) / scale) + 1,
+                      level.tiles_y);
+
+    tileCacheFrame(editor.tiles);
+    lodFrame(editor.lod);
+
+    // all of it on the cpu into one texture, down to where the atlas takes
+    // over
+    if (!far && editor.composite &&
+        compositorDraw(editor.compositor,
+                       editor.map,
+                       editor.tilePieceClips,
+                       &editor.camera,
+                       scale))
+        return;
+
+    for (int cy = ty0 >> CHUNK_SHIFT; cy <= (ty1 - 1) >> CHUNK_SHIFT; cy++)
     {
-        if (checkCollision(editor.tileSet[i].box, editor.camera, editor.zoom))
+        for (int cx = tx0 >> CHUNK_SHIFT; cx <= (tx1 - 1) >> CHUNK_SHIFT; cx++)
         {
-            if (editor.tileSet[i].set[0] == 135 &&
-                editor.tileSet[i].set[1] == 135 &&
-                editor.tileSet[i].set[2] == 135 &&
-                editor.tileSet[i].set[3] == 135)
-                continue; // testing performance !!!
+            uint32_t rows[CHUNK_TILES], painted = 0;
 
-            if (editor.zoom)
-            {
-                x = (editor.tileSet[i].box.x << 1) - editor.camera.x;
-                y = (editor.tileSet[i].box.y << 1) - editor.camera.y;
+            // chunks never painted or since erased are skipped whole
+            if (!mapChunkRows(editor.map, cx, cy, rows))
+                continue;
 
-                x2 = ((editor.tileSet[i].box.x + level.tile_piece_size) << 1) -
-                     editor.camera.x;
-                y2 = ((editor.tileSet[i].box.y + level.tile_piece_size) << 1) -
-                     editor.camera.y;
-            }
-            else
+            for (int i = 0; i < CHUNK_TILES; i++)
+                painted |= rows[i];
+
+            if (painted == 0)
+                continue;
+
+            int ox = cx << CHUNK_SHIFT, oy = cy << CHUNK_SHIFT;
+
+            int x0 = (int)(ox * scale), y0 = (int)(oy * scale),
+                x1 = (int)((ox + CHUNK_TILES) * scale),
+                y1 = (int)((oy + CHUNK_TILES) * scale);
+
+            SDL_Rect dst = { x0 - editor.camera.x,
+                             y0 - editor.camera.y,
+                             x1 - x0,
+                             y1 - y0 };
+
+            if (far && lodDraw(editor.lod, editor.map, cx, cy, &dst))
+                continue;
+
+            // one copy of the baked chunk, tile by tile only as a fallback
+            if (tileCacheDraw(editor.tiles, editor.map, cx, cy, &dst))
+                continue;
+
+            // columns are relative to the chunk, rows are level rows
+            int c0 = SDL_max(tx0, ox) - ox,
+                c1 = SDL_min(tx1, ox + CHUNK_TILES) - ox,
+                r0 = SDL_max(ty0, oy), r1 = SDL_min(ty1, oy + CHUNK_TILES);
+
+            // visible columns of the chunk as a mask over its rows
+            uint32_t window = (uint32_t)(((uint64_t)1 << c1) - 1) &
+                              ~(((uint32_t)1 << c0) - 1);
+
+            for (int ty = r0; ty < r1; ty++)
             {
-                x = editor.tileSet[i].box.x - editor.camera.x;
-                y = editor.tileSet[i].box.y - editor.camera.y;
+                uint32_t bits = rows[ty & CHUNK_MASK] & window;
 
-                x2 = editor.tileSet[i].box.x + level.tile_piece_size -
-                     editor.camera.x;
-                y2 = editor.tileSet[i].box.y + level.tile_piece_size -
-                     editor.camera.y;
-            }
+                unsigned char* row = mapGetTile(editor.map, ox, ty);
+
+                int y = (int)(ty * scale) - editor.camera.y,
+                    y2 = (int)((ty + 1) * scale) - editor.camera.y;
 
-            renderTileTexture(sheet, editor, i, x, y, x2, y2);
+                // only tiles that hold pieces, empty runs cost nothing
+                for (; bits != 0; bits &= bits - 1)
+                {
+                    int tx = ox + __builtin_ctz(bits);
+
+                    renderTileTexture(
+                        sheet,
+                        editor,
+                        row + ((tx - ox) << 2),
+                        (int)(tx * scale) - editor.camera.x,
+                        y,
+                        (int)((tx + 1) * scale) - editor.camera.x,
+                        y2);
+                }
+            }
         }
     }
+
+    lodFlush(editor.lod);
 }
 
-void renderTileTexture(texture* sheet, Editor editor, int i, int x, int y,
-                       int x2, int y2)
+// (x, y) to (x2, y2) is the whole tile, split in half for the pieces
+void renderTileTexture(Batch* sheet, Editor editor, unsigned char set[], int x,
+                       int y, int x2, int y2)
 {
+    int mx = (x + x2) >> 1, my = (y + y2) >> 1;
+
     //  [*][ ]
     //  [ ][ ]
-    renderTexture(sheet,
-                  x,
-                  y,
-                  &editor.tilePieceClips[editor.tileSet[i].set[0]],
-                  SDL_FLIP_NONE,
-                  editor.zoom);
+    batchAdd(sheet,
+             &editor.tilePieceClips[set[0]],
+             &(SDL_Rect){ x, y, mx - x, my - y });
     //  [ ][*]
     //  [ ][ ]
-    renderTexture(sheet,
-                  x2,
-                  y,
-                  &editor.tilePieceClips[editor.tileSet[i].set[1]],
-                  SDL_FLIP_NONE,
-                  editor.zoom);
+    batchAdd(sheet,
+             &editor.tilePieceClips[set[1]],
+             &(SDL_Rect){ mx, y, x2 - mx, my - y });
     //  [ ][ ]
     //  [*][ ]
-    renderTexture(sheet,
-                  x,
-                  y2,
-                  &editor.tilePieceClips[editor.tileSet[i].set[2]],
-                  SDL_FLIP_NONE,
-                  editor.zoom);
+    batchAdd(sheet,
+             &editor.tilePieceClips[set[2]],
+             &(SDL_Rect){ x, my, mx - x, y2 - my });
     //  [ ][ ]
     //  [ ][*]
-    renderTexture(sheet,
-                  x2,
-                  y2,
-                  &editor.tilePieceClips[editor.tileSet[i].set[3]],
-                  SDL_FLIP_NONE,
-                  editor.zoom);
+    batchAdd(sheet,
+             &editor.tilePieceClips[set[3]],
+             &(SDL_Rect){ mx, my, x2 - mx, y2 - my });
 }
 
-void renderTilePieces(texture* sheet, SDL_Rect* clips, Level level)
+void renderTilePieces(Batch* sheet, SDL_Rect* clips, Level level)
 {
     short n = -1;
 
@@ -1488,138 +2994,114 @@ void renderTilePieces(texture* sheet, SDL_Rect* clips, Level level)
         if ((i % 17) == 0)
             n++;
 
-        renderTexture(
-            sheet,
-            (((i % 17) + 1) << 4) -
-                level.tile_piece_size, // weird bit hacking, is it faster though?
-            ((n + 1) << 4) - level.tile_piece_size,
-            &clips[i],
-            false,
-            false);
+        // weird bit hacking, is it faster though?
+        SDL_Rect box = { (((i % 17) + 1) << 4) - level.tile_piece_size,
+                         ((n + 1) << 4) - level.tile_piece_size,
+                         clips[i].w,
+                         clips[i].h };
+
+        batchAdd(sheet, &clips[i], &box);
     }
 }
 
-void setCamera(SDL_Rect* screen, short x, short y)
+void setCamera(SDL_Rect* screen, int x, int y)
 {
     screen->x = x - (SCREEN_WIDTH >> 1);
     screen->y = y - (SCREEN_HEIGHT >> 1);
 }
 
-void renderGrid(SDL_Renderer* r, SDL_Rect* c, short grid, bool zoom,
+// only the lines crossing the screen, as one pixel wide rects sent in as
+// few calls as possible; the level border is drawn by the caller
+void renderGrid(SDL_Renderer* r, SDL_Rect* c, short grid, float zoom,
                 Level level)
 {
-    if (grid)
+    if (!grid)
+        return;
+
+    float step = ((grid == 2) ? level.tile_piece_size : level.tile_size) * zoom;
+
+    // far out the lines would only paint the level grey
+    if (step < GRID_MIN)
+        return;
+
+    int w = level.width * zoom, h = level.height * zoom;
+
+    // visible part of the level, in screen pixels from its corner
+    int x0 = SDL_max(c->x, 0), y0 = SDL_max(c->y, 0),
+        x1 = SDL_min(c->x + c->w, w), y1 = SDL_min(c->y + c->h, h);
+
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    SDL_Rect lines[256];
+    int      count = 0;
+
+    // interior lines only, on the same truncated edges as the tiles
+    for (int i = SDL_max((int)(x0 / step), 1), x; (x = (int)(i * step)) < x1;
+         i++)
     {
-        int x = 0, y = 0,
-            tiles = (grid == 2) ? level.total_tile_pieces : level.total_tiles;
+        if (x < x0)
+            continue;
 
-        for (int i = 0; i < tiles; i++)
-        {
-            if (x == 0 && i)
-                SDL_RenderDrawLine(r,
-                                   x - c->x,
-                                   y - c->y,
-                                   zoom ? level.width_z - c->x :
-                                          level.width - c->x,
-                                   y - c->y);
-
-            else if (x > 0)
-                SDL_RenderDrawLine(r,
-                                   x - c->x,
-                                   y - c->y,
-                                   x - c->x,
-                                   zoom ? level.height_z - c->y :
-                                          level.height - c->y);
-
-            if (zoom)
-                x += (grid == 2) ? level.tile_piece_size_z : level.tile_size_z;
-            else
-                x += (grid == 2) ? level.tile_piece_size : level.tile_size;
+        lines[count++] = (SDL_Rect){ x - c->x, y0 - c->y, 1, y1 - y0 };
 
-            if (x >= level.width && !zoom)
-            {
-                x = 0;
-                y += (grid == 2) ? level.tile_piece_size : level.tile_size;
-            }
-            else if (x >= level.width_z && zoom)
-            {
-                x = 0;
-                y += (grid == 2) ? level.tile_piece_size_z : level.tile_size_z;
-            }
+        if (count == SDL_arraysize(lines))
+        {
+            SDL_RenderFillRects(r, lines, count);
+            count = 0;
         }
     }
-}
 
-void renderShortcuts(SDL_Renderer* r, texture* sheet, hudTile hudTile[],
-                     SDL_Rect* clip)
-{
-    SDL_SetRenderDrawColor(r, 0xaa, 0xaa, 0xaa, 0x00);
-
-    for (int i = 0; i < 10; i++)
+    for (int i = SDL_max((int)(y0 / step), 1), y; (y = (int)(i * step)) < y1;
+         i++)
     {
-        renderTexture(sheet,
-                      hudTile[i].box.x,
-                      hudTile[i].box.y,
-                      &clip[hudTile[i].id],
-                      false,
-                      true);
+        if (y < y0)
+            continue;
+
+        lines[count++] = (SDL_Rect){ x0 - c->x, y - c->y, x1 - x0, 1 };
+
+        if (count == SDL_arraysize(lines))
+        {
+            SDL_RenderFillRects(r, lines, count);
+            count = 0;
+        }
     }
+
+    if (count > 0)
+        SDL_RenderFillRects(r, lines, count);
 }
 
-bool checkCollision(SDL_Rect a, SDL_Rect b, bool zoom)
+// slots holding a stamp are left to renderStamps
+void renderShortcuts(SDL_Renderer* r, Batch* sheet, hudTile hudTile[],
+                     Stamp stamps[], SDL_Rect* clip)
 {
-    //The sides of the rectangles
-    int leftA = zoom ? a.x << 1 : a.x, leftB = b.x,
-        rightA = zoom ? (a.x + a.w) << 1 : a.x + a.w, rightB = b.x + b.w,
-        topA = zoom ? a.y << 1 : a.y, topB = b.y,
-        bottomA = zoom ? (a.y + a.h) << 1 : a.y + a.h, bottomB = b.y + b.h;
-
-    //If any of the sides from A are outside of B
-    if (bottomA <= topB)
-        return false;
-    if (topA >= bottomB)
-        return false;
-    if (rightA <= leftB)
-        return false;
-    if (leftA >= rightB)
-        return false;
+    SDL_SetRenderDrawColor(r, 0xaa, 0xaa, 0xaa, 0x00);
 
-    //If none of the sides from A are outside B
-    return true;
+    for (int i = 0; i < 10; i++)
+        if (stamps[i].w == 0)
+            batchAdd(sheet, &clip[hudTile[i].id], &hudTile[i].box);
 }
 
-bool listMapFiles(L_File* list, Button buttons[])
+// stamps shrunk into their shortcut slots
+void renderStamps(Editor* e, SDL_Renderer* r)
 {
-    bool success = true;
-
-    DIR*           d;
-    struct dirent* dir;
-    d = opendir("maps");
+    int sheet = atlasSheet(e->atlas, e->map->sheetId);
 
-    if (d == NULL)
-        success = false;
-    else
+    for (int i = 0; i < 10; i++)
     {
-        short i = -1;
-
-        while ((dir = readdir(d)) != NULL)
-        {
-            if (dir->d_type == DT_REG)
-            {
-                i++;
+        SDL_Texture* preview = stampPreview(&e->stamps[i], r, e->atlas, sheet);
 
-                strcpy(list[i].str, dir->d_name);
+        if (preview == NULL)
+            continue;
 
-                list[i].box.w = buttons[B_NEW].box.w;
-                list[i].box.h = 20;
+        SDL_Rect box  = e->hudShortcuts[i].box;
+        int      side = SDL_max(e->stamps[i].w, e->stamps[i].h);
+        SDL_Rect fit  = { box.x + (box.w - box.w * e->stamps[i].w / side) / 2,
+                          box.y + (box.h - box.h * e->stamps[i].h / side) / 2,
+                          box.w * e->stamps[i].w / side,
+                          box.h * e->stamps[i].h / side };
 
-                list[i].box.x = buttons[B_NEW].box.x;
-                list[i].box.y = buttons[B_NEW].box.y + (i * 20);
-            }
-        }
+        SDL_SetTextureAlphaMod(preview, 0xff);
+        SDL_RenderCopy(r, preview, NULL, &fit);
     }
-
-    closedir(d);
-
-    return success;
 }
@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "export.h"
+
+// pieces are 16 pixels square in the atlas and a tile is 2x2 of them
+#define SHEET_PIECE 16
+#define TILE_PIXELS (SHEET_PIECE << 1)
+
+enum ROW_STATE { ROW_COLD, ROW_READING, ROW_HOT };
+
+// one row of a piece, 64 bytes, as four unaligned 16 byte moves
+static inline void copyRow(unsigned char* dst, const unsigned char* src)
+{
+#ifdef __SSE2__
+    for (int i = 0; i < SHEET_PIECE * 4; i += 16)
+        _mm_storeu_si128((__m128i*)(dst + i),
+                         _mm_loadu_si128((const __m128i*)(src + i)));
+#else
+    memcpy(dst, src, SHEET_PIECE * 4);
+#endif
+}
+
+// pieces never overlap, they are copied over a cleared band without
+// blending, same as the baked chunk textures
+static void composite(Export* x, int band, unsigned char* out)
+{
+    size_t pitch = (size_t)x->width * TILE_PIXELS * 4;
+    int    ty0   = band * EXPORT_BAND,
+        ty1      = SDL_min(ty0 + EXPORT_BAND, x->height);
+
+    memset(out, 0, pitch * (ty1 - ty0) * TILE_PIXELS);
+
+    const unsigned char* sheet = x->sheet->pixels;
+    int                  spitch = x->sheet->pitch;
+
+    for (int ty = ty0; ty < ty1; ty++)
+    {
+        unsigned char* row = out + pitch * (ty - ty0) * TILE_PIXELS;
+        int            cy  = ty >> CHUNK_SHIFT;
+
+        for (int cx = 0; cx < x->chunksX; cx++)
+        {
+            unsigned char* chunk = x->chunks[cy * x->chunksX + cx];
+
+            if (chunk == NULL)
+                continue;
+
+            int ox = cx << CHUNK_SHIFT,
+                n  = SDL_min(CHUNK_TILES, x->width - ox);
+
+            unsigned char* tiles =
+                chunk + (((ty & CHUNK_MASK) << CHUNK_SHIFT) << 2);
+
+            for (int tx = 0; tx < n; tx++)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    int id = tiles[(tx << 2) + k];
+
+                    if (id >= EMPTY_PIECE)
+                        continue;
+
+                    const unsigned char* src = sheet +
+                                               x->clips[id].y * spitch +
+                                               x->clips[id].x * 4;
+
+                    unsigned char* dst =
+                        row + (k >> 1) * SHEET_PIECE * pitch +
+                        ((((ox + tx) << 1) + (k & 1)) * SHEET_PIECE) * 4;
+
+                    for (int r = 0; r < SHEET_PIECE; r++)
+                        copyRow(dst + r * pitch, src + r * spitch);
+                }
+            }
+        }
+    }
+}
+
+// the chunk rows band reaches, first and last
+static void bandRows(Export* x, int band, int* first, int* last)
+{
+    *first = (band * EXPORT_BAND) >> CHUNK_SHIFT;
+    *last  = (SDL_min((band + 1) * EXPORT_BAND, x->height) - 1) >> CHUNK_SHIFT;
+}
+
+// chunks of row cy that weren't in memory, off the level's file; empty
+// ones on disk stay NULL
+static bool readRow(Export* x, int cy)
+{
+    if (x->file.fp == NULL)
+        return true;
+
+    for (int cx = 0; cx < x->chunksX; cx++)
+    {
+        unsigned char** c = &x->chunks[cy * x->chunksX + cx];
+
+        if (*c != NULL || (unsigned int)cx >= x->file.header.chunksX ||
+            (unsigned int)cy >= x->file.header.chunksY ||
+            x->file.table[cy * x->file.header.chunksX + cx].coding ==
+                CHUNK_EMPTY)
+            continue;
+
+        if ((*c = malloc(CHUNK_BYTES)) == NULL ||
+            !mapFileReadChunk(&x->file, cx, cy, *c))
+            return false;
+    }
+
+    return true;
+}
+
+// the band with the chunk rows it needs read first, one row at a time off
+// the file; rows are freed once their last band is done. False once the
+// export is cancelled or a read failed
+static bool drawBand(Export* x, int band, unsigned char* out)
+{
+    int first, last;
+
+    bandRows(x, band, &first, &last);
+
+    SDL_LockMutex(x->lock);
+
+    for (int cy = first; cy <= last && !x->cancel; cy++)
+    {
+        while (!x->cancel && (x->rowState[cy] == ROW_READING ||
+                              (x->rowState[cy] == ROW_COLD && x->reading)))
+            SDL_CondWait(x->wake, x->lock);
+
+        if (x->cancel || x->rowState[cy] == ROW_HOT)
+            continue;
+
+        x->rowState[cy] = ROW_READING;
+        x->reading      = true;
+
+        SDL_UnlockMutex(x->lock);
+
+        bool success = readRow(x, cy);
+
+        SDL_LockMutex(x->lock);
+
+        x->rowState[cy] = ROW_HOT;
+        x->reading      = false;
+        x->cancel |= !success;
+        SDL_CondBroadcast(x->wake);
+    }
+
+    bool cancel = x->cancel;
+
+    SDL_UnlockMutex(x->lock);
+
+    if (cancel)
+        return false;
+
+    composite(x, band, out);
+
+    SDL_LockMutex(x->lock);
+
+    for (int cy = first; cy <= last; cy++)
+    {
+        if (--x->rowLeft[cy] > 0)
+            continue;
+
+        for (int cx = 0; cx < x->chunksX; cx++)
+        {
+            free(x->chunks[cy * x->chunksX + cx]);
+            x->chunks[cy * x->chunksX + cx] = NULL;
+        }
+    }
+
+    SDL_UnlockMutex(x->lock);
+
+    return true;
+}
+
+static int exportWorker(void* data)
+{
+    Export* x = data;
+
+    SDL_LockMutex(x->lock);
+
+    while (true)
+    {
+        // a ring slot is free once the writer is past the band it held
+        while (!x->cancel && x->next < x->count &&
+               x->next >= x->written + x->ring)
+            SDL_CondWait(x->wake, x->lock);
+
+        if (x->cancel || x->next >= x->count)
+            break;
+
+        int band = x->next++;
+
+        SDL_UnlockMutex(x->lock);
+
+        // a failed band cancels the export, the writer gives up on it
+        drawBand(x, band, x->bands + (size_t)(band % x->ring) * x->bandSize);
+
+        SDL_LockMutex(x->lock);
+
+        x->ready[band % x->ring] = band;
+        SDL_CondBroadcast(x->wake);
+    }
+
+    SDL_UnlockMutex(x->lock);
+
+    return 0;
+}
+
+// bands go out in order as the workers finish them; without workers each
+// one is composited here first
+static bool writePng(Export* x, FILE* f)
+{
+    png_structp png =
+        png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png != NULL ? png_create_info_struct(png) : NULL;
+
+    if (info == NULL)
+    {
+        png_destroy_write_struct(&png, NULL);
+        return false;
+    }
+
+    // libpng reports errors by jumping back here
+    if (setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+
+    png_init_io(png, f);
+
+    // the encoder is the one part that can't be split, keep it cheap
+    png_set_compression_level(png, 1);
+
+    png_set_IHDR(png,
+                 info,
+                 x->width * TILE_PIXELS,
+                 x->height * TILE_PIXELS,
+                 8,
+                 PNG_COLOR_TYPE_RGBA,
+                 PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+
+    png_write_info(png, info);
+
+    size_t pitch = (size_t)x->width * TILE_PIXELS * 4;
+
+    for (int b = 0; b < x->count; b++)
+    {
+        unsigned char* band = x->bands + (size_t)(b % x->ring) * x->bandSize;
+        int            rows =
+            (SDL_min((b + 1) * EXPORT_BAND, x->height) - b * EXPORT_BAND) *
+            TILE_PIXELS;
+
+        SDL_LockMutex(x->lock);
+
+        while (x->workerCount > 0 && !x->cancel && x->ready[b % x->ring] != b)
+            SDL_CondWait(x->wake, x->lock);
+
+        bool cancel = x->cancel;
+
+        SDL_UnlockMutex(x->lock);
+
+        if (cancel)
+        {
+            png_destroy_write_struct(&png, &info);
+            return false;
+        }
+
+        if (x->workerCount == 0 && !drawBand(x, b, band))
+        {
+            png_destroy_write_struct(&png, &info);
+            return false;
+        }
+
+        for (int r = 0; r < rows; r++)
+            png_write_row(png, band + r * pitch);
+
+        SDL_LockMutex(x->lock);
+
+        x->written = b + 1;
+        SDL_CondBroadcast(x->wake);
+
+        SDL_UnlockMutex(x->lock);
+    }
+
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+
+    return true;
+}
+
+static int exportThread(void* data)
+{
+    Export* x = data;
+
+    // streamed levels only keep part of the map in memory, the chunks that
+    // weren't are read back from their file as the bands get to them
+    bool  success = x->source[0] == '\0' || mapFileOpen(&x->file, x->source);
+    FILE* f       = success ? fopen(x->path, "wb") : NULL;
+
+    int    workers = SDL_min(SDL_max(SDL_GetCPUCount() - 1, 1), EXPORT_WORKERS);
+    size_t pitch   = (size_t)x->width * TILE_PIXELS * 4;
+
+    x->bandSize = pitch * TILE_PIXELS * EXPORT_BAND;
+    x->ring     = workers * EXPORT_AHEAD;
+    x->bands    = malloc(x->bandSize * x->ring);
+    x->ready    = malloc(x->ring * sizeof(int));
+    x->rowState = calloc(x->chunksY, sizeof(unsigned char));
+    x->rowLeft  = calloc(x->chunksY, sizeof(int));
+    x->reading  = false;
+
+    success = success && f != NULL && x->bands != NULL && x->ready != NULL &&
+              x->rowState != NULL && x->rowLeft != NULL;
+
+    if (success)
+    {
+        for (int i = 0; i < x->ring; i++)
+            x->ready[i] = -1;
+
+        for (int b = 0; b < x->count; b++)
+        {
+            int first, last;
+
+            bandRows(x, b, &first, &last);
+
+            for (int cy = first; cy <= last; cy++)
+                x->rowLeft[cy]++;
+        }
+
+        for (int i = 0; i < workers; i++)
+        {
+            x->workers[x->workerCount] =
+                SDL_CreateThread(exportWorker, "export worker", x);
+
+            if (x->workers[x->workerCount] != NULL)
+                x->workerCount++;
+        }
+
+        success = writePng(x, f);
+    }
+
+    SDL_LockMutex(x->lock);
+    x->cancel = true;
+    SDL_CondBroadcast(x->wake);
+    SDL_UnlockMutex(x->lock);
+
+    for (int i = 0; i < x->workerCount; i++)
+        SDL_WaitThread(x->workers[i], NULL);
+
+    x->workerCount = 0;
+
+    if (f != NULL && fclose(f) != 0)
+        success = false;
+
+    // nothing half written is left behind
+    if (!success)
+        remove(x->path);
+
+    mapFileClose(&x->file);
+
+    free(x->bands);
+    free(x->ready);
+    free(x->rowState);
+    free(x->rowLeft);
+
+    x->bands    = NULL;
+    x->ready    = NULL;
+    x->rowState = NULL;
+    x->rowLeft  = NULL;
+
+    SDL_AtomicSet(&x->done, success ? 1 : -1);
+
+    return 0;
+}
+
+bool exportInit(Export* x, SDL_Surface* sheet)
+{
+    SDL_memset(x, 0, sizeof(Export));
+
+    // pieces are copied out as plain rgba bytes
+    if (sheet == NULL || sheet->format->format != SDL_PIXELFORMAT_RGBA32)
+        return false;
+
+    x->sheet = sheet;
+
+    x->lock = SDL_CreateMutex();
+    x->wake = SDL_CreateCond();
+
+    return x->lock != NULL && x->wake != NULL;
+}
+
+static void freeChunks(Export* x)
+{
+    if (x->chunks == NULL)
+        return;
+
+    for (int i = 0; i < x->chunksX * x->chunksY; i++)
+        free(x->chunks[i]);
+
+    free(x->chunks);
+    x->chunks = NULL;
+}
+
+void exportFree(Export* x)
+{
+    // a running export is abandoned, its file removed
+    if (x->thread != NULL)
+    {
+        SDL_LockMutex(x->lock);
+        x->cancel = true;
+        SDL_CondBroadcast(x->wake);
+        SDL_UnlockMutex(x->lock);
+
+        SDL_WaitThread(x->thread, NULL);
+        x->thread = NULL;
+    }
+
+    freeChunks(x);
+
+    if (x->wake != NULL)
+        SDL_DestroyCond(x->wake);
+    if (x->lock != NULL)
+        SDL_DestroyMutex(x->lock);
+
+    x->wake  = NULL;
+    x->lock  = NULL;
+    x->sheet = NULL;
+}
+
+bool exportStart(Export* x, Map* m, const SDL_Rect clips[], const char* path,
+                 const char* source)
+{
+    if (x->thread != NULL || x->lock == NULL)
+        return false;
+
+    memcpy(x->clips, clips, sizeof(x->clips));
+
+    x->width   = m->width;
+    x->height  = m->height;
+    x->chunksX = (m->width + CHUNK_MASK) >> CHUNK_SHIFT;
+    x->chunksY = (m->height + CHUNK_MASK) >> CHUNK_SHIFT;
+    x->chunks  = calloc((size_t)x->chunksX * x->chunksY, sizeof(*x->chunks));
+
+    if (x->chunks == NULL)
+        return false;
+
+    // only painted chunks are copied, the level keeps changing meanwhile
+    for (int cy = 0; cy < x->chunksY; cy++)
+    {
+        for (int cx = 0; cx < x->chunksX; cx++)
+        {
+            uint32_t rows[CHUNK_TILES], painted = 0;
+
+            if (!mapChunkRows(m, cx, cy, rows))
+                continue;
+
+            for (int i = 0; i < CHUNK_TILES; i++)
+                painted |= rows[i];
+
+            unsigned char** c = &x->chunks[cy * x->chunksX + cx];
+
+            // erased in memory still beats whatever the file has
+            if (painted == 0 && source == NULL)
+                continue;
+
+            if ((*c = malloc(CHUNK_BYTES)) == NULL ||
+                !mapCopyChunk(m, cx, cy, *c))
+            {
+                freeChunks(x);
+                return false;
+            }
+        }
+    }
+
+    x->path[0]   = '\0';
+    x->source[0] = '\0';
+    strncat(x->path, path, sizeof(x->path) - 1);
+
+    if (source != NULL)
+        strncat(x->source, source, sizeof(x->source) - 1);
+
+    x->count   = (x->height + EXPORT_BAND - 1) / EXPORT_BAND;
+    x->next    = 0;
+    x->written = 0;
+    x->cancel  = false;
+    x->start   = SDL_GetPerformanceCounter();
+
+    SDL_AtomicSet(&x->done, 0);
+
+    x->thread = SDL_CreateThread(exportThread, "export", x);
+
+    if (x->thread == NULL)
+    {
+        freeChunks(x);
+        return false;
+    }
+
+    return true;
+}
+
+int exportPoll(Export* x)
+{
+    if (x->thread == NULL)
+        return 0;
+
+    int done = SDL_AtomicGet(&x->done);
+
+    if (done != 0)
+    {
+        SDL_WaitThread(x->thread, NULL);
+        x->thread = NULL;
+
+        freeChunks(x);
+    }
+
+    return done;
+}
@@ -0,0 +1,67 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "mapfile.h"
+
+// bands are EXPORT_BAND tile rows tall and each worker gets EXPORT_AHEAD of
+// them in flight, so memory stays at workers * EXPORT_AHEAD bands however
+// large the level is
+#define EXPORT_BAND    4
+#define EXPORT_AHEAD   2
+#define EXPORT_WORKERS 8
+
+// full size png of a level, composited on the cpu from the sheet; workers
+// fill horizontal bands of the image out of order and the export thread
+// encodes them in order as they finish, one row at a time
+typedef struct Export
+{
+    SDL_Surface* sheet; // the editor's atlas, rgba, only read
+    SDL_Rect     clips[EMPTY_PIECE + 1]; // the level's, copied at the start
+
+    // the level as it was when the export started, one entry per chunk and
+    // NULL where nothing is painted; source is the file chunks that weren't
+    // in memory are read from, empty when all of them were. They are read a
+    // chunk row at a time once a band reaches it and every row is dropped
+    // when its last band is composited, so only the rows in flight are kept
+    unsigned char** chunks;
+    int             chunksX, chunksY, width, height; // tiles
+    char            path[512], source[256];
+    MapFile         file;
+
+    SDL_Thread* thread;
+    SDL_Thread* workers[EXPORT_WORKERS];
+    int         workerCount;
+    SDL_mutex*  lock;
+    SDL_cond*   wake;
+
+    unsigned char* bands; // ring of composited bands
+    size_t         bandSize;
+    int            ring;
+
+    // under lock; ready is the band each ring slot holds, -1 while empty,
+    // rowState and rowLeft the chunk rows and their bands still to do
+    int*           ready;
+    int            next, written, count;
+    bool           cancel, reading; // reading while a row comes off source
+    unsigned char* rowState;
+    int*           rowLeft;
+
+    Uint64       start;
+    SDL_atomic_t done; // 1 written, -1 failed, 0 still going
+} Export;
+
+bool exportInit(Export* x, SDL_Surface* sheet);
+void exportFree(Export* x);
+
+// copies what's painted in m and writes it to path in the background, with
+// the pieces clips says; false while an earlier export is still running.
+// A streamed level passes its file as source, synced with streamSync first
+bool exportStart(Export* x, Map* m, const SDL_Rect clips[], const char* path,
+                 const char* source);
+
+// result of a finished export, once; 0 while one is running or none was
+int exportPoll(Export* x);
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include "fill.h"
+
+#define CHUNK_PIECES (CHUNK_TILES << 1)
+
+// one fill's state; runs mostly stay inside a chunk, so the chunk row last
+// read is kept and pieces are looked up in it directly
+typedef struct Scan
+{
+    Fill* f;
+    Map*  m;
+    short target, id;
+    int   width, height; // in pieces
+
+    int            rowX, rowY; // chunk column and piece row of row
+    unsigned char* row;        // its tiles, NULL when the chunk is empty
+    int            allowedX, allowedY, touchedX, touchedY;
+    bool           allowed;
+} Scan;
+
+// whether (px, py) still holds the piece being replaced and may be filled
+static bool matches(Scan* s, int px, int py)
+{
+    if (px < 0 || py < 0 || px >= s->width || py >= s->height)
+        return false;
+
+    int cx = px / CHUNK_PIECES;
+
+    if (cx != s->rowX || py != s->rowY)
+    {
+        int cy = py / CHUNK_PIECES;
+
+        if (cx != s->allowedX || cy != s->allowedY)
+        {
+            s->allowedX = cx;
+            s->allowedY = cy;
+            s->allowed  = s->f->allowed == NULL ||
+                         s->f->allowed(s->f->data, cx, cy);
+        }
+
+        s->rowX = cx;
+        s->rowY = py;
+        s->row  = mapGetTile(s->m, cx << CHUNK_SHIFT, py >> 1);
+    }
+
+    short id = s->row == NULL ?
+                   EMPTY_PIECE :
+                   s->row[(((px >> 1) & CHUNK_MASK) << 2) + ((py & 1) << 1) +
+                          (px & 1)];
+
+    return s->allowed && id == s->target;
+}
+
+// the far end of the run px is in, going step (1 or -1) along row py; past
+// the first piece of a chunk the rest of its row is read straight from the
+// tiles, or skipped whole when the chunk is empty and so is the target
+static int runEnd(Scan* s, int px, int py, int step)
+{
+    int k = (py & 1) << 1;
+
+    while (matches(s, px + step, py))
+    {
+        px += step;
+
+        int end = step > 0 ? (s->rowX + 1) * CHUNK_PIECES - 1 :
+                             s->rowX * CHUNK_PIECES;
+
+        end = end < s->width ? end : s->width - 1;
+
+        if (s->row == NULL)
+            px = end;
+
+        while (px != end &&
+               s->row[((((px + step) >> 1) & CHUNK_MASK) << 2) + k +
+                      ((px + step) & 1)] == s->target)
+            px += step;
+    }
+
+    return px;
+}
+
+// x0 to x1 of row py a chunk at a time: the first piece goes through
+// mapSetPiece, which makes the chunk and marks it edited, the rest are
+// written straight into the tile row behind it
+static bool writeRun(Scan* s, int x0, int x1, int py)
+{
+    int k = (py & 1) << 1, cy = py / CHUNK_PIECES;
+
+    while (x0 <= x1)
+    {
+        int cx  = x0 / CHUNK_PIECES,
+            end = (cx + 1) * CHUNK_PIECES - 1 < x1 ?
+                      (cx + 1) * CHUNK_PIECES - 1 :
+                      x1;
+
+        mapSetPiece(s->m, x0, py, s->id);
+
+        unsigned char* t = mapGetTile(s->m, x0 >> 1, py >> 1);
+
+        // a chunk that couldn't be made would be found again and again
+        if (t == NULL)
+            return s->id == EMPTY_PIECE;
+
+        for (int px = x0 + 1; px <= end; px++)
+            t[(((px >> 1) - (x0 >> 1)) << 2) + k + (px & 1)] = s->id;
+
+        mapMarkDirty(s->m, cx, cy);
+
+        // the chunk may have just been made
+        s->rowY = -1;
+
+        if (s->f->touched != NULL && (cx != s->touchedX || cy != s->touchedY))
+            s->f->touched(s->f->data, cx, cy);
+
+        s->touchedX = cx;
+        s->touchedY = cy;
+
+        x0 = end + 1;
+    }
+
+    return true;
+}
+
+static bool push(Fill* f, int* top, int x0, int x1, int y, int dy)
+{
+    if (*top == FILL_SPANS)
+        return false;
+
+    f->spans[(*top)++] = (FillSpan){ x0, x1, y, dy };
+
+    return true;
+}
+
+bool fillInit(Fill* f)
+{
+    f->spans   = malloc(FILL_SPANS * sizeof(FillSpan));
+    f->allowed = NULL;
+    f->touched = NULL;
+    f->run     = NULL;
+    f->data    = NULL;
+    f->count   = 0;
+
+    return f->spans != NULL;
+}
+
+void fillFree(Fill* f)
+{
+    free(f->spans);
+    f->spans = NULL;
+}
+
+bool fillPieces(Fill* f, Map* m, int px, int py, short id, bool diagonal)
+{
+    Scan s = { f, m, mapGetPiece(m, px, py), id, m->width << 1,
+               m->height << 1, -1, -1, NULL, -1, -1, -1, -1, false };
+
+    f->count = 0;
+
+    if (f->spans == NULL)
+        return false;
+
+    if (s.target == id || !matches(&s, px, py))
+        return true;
+
+    f->left = f->right = px;
+    f->top = f->bottom = py;
+
+    int  d = diagonal ? 1 : 0, top = 0;
+    bool complete = push(f, &top, px, px, py, 0);
+
+    while (top > 0)
+    {
+        FillSpan span = f->spans[--top];
+
+        for (int x = span.x0; x <= span.x1; x++)
+        {
+            if (!matches(&s, x, span.y))
+                continue;
+
+            // only the first run found can reach past the span's left end
+            int x0 = runEnd(&s, x, span.y, -1), x1 = runEnd(&s, x, span.y, 1);
+
+            if (f->run != NULL)
+                f->run(f->data, x0, x1, span.y, s.target, id);
+
+            if (!writeRun(&s, x0, x1, span.y))
+                return false;
+
+            f->count += x1 - x0 + 1;
+            f->left   = x0 < f->left ? x0 : f->left;
+            f->right  = x1 > f->right ? x1 : f->right;
+            f->top    = span.y < f->top ? span.y : f->top;
+            f->bottom = span.y > f->bottom ? span.y : f->bottom;
+
+            // onwards along the whole run; back towards the row it was
+            // found from only where the run sticks out past the one there,
+            // span.x0 + d to span.x1 - d, everything between is filled
+            if (span.dy == 0)
+            {
+                complete &= push(f, &top, x0 - d, x1 + d, span.y - 1, -1);
+                complete &= push(f, &top, x0 - d, x1 + d, span.y + 1, 1);
+            }
+            else
+            {
+                int back = span.y - span.dy;
+
+                complete &= push(
+                    f, &top, x0 - d, x1 + d, span.y + span.dy, span.dy);
+
+                if (x0 - d < span.x0 + d)
+                    complete &= push(
+                        f, &top, x0 - d, span.x0 + d - 1, back, -span.dy);
+                if (x1 + d > span.x1 - d)
+                    complete &= push(
+                        f, &top, span.x1 - d + 1, x1 + d, back, -span.dy);
+            }
+
+            x = x1 + 1;
+        }
+    }
+
+    return complete;
+}
@@ -0,0 +1,46 @@
+#ifndef FILL_H
+#define FILL_H
+
+#include <stdbool.h>
+#include "map.h"
+
+// spans waiting to be searched at once; a fill needing more than this,
+// which takes a maze of one piece wide corridors, stops where it got to
+#define FILL_SPANS (1 << 16)
+
+typedef struct FillSpan
+{
+    int x0, x1, y; // pieces, inclusive
+    int dy;        // 1 or -1, the run it was found from is at y - dy; 0 for
+                   // the seed
+} FillSpan;
+
+// scanline flood fill over the piece grid: whole runs of the matching piece
+// are written at once and only the parts of the rows above and below that
+// could hold more are searched; the span stack never grows past FILL_SPANS
+typedef struct Fill
+{
+    FillSpan* spans;
+
+    // chunk coordinates: allowed says whether a chunk may be filled into,
+    // touched is told about every chunk written to; run hears about each
+    // run of pieces, x0 to x1 of row py, before it goes from old to id
+    bool (*allowed)(void* data, int cx, int cy);
+    void (*touched)(void* data, int cx, int cy);
+    void (*run)(void* data, int x0, int x1, int py, short old, short id);
+    void* data;
+
+    // the last fill, pieces written and their bounds
+    long count;
+    int  left, top, right, bottom;
+} Fill;
+
+bool fillInit(Fill* f);
+void fillFree(Fill* f);
+
+// replaces the piece at (px, py) and every piece of the same id joined to it
+// by an edge, or by a corner too when diagonal; false when the fill ran out
+// of spans or memory and is incomplete
+bool fillPieces(Fill* f, Map* m, int px, int py, short id, bool diagonal);
+
+#endif
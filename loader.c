@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loader.h"
+
+static int loaderThread(void* data)
+{
+    Loader* l = data;
+
+    unsigned char pieces[CHUNK_BYTES];
+    int           cx, cy;
+
+    while (mapReaderNext(&l->reader, &cx, &cy, pieces))
+    {
+        SDL_AtomicSet(&l->scanned, l->reader.next);
+
+        SDL_LockMutex(l->lock);
+
+        // the main thread drains the ring every frame
+        while (l->count == LOADER_QUEUE && !l->cancel)
+            SDL_CondWait(l->space, l->lock);
+
+        if (l->cancel)
+        {
+            SDL_UnlockMutex(l->lock);
+            break;
+        }
+
+        LoadedChunk* c = &l->queue[(l->head + l->count) % LOADER_QUEUE];
+
+        c->cx = cx;
+        c->cy = cy;
+        memcpy(c->pieces, pieces, CHUNK_BYTES);
+
+        l->count++;
+
+        SDL_UnlockMutex(l->lock);
+    }
+
+    SDL_AtomicSet(&l->scanned, l->total);
+
+    SDL_LockMutex(l->lock);
+    l->finished = true;
+    SDL_UnlockMutex(l->lock);
+
+    return 0;
+}
+
+bool loaderInit(Loader* l)
+{
+    l->thread = NULL;
+    l->lock   = SDL_CreateMutex();
+    l->space  = SDL_CreateCond();
+    l->queue  = malloc(LOADER_QUEUE * sizeof(LoadedChunk));
+
+    // loaderStart refuses without a queue and mapLoadFile takes over
+    if (l->lock == NULL || l->space == NULL)
+    {
+        free(l->queue);
+        l->queue = NULL;
+    }
+
+    return l->queue != NULL;
+}
+
+void loaderFree(Loader* l)
+{
+    loaderCancel(l);
+
+    if (l->space != NULL)
+        SDL_DestroyCond(l->space);
+    if (l->lock != NULL)
+        SDL_DestroyMutex(l->lock);
+
+    free(l->queue);
+
+    l->space = NULL;
+    l->lock  = NULL;
+    l->queue = NULL;
+}
+
+static void loaderJoin(Loader* l)
+{
+    SDL_WaitThread(l->thread, NULL);
+    mapReaderClose(&l->reader);
+
+    l->thread = NULL;
+}
+
+bool loaderStart(Loader* l, Map* m, const char* path)
+{
+    loaderCancel(l);
+
+    if (l->queue == NULL ||
+        !mapReaderOpen(&l->reader, path, m->baseWidth))
+        return false;
+
+    mapClear(m);
+
+    m->width   = l->reader.width;
+    m->height  = l->reader.height;
+    m->sheetId = l->reader.sheetId;
+
+    l->path[0] = '\0';
+    strncat(l->path, path, sizeof(l->path) - 1);
+
+    l->head     = 0;
+    l->count    = 0;
+    l->finished = false;
+    l->cancel   = false;
+    l->total    = l->reader.chunksX * l->reader.chunksY;
+
+    SDL_AtomicSet(&l->scanned, 0);
+
+    l->thread = SDL_CreateThread(loaderThread, "loader", l);
+
+    if (l->thread == NULL)
+    {
+        printf("Failed to start loader thread! SDL Error: %s\n",
+               SDL_GetError());
+        mapReaderClose(&l->reader);
+        return false;
+    }
+
+    return true;
+}
+
+void loaderCancel(Loader* l)
+{
+    if (l->thread == NULL)
+        return;
+
+    SDL_LockMutex(l->lock);
+    l->cancel = true;
+    SDL_CondSignal(l->space);
+    SDL_UnlockMutex(l->lock);
+
+    loaderJoin(l);
+}
+
+bool loaderPump(Loader* l, Map* m, int budget)
+{
+    if (l->thread == NULL)
+        return true;
+
+    bool success = true;
+
+    SDL_LockMutex(l->lock);
+
+    for (; l->count > 0 && budget > 0 && success; budget--)
+    {
+        LoadedChunk*   c      = &l->queue[l->head];
+        unsigned char* pieces = mapChunkData(m, c->cx, c->cy, true);
+
+        if (pieces != NULL)
+            memcpy(pieces, c->pieces, CHUNK_BYTES);
+        else
+            success = false;
+
+        l->head = (l->head + 1) % LOADER_QUEUE;
+        l->count--;
+    }
+
+    bool finished = l->finished && l->count == 0;
+
+    SDL_CondSignal(l->space);
+    SDL_UnlockMutex(l->lock);
+
+    if (!success)
+    {
+        loaderCancel(l);
+        return false;
+    }
+
+    if (finished)
+    {
+        success = !l->reader.failed;
+
+        if (success)
+            mapSetFile(m, l->path, l->reader.format, l->reader.garbage);
+
+        loaderJoin(l);
+    }
+
+    return success;
+}
+
+bool loaderActive(const Loader* l)
+{
+    return l->thread != NULL;
+}
+
+float loaderProgress(Loader* l)
+{
+    return l->total > 0 ? (float)SDL_AtomicGet(&l->scanned) / l->total : 1.0f;
+}
@@ -0,0 +1,51 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "mapfile.h"
+
+// decoded chunks waiting for the main thread, and how many it takes a frame
+#define LOADER_QUEUE  1024
+#define LOADER_BUDGET 1024
+
+typedef struct LoadedChunk
+{
+    int           cx, cy;
+    unsigned char pieces[CHUNK_BYTES];
+} LoadedChunk;
+
+// levels are read and decoded on a worker thread and handed over a chunk at
+// a time, so the map fills in while it is already on screen
+typedef struct Loader
+{
+    MapReader reader;
+    char      path[256];
+
+    SDL_Thread* thread;
+    SDL_mutex*  lock;
+    SDL_cond*   space;
+
+    // under lock
+    LoadedChunk* queue; // ring of LOADER_QUEUE
+    size_t       head, count;
+    bool         finished, cancel;
+
+    SDL_atomic_t scanned; // chunks read so far, for the progress bar
+    int          total;
+} Loader;
+
+bool loaderInit(Loader* l);
+void loaderFree(Loader* l);
+
+// clears m to the file's size and starts filling it in the background
+bool loaderStart(Loader* l, Map* m, const char* path);
+void loaderCancel(Loader* l);
+
+// moves up to budget ready chunks into m, once the last one is in the map
+// is marked as loaded from path; false if the load failed
+bool  loaderPump(Loader* l, Map* m, int budget);
+bool  loaderActive(const Loader* l);
+float loaderProgress(Loader* l);
+
+#endif
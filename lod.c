@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lod.h"
+
+bool lodInit(Lod* l, SDL_Renderer* r, const unsigned char colours[][4])
+{
+    SDL_memset(l, 0, sizeof(Lod));
+
+    l->renderer = r;
+    l->top      = LOD_SLOTS;
+    l->bottom   = -1;
+
+    memcpy(l->colours, colours, sizeof(l->colours));
+
+    l->pixels = calloc((size_t)LOD_ATLAS * LOD_ATLAS, 4);
+
+    if (l->pixels == NULL)
+        return false;
+
+    l->atlas = SDL_CreateTexture(r,
+                                 SDL_PIXELFORMAT_RGBA32,
+                                 SDL_TEXTUREACCESS_STREAMING,
+                                 LOD_ATLAS,
+                                 LOD_ATLAS);
+
+    if (l->atlas == NULL)
+    {
+        lodFree(l);
+        return false;
+    }
+
+    SDL_SetTextureBlendMode(l->atlas, SDL_BLENDMODE_BLEND);
+
+    return batchInit(&l->batch, r, l->atlas);
+}
+
+void lodFree(Lod* l)
+{
+    batchFree(&l->batch);
+
+    if (l->atlas != NULL)
+        SDL_DestroyTexture(l->atlas);
+
+    free(l->pixels);
+
+    l->atlas  = NULL;
+    l->pixels = NULL;
+}
+
+void lodClear(Lod* l)
+{
+    for (int i = 0; i < LOD_SLOTS * LOD_SLOTS; i++)
+        l->slots[i].baked = false;
+}
+
+void lodColours(Lod* l, const unsigned char colours[][4])
+{
+    memcpy(l->colours, colours, sizeof(l->colours));
+
+    lodClear(l);
+}
+
+static LodSlot* slotOf(Lod* l, int cx, int cy)
+{
+    int u = cx & (LOD_SLOTS - 1), v = cy & (LOD_SLOTS - 1);
+
+    return &l->slots[v * LOD_SLOTS + u];
+}
+
+void lodInvalidate(Lod* l, int px, int py)
+{
+    int      cx = px >> (CHUNK_SHIFT + 1), cy = py >> (CHUNK_SHIFT + 1);
+    LodSlot* s  = slotOf(l, cx, cy);
+
+    if (s->cx == cx && s->cy == cy)
+        s->baked = false;
+}
+
+void lodFrame(Lod* l)
+{
+    l->bakes = 0;
+    l->draws = 0;
+}
+
+// each tile's colour is the mean of its painted pieces, its alpha how much
+// of the tile is painted
+static bool bake(Lod* l, Map* m, int cx, int cy)
+{
+    unsigned char pieces[CHUNK_BYTES];
+
+    if (!mapCopyChunk(m, cx, cy, pieces))
+        return false;
+
+    int u = cx & (LOD_SLOTS - 1), v = cy & (LOD_SLOTS - 1);
+
+    for (int ty = 0; ty < CHUNK_TILES; ty++)
+    {
+        unsigned char* out =
+            l->pixels +
+            ((size_t)((v * CHUNK_TILES) + ty) * LOD_ATLAS + u * CHUNK_TILES) *
+                4;
+
+        for (int tx = 0; tx < CHUNK_TILES; tx++, out += 4)
+        {
+            unsigned char* t = pieces + (((ty << CHUNK_SHIFT) + tx) << 2);
+            unsigned int   sum[4] = { 0 }, n = 0;
+
+            for (int k = 0; k < 4; k++)
+            {
+                if (t[k] >= EMPTY_PIECE)
+                    continue;
+
+                for (int c = 0; c < 4; c++)
+                    sum[c] += l->colours[t[k]][c];
+
+                n++;
+            }
+
+            if (n == 0)
+            {
+                memset(out, 0, 4);
+                continue;
+            }
+
+            out[0] = sum[0] / n;
+            out[1] = sum[1] / n;
+            out[2] = sum[2] / n;
+            out[3] = sum[3] >> 2;
+        }
+    }
+
+    l->top    = SDL_min(l->top, v);
+    l->bottom = SDL_max(l->bottom, v);
+
+    l->bakes++;
+
+    return true;
+}
+
+bool lodDraw(Lod* l, Map* m, int cx, int cy, const SDL_Rect* dst)
+{
+    if (l->atlas == NULL)
+        return false;
+
+    LodSlot* s = slotOf(l, cx, cy);
+
+    if (s->cx != cx || s->cy != cy || !s->baked)
+    {
+        s->cx = cx;
+        s->cy = cy;
+
+        if (!(s->baked = bake(l, m, cx, cy)))
+            return false;
+    }
+
+    SDL_Rect src = { (cx & (LOD_SLOTS - 1)) * CHUNK_TILES,
+                     (cy & (LOD_SLOTS - 1)) * CHUNK_TILES,
+                     CHUNK_TILES,
+                     CHUNK_TILES };
+
+    batchAdd(&l->batch, &src, dst);
+
+    l->draws++;
+
+    return true;
+}
+
+void lodFlush(Lod* l)
+{
+    // one upload for the rows baked this frame, then the quads that use them
+    if (l->bottom >= l->top)
+    {
+        SDL_Rect rows = { 0,
+                          l->top * CHUNK_TILES,
+                          LOD_ATLAS,
+                          (l->bottom - l->top + 1) * CHUNK_TILES };
+
+        SDL_UpdateTexture(l->atlas,
+                          &rows,
+                          l->pixels + (size_t)rows.y * LOD_ATLAS * 4,
+                          LOD_ATLAS * 4);
+
+        l->top    = LOD_SLOTS;
+        l->bottom = -1;
+    }
+
+    batchFlush(&l->batch);
+}
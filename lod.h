@@ -0,0 +1,59 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "batch.h"
+
+// chunk images sit in a square of LOD_SLOTS slots, picked by chunk position
+// modulo LOD_SLOTS; any LOD_SLOTS x LOD_SLOTS chunks get a slot each, so the
+// view must never span more than that
+#define LOD_SLOTS 64
+#define LOD_ATLAS (LOD_SLOTS * CHUNK_TILES) // atlas side in pixels
+
+typedef struct LodSlot
+{
+    int  cx, cy;
+    bool baked; // pixels match the chunk, cleared by edits
+} LodSlot;
+
+// far out a tile is one pixel, the average of its pieces' colours, and a
+// chunk is a CHUNK_TILES square image in one atlas; the atlas is kept on the
+// cpu, changed rows are uploaded once a frame and every chunk on screen goes
+// out in a single batch however many there are
+typedef struct Lod
+{
+    SDL_Renderer*  renderer;
+    SDL_Texture*   atlas;
+    Batch          batch;
+    unsigned char* pixels;      // rgba, LOD_ATLAS square
+    int            top, bottom; // slot rows changed since the last upload
+
+    unsigned char colours[EMPTY_PIECE + 1][4]; // average of each piece
+
+    LodSlot slots[LOD_SLOTS * LOD_SLOTS];
+
+    int bakes, draws; // this frame
+} Lod;
+
+// colours are the sheet's piece averages, as rgba bytes
+bool lodInit(Lod* l, SDL_Renderer* r, const unsigned char colours[][4]);
+void lodFree(Lod* l);
+
+// forget every chunk image, for when a different level is loaded
+void lodClear(Lod* l);
+
+// a level on another sheet, every chunk image is rebuilt in its colours
+void lodColours(Lod* l, const unsigned char colours[][4]);
+
+// piece coordinates, the chunk holding the piece is rebuilt when next drawn
+void lodInvalidate(Lod* l, int px, int py);
+
+// starts a frame, the bake and draw counts restart from zero
+void lodFrame(Lod* l);
+
+// queues chunk (cx, cy) of m into dst, lodFlush draws everything queued
+bool lodDraw(Lod* l, Map* m, int cx, int cy, const SDL_Rect* dst);
+void lodFlush(Lod* l);
+
+#endif
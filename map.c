@@ -0,0 +1,956 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define MAP_HAVE_MMAP
+#endif
+#include "map.h"
+#include "mapfile.h"
+
+static size_t chunkHash(int cx, int cy)
+{
+    uint64_t h = (uint64_t)(uint32_t)cx * 0x9e3779b97f4a7c15ULL ^
+                 (uint64_t)(uint32_t)cy * 0xc2b2ae3d27d4eb4fULL;
+
+    h ^= h >> 32;
+
+    return (size_t)h;
+}
+
+static bool mapGrow(Map* m)
+{
+    size_t     capacity = m->capacity ? m->capacity << 1 : 64;
+    MapChunk** slots    = calloc(capacity, sizeof(MapChunk*));
+
+    if (slots == NULL)
+        return false;
+
+    for (size_t i = 0; i < m->capacity; i++)
+    {
+        MapChunk* c = m->slots[i];
+
+        if (c == NULL)
+            continue;
+
+        size_t s = chunkHash(c->cx, c->cy) & (capacity - 1);
+
+        while (slots[s] != NULL)
+            s = (s + 1) & (capacity - 1);
+
+        slots[s] = c;
+    }
+
+    free(m->slots);
+
+    m->slots    = slots;
+    m->capacity = capacity;
+
+    return true;
+}
+
+// every chunk can be dirty at once, the list has room for all of them
+// before a chunk is made so marking one never has to allocate
+static bool reserveDirty(Map* m)
+{
+    if (m->count < m->dirtyCapacity)
+        return true;
+
+    size_t     capacity = m->dirtyCapacity ? m->dirtyCapacity << 1 : 64;
+    MapChunk** dirty    = realloc(m->dirty, capacity * sizeof(MapChunk*));
+
+    if (dirty == NULL)
+        return false;
+
+    m->dirty         = dirty;
+    m->dirtyCapacity = capacity;
+
+    return true;
+}
+
+static MapChunk* mapNewChunk(Map* m, int cx, int cy)
+{
+    // keep the table at most half full so probes stay short
+    if ((m->count + 1) << 1 > m->capacity && !mapGrow(m))
+        return NULL;
+
+    if (!reserveDirty(m))
+        return NULL;
+
+    MapChunk* c = malloc(sizeof(MapChunk));
+
+    if (c == NULL)
+        return NULL;
+
+    c->cx      = cx;
+    c->cy      = cy;
+    c->dirty   = false;
+    c->counted = true;
+
+    memset(c->occupied, 0, sizeof(c->occupied));
+    memset(c->pieces, EMPTY_PIECE, CHUNK_BYTES);
+
+    size_t s = chunkHash(cx, cy) & (m->capacity - 1);
+
+    while (m->slots[s] != NULL)
+        s = (s + 1) & (m->capacity - 1);
+
+    m->slots[s] = c;
+    m->count++;
+
+    return c;
+}
+
+bool mapInit(Map* m, int width, int height, int tileSize)
+{
+    m->width      = width;
+    m->height     = height;
+    m->tileSize   = tileSize;
+    m->baseWidth  = width;
+    m->baseHeight = height;
+
+    m->slots    = NULL;
+    m->capacity = 0;
+    m->count    = 0;
+    m->last     = NULL;
+
+    m->sheetId = 0;
+
+    m->dirty         = NULL;
+    m->dirtyCount    = 0;
+    m->dirtyCapacity = 0;
+    m->format        = MAP_FORMAT_NONE;
+    m->path[0]       = '\0';
+    m->garbage       = 0;
+
+    m->io       = MAP_IO_BUFFERED;
+    m->grid     = NULL;
+    m->gridSize = 0;
+    m->fd       = -1;
+
+    return mapGrow(m);
+}
+
+void mapClear(Map* m)
+{
+    mapCloseFile(m);
+
+    for (size_t i = 0; i < m->capacity; i++)
+    {
+        free(m->slots[i]);
+        m->slots[i] = NULL;
+    }
+
+    m->count = 0;
+    m->last  = NULL;
+
+    m->dirtyCount = 0;
+    m->format     = MAP_FORMAT_NONE;
+    m->garbage    = 0;
+}
+
+void mapFree(Map* m)
+{
+    mapClear(m);
+
+    free(m->slots);
+    free(m->dirty);
+
+    m->slots         = NULL;
+    m->capacity      = 0;
+    m->dirty         = NULL;
+    m->dirtyCapacity = 0;
+}
+
+// can't fail, reserveDirty made room when the chunk was
+static void markChunk(Map* m, MapChunk* c)
+{
+    if (c->dirty)
+        return;
+
+    c->dirty                  = true;
+    m->dirty[m->dirtyCount++] = c;
+}
+
+static MapChunk* mapFindChunk(Map* m, int cx, int cy)
+{
+    if (m->last != NULL && m->last->cx == cx && m->last->cy == cy)
+        return m->last;
+
+    if (m->capacity == 0)
+        return NULL;
+
+    size_t s = chunkHash(cx, cy) & (m->capacity - 1);
+
+    while (m->slots[s] != NULL)
+    {
+        MapChunk* c = m->slots[s];
+
+        if (c->cx == cx && c->cy == cy)
+        {
+            m->last = c;
+            return c;
+        }
+
+        s = (s + 1) & (m->capacity - 1);
+    }
+
+    return NULL;
+}
+
+bool mapHasChunk(Map* m, int cx, int cy)
+{
+    if (m->grid != NULL)
+        return true;
+
+    return mapFindChunk(m, cx, cy) != NULL;
+}
+
+unsigned char* mapGetTile(Map* m, int tx, int ty)
+{
+    if (tx < 0 || ty < 0 || tx >= m->width || ty >= m->height)
+        return NULL;
+
+    if (m->grid != NULL)
+        return m->grid + (((size_t)ty * m->width + tx) << 2);
+
+    MapChunk* c = mapFindChunk(m, tx >> CHUNK_SHIFT, ty >> CHUNK_SHIFT);
+
+    if (c == NULL)
+        return NULL;
+
+    return &c->pieces[(((ty & CHUNK_MASK) << CHUNK_SHIFT) + (tx & CHUNK_MASK))
+                      << 2];
+}
+
+// tiles of a chunk that lie inside the level, edge chunks are cut short
+static void chunkExtent(const Map* m, int cx, int cy, int* cols, int* rows)
+{
+    *cols = m->width - (cx << CHUNK_SHIFT);
+    *rows = m->height - (cy << CHUNK_SHIFT);
+
+    if (*cols > CHUNK_TILES)
+        *cols = CHUNK_TILES;
+    if (*rows > CHUNK_TILES)
+        *rows = CHUNK_TILES;
+}
+
+unsigned char* mapChunkData(Map* m, int cx, int cy, bool create)
+{
+    if (m->grid != NULL)
+        return NULL;
+
+    MapChunk* c = mapFindChunk(m, cx, cy);
+
+    if (c == NULL && create)
+        c = mapNewChunk(m, cx, cy);
+
+    if (c == NULL)
+        return NULL;
+
+    // the caller may fill it in, occupancy is recounted when next asked for
+    c->counted = false;
+
+    return c->pieces;
+}
+
+bool mapCopyChunk(Map* m, int cx, int cy, unsigned char out[])
+{
+    if (m->grid == NULL)
+    {
+        MapChunk* c = mapFindChunk(m, cx, cy);
+
+        if (c == NULL)
+            return false;
+
+        memcpy(out, c->pieces, CHUNK_BYTES);
+
+        return true;
+    }
+
+    int tx0 = cx << CHUNK_SHIFT, ty0 = cy << CHUNK_SHIFT, cols, rows;
+
+    chunkExtent(m, cx, cy, &cols, &rows);
+
+    if (cols < CHUNK_TILES || rows < CHUNK_TILES)
+        memset(out, EMPTY_PIECE, CHUNK_BYTES);
+
+    // gather the chunk rows out of the mapped level
+    for (int y = 0; y < rows; y++)
+        memcpy(out + (y << (CHUNK_SHIFT + 2)),
+               m->grid + (((size_t)(ty0 + y) * m->width + tx0) << 2),
+               cols << 2);
+
+    return true;
+}
+
+// a tile is empty when all four of its pieces are
+static bool tileEmpty(const unsigned char* t)
+{
+    return t[0] == EMPTY_PIECE && t[1] == EMPTY_PIECE && t[2] == EMPTY_PIECE &&
+           t[3] == EMPTY_PIECE;
+}
+
+static uint32_t rowBits(const unsigned char* t, int cols)
+{
+    uint32_t bits = 0;
+
+    for (int x = 0; x < cols; x++, t += 4)
+        if (!tileEmpty(t))
+            bits |= (uint32_t)1 << x;
+
+    return bits;
+}
+
+bool mapChunkRows(Map* m, int cx, int cy, uint32_t rows[])
+{
+    if (m->grid != NULL)
+    {
+        int tx0 = cx << CHUNK_SHIFT, ty0 = cy << CHUNK_SHIFT, cols, count;
+
+        chunkExtent(m, cx, cy, &cols, &count);
+
+        memset(rows, 0, CHUNK_TILES * sizeof(uint32_t));
+
+        for (int y = 0; y < count; y++)
+            rows[y] = rowBits(
+                m->grid + (((size_t)(ty0 + y) * m->width + tx0) << 2), cols);
+
+        return true;
+    }
+
+    MapChunk* c = mapFindChunk(m, cx, cy);
+
+    if (c == NULL)
+        return false;
+
+    if (!c->counted)
+    {
+        for (int y = 0; y < CHUNK_TILES; y++)
+            c->occupied[y] =
+                rowBits(c->pieces + (y << (CHUNK_SHIFT + 2)), CHUNK_TILES);
+
+        c->counted = true;
+    }
+
+    memcpy(rows, c->occupied, sizeof(c->occupied));
+
+    return true;
+}
+
+short mapGetPiece(Map* m, int px, int py)
+{
+    unsigned char* t = mapGetTile(m, px >> 1, py >> 1);
+
+    if (t == NULL)
+        return EMPTY_PIECE;
+
+    return t[((py & 1) << 1) + (px & 1)];
+}
+
+void mapSetPiece(Map* m, int px, int py, short id)
+{
+    int tx = px >> 1, ty = py >> 1;
+
+    if (px < 0 || py < 0 || tx >= m->width || ty >= m->height)
+        return;
+
+    if (m->grid != NULL)
+    {
+        m->grid[(((size_t)ty * m->width + tx) << 2) + ((py & 1) << 1) +
+                (px & 1)] = id;
+        return;
+    }
+
+    MapChunk* c = mapFindChunk(m, tx >> CHUNK_SHIFT, ty >> CHUNK_SHIFT);
+
+    if (c == NULL)
+    {
+        // erasing an unpainted area is a no-op
+        if (id == EMPTY_PIECE)
+            return;
+
+        c = mapNewChunk(m, tx >> CHUNK_SHIFT, ty >> CHUNK_SHIFT);
+
+        if (c == NULL)
+            return;
+
+        m->last = c;
+    }
+
+    int            x = tx & CHUNK_MASK, y = ty & CHUNK_MASK;
+    unsigned char* t = &c->pieces[((y << CHUNK_SHIFT) + x) << 2];
+
+    t[((py & 1) << 1) + (px & 1)] = id;
+
+    if (tileEmpty(t))
+        c->occupied[y] &= ~((uint32_t)1 << x);
+    else
+        c->occupied[y] |= (uint32_t)1 << x;
+
+    markChunk(m, c);
+}
+
+size_t mapChunkBytes(const Map* m)
+{
+    return m->count * sizeof(MapChunk) + m->capacity * sizeof(MapChunk*);
+}
+
+void mapDropChunk(Map* m, int cx, int cy)
+{
+    if (m->grid != NULL || m->capacity == 0)
+        return;
+
+    size_t mask = m->capacity - 1, s = chunkHash(cx, cy) & mask;
+
+    while (m->slots[s] != NULL &&
+           (m->slots[s]->cx != cx || m->slots[s]->cy != cy))
+        s = (s + 1) & mask;
+
+    MapChunk* c = m->slots[s];
+
+    if (c == NULL)
+        return;
+
+    if (c->dirty)
+    {
+        for (size_t i = 0; i < m->dirtyCount; i++)
+        {
+            if (m->dirty[i] == c)
+            {
+                m->dirty[i] = m->dirty[--m->dirtyCount];
+                break;
+            }
+        }
+    }
+
+    if (m->last == c)
+        m->last = NULL;
+
+    free(c);
+    m->slots[s] = NULL;
+    m->count--;
+
+    // shift the rest of the probe run back so lookups still reach them
+    for (size_t i = s, j = (s + 1) & mask; m->slots[j] != NULL;
+         j = (j + 1) & mask)
+    {
+        size_t k = chunkHash(m->slots[j]->cx, m->slots[j]->cy) & mask;
+
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+
+        m->slots[i] = m->slots[j];
+        m->slots[j] = NULL;
+        i           = j;
+    }
+}
+
+void mapMarkDirty(Map* m, int cx, int cy)
+{
+    MapChunk* c = mapFindChunk(m, cx, cy);
+
+    if (c != NULL)
+    {
+        c->counted = false;
+        markChunk(m, c);
+    }
+}
+
+unsigned char* mapWriteTiles(Map* m, int tx, int ty, bool create)
+{
+    if (m->grid != NULL)
+        return m->grid + (((size_t)ty * m->width + tx) << 2);
+
+    int       cx = tx >> CHUNK_SHIFT, cy = ty >> CHUNK_SHIFT;
+    MapChunk* c  = mapFindChunk(m, cx, cy);
+
+    if (c == NULL && create && (c = mapNewChunk(m, cx, cy)) != NULL)
+        m->last = c;
+
+    if (c == NULL)
+        return NULL;
+
+    c->counted = false;
+    markChunk(m, c);
+
+    return &c->pieces[(((ty & CHUNK_MASK) << CHUNK_SHIFT) + (tx & CHUNK_MASK))
+                      << 2];
+}
+
+static int least(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+static int most(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+bool mapCopyTiles(Map* dst, int dx, int dy, Map* src, int sx, int sy, int w,
+                  int h)
+{
+    int x0 = most(most(0, -dx), src != NULL ? -sx : 0),
+        y0 = most(most(0, -dy), src != NULL ? -sy : 0),
+        x1 = least(least(w, dst->width - dx),
+                   src != NULL ? src->width - sx : w),
+        y1 = least(least(h, dst->height - dy),
+                   src != NULL ? src->height - sy : h);
+
+    for (int y = y0; y < y1; y++)
+    {
+        // segments end wherever either level's chunks do
+        for (int x = x0, n; x < x1; x += n)
+        {
+            n = least(least(x1 - x, CHUNK_TILES - ((dx + x) & CHUNK_MASK)),
+                      CHUNK_TILES - ((sx + x) & CHUNK_MASK));
+
+            unsigned char* from =
+                src != NULL ? mapGetTile(src, sx + x, sy + y) : NULL;
+            unsigned char* to =
+                mapWriteTiles(dst, dx + x, dy + y, from != NULL);
+
+            if (to == NULL && from != NULL)
+                return false;
+
+            if (to == NULL)
+                continue;
+
+            if (from != NULL)
+                memcpy(to, from, n << 2);
+            else
+                memset(to, EMPTY_PIECE, n << 2);
+        }
+    }
+
+    return true;
+}
+
+void mapClearDirty(Map* m)
+{
+    for (size_t i = 0; i < m->dirtyCount; i++)
+        m->dirty[i]->dirty = false;
+
+    m->dirtyCount = 0;
+}
+
+static bool copyChunk(Map* dst, const MapChunk* c)
+{
+    MapChunk* d = mapFindChunk(dst, c->cx, c->cy);
+
+    if (d == NULL && (d = mapNewChunk(dst, c->cx, c->cy)) == NULL)
+        return false;
+
+    memcpy(d->pieces, c->pieces, CHUNK_BYTES);
+    memcpy(d->occupied, c->occupied, sizeof(c->occupied));
+    d->counted = c->counted;
+
+    if (c->dirty)
+        markChunk(dst, d);
+
+    return true;
+}
+
+bool mapSnapshot(Map* dst, Map* src, bool full)
+{
+    if (src->grid != NULL)
+        return false;
+
+    if (full)
+    {
+        mapClear(dst);
+
+        dst->width    = src->width;
+        dst->height   = src->height;
+        dst->tileSize = src->tileSize;
+        dst->sheetId  = src->sheetId;
+        dst->format   = src->format;
+        dst->garbage  = src->garbage;
+        strcpy(dst->path, src->path);
+
+        for (size_t i = 0; i < src->capacity; i++)
+            if (src->slots[i] != NULL && !copyChunk(dst, src->slots[i]))
+                return false;
+    }
+    else
+    {
+        for (size_t i = 0; i < src->dirtyCount; i++)
+            if (!copyChunk(dst, src->dirty[i]))
+                return false;
+    }
+
+    mapClearDirty(src);
+
+    return true;
+}
+
+static void setSaved(Map* m, const char* path, enum MAP_FORMAT format)
+{
+    mapClearDirty(m);
+
+    m->format  = format;
+    m->garbage = 0;
+    m->path[0] = '\0';
+    strncat(m->path, path, sizeof(m->path) - 1);
+}
+
+void mapSetFile(Map* m, const char* path, enum MAP_FORMAT format,
+                uint64_t garbage)
+{
+    setSaved(m, path, format);
+
+    m->garbage = garbage;
+}
+
+static bool mapLoadContainer(Map* m, const char* path)
+{
+    MapFile f;
+
+    if (!mapFileOpen(&f, path))
+        return false;
+
+    mapClear(m);
+
+    m->width   = f.header.width;
+    m->height  = f.header.height;
+    m->sheetId = f.header.sheetId;
+
+    bool     success = true;
+    uint64_t live    = MAP_FILE_HEADER_SIZE + (uint64_t)f.header.chunksX *
+                                               f.header.chunksY *
+                                               MAP_FILE_ENTRY_SIZE;
+
+    for (unsigned int cy = 0; cy < f.header.chunksY && success; cy++)
+    {
+        for (unsigned int cx = 0; cx < f.header.chunksX && success; cx++)
+        {
+            if (f.table[cy * f.header.chunksX + cx].coding == CHUNK_EMPTY)
+                continue;
+
+            unsigned char* pieces = mapChunkData(m, cx, cy, true);
+
+            success = pieces != NULL &&
+                      mapFileReadChunk(&f, cx, cy, pieces);
+
+            live += f.table[cy * f.header.chunksX + cx].size;
+        }
+    }
+
+    if (success)
+    {
+        setSaved(m, path, MAP_FORMAT_LVL);
+
+        // chunks replaced by earlier incremental saves
+        if (fseeko(f.fp, 0, SEEK_END) == 0 && (uint64_t)ftello(f.fp) > live)
+            m->garbage = ftello(f.fp) - live;
+    }
+
+    mapFileClose(&f);
+
+    return success;
+}
+
+static bool isEmptySpan(const unsigned char* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (p[i] != EMPTY_PIECE)
+            return false;
+
+    return true;
+}
+
+int mapRawHeight(uint64_t bytes, int width)
+{
+    uint64_t row = (uint64_t)width << 2;
+
+    if (row == 0 || bytes == 0 || (bytes + row - 1) / row > INT_MAX)
+        return 0;
+
+    return (int)((bytes + row - 1) / row);
+}
+
+// whatever level was loaded before, a raw one is baseWidth wide
+static bool mapLoadRawFile(Map* m, FILE* fp)
+{
+    int height = fseeko(fp, 0, SEEK_END) == 0 ?
+                     mapRawHeight(ftello(fp), m->baseWidth) :
+                     0;
+
+    if (height == 0 || fseeko(fp, 0, SEEK_SET) != 0)
+        return false;
+
+    size_t         row     = (size_t)m->baseWidth << 2;
+    unsigned char* buffer  = malloc(row);
+    bool           success = true;
+
+    if (buffer == NULL)
+        return false;
+
+    mapClear(m);
+
+    m->width   = m->baseWidth;
+    m->height  = height;
+    m->sheetId = 0;
+
+    // one tile row at a time, copied straight into the chunk rows it covers;
+    // blank spans are skipped so blank chunks stay unallocated
+    for (int ty = 0; ty < m->height && success; ty++)
+    {
+        size_t n = fread(buffer, sizeof(buffer[0]), row, fp);
+
+        if (n < row)
+            memset(buffer + n, EMPTY_PIECE, row - n);
+
+        for (int tx = 0; tx < m->width; tx += CHUNK_TILES)
+        {
+            unsigned char* span = buffer + ((size_t)tx << 2);
+            size_t         len  = (size_t)(m->width - tx < CHUNK_TILES ?
+                                        m->width - tx :
+                                        CHUNK_TILES)
+                         << 2;
+
+            int cx = tx >> CHUNK_SHIFT, cy = ty >> CHUNK_SHIFT;
+
+            if (isEmptySpan(span, len) && !mapHasChunk(m, cx, cy))
+                continue;
+
+            unsigned char* pieces = mapChunkData(m, cx, cy, true);
+
+            if (pieces == NULL)
+            {
+                success = false;
+                break;
+            }
+
+            memcpy(pieces + ((ty & CHUNK_MASK) << (CHUNK_SHIFT + 2)),
+                   span,
+                   len);
+        }
+    }
+
+    free(buffer);
+
+    return success;
+}
+
+bool mapLoadFile(Map* m, const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+
+    if (fp == NULL)
+        return false;
+
+    if (mapFileIsContainer(fp))
+    {
+        fclose(fp);
+        return mapLoadContainer(m, path);
+    }
+
+    // headerless files are the original raw dump
+    bool success = mapLoadRawFile(m, fp);
+
+    if (success)
+        setSaved(m, path, MAP_FORMAT_RAW);
+
+    fclose(fp);
+
+    return success;
+}
+
+bool mapSaveFile(Map* m, const char* path)
+{
+    if (!mapFileWrite(m, path))
+        return false;
+
+    setSaved(m, path, MAP_FORMAT_LVL);
+
+    return true;
+}
+
+bool mapSaveRawFile(Map* m, const char* path, unsigned char buffer[])
+{
+    FILE* fp = fopen(path, "wb");
+
+    if (fp == NULL)
+        return false;
+
+    bool   success = true;
+    size_t row     = (size_t)m->width << 2;
+
+    for (int ty = 0; ty < m->height && success; ty++)
+    {
+        // a chunk's share of a tile row is contiguous in either storage
+        for (int tx = 0; tx < m->width; tx += CHUNK_TILES)
+        {
+            unsigned char* t   = mapGetTile(m, tx, ty);
+            size_t         len = (size_t)(m->width - tx < CHUNK_TILES ?
+                                       m->width - tx :
+                                       CHUNK_TILES)
+                         << 2;
+
+            if (t != NULL)
+                memcpy(buffer + ((size_t)tx << 2), t, len);
+            else
+                memset(buffer + ((size_t)tx << 2), EMPTY_PIECE, len);
+        }
+
+        success = fwrite(buffer, sizeof(buffer[0]), row, fp) == row;
+    }
+
+    if (fclose(fp) != 0)
+        success = false;
+
+    if (success)
+        setSaved(m, path, MAP_FORMAT_RAW);
+
+    return success;
+}
+
+// the dirty chunk rows are written in place, each one is contiguous in the
+// raw layout
+static bool mapUpdateRawFile(Map* m)
+{
+    int fd = open(m->path, O_WRONLY);
+
+    if (fd < 0)
+        return false;
+
+    bool success = true;
+
+    for (size_t i = 0; i < m->dirtyCount && success; i++)
+    {
+        MapChunk* c = m->dirty[i];
+
+        int tx0 = c->cx << CHUNK_SHIFT, ty0 = c->cy << CHUNK_SHIFT, cols, rows;
+
+        chunkExtent(m, c->cx, c->cy, &cols, &rows);
+
+        for (int y = 0; y < rows && success; y++)
+        {
+            size_t len = (size_t)cols << 2;
+            off_t  at  = ((off_t)(ty0 + y) * m->width + tx0) << 2;
+
+            success = pwrite(fd,
+                             c->pieces + (y << (CHUNK_SHIFT + 2)),
+                             len,
+                             at) == (ssize_t)len;
+        }
+    }
+
+    if (close(fd) != 0)
+        success = false;
+
+    return success;
+}
+
+bool mapSaveChanges(Map* m, const char* path)
+{
+    if (m->grid != NULL)
+        return mapSyncFile(m);
+
+    if (m->format == MAP_FORMAT_NONE || strcmp(path, m->path) != 0)
+        return false;
+
+    if (m->dirtyCount == 0)
+        return true;
+
+    bool success = m->format == MAP_FORMAT_RAW ? mapUpdateRawFile(m) :
+                                                 mapFileUpdate(m);
+
+    if (success)
+        mapClearDirty(m);
+
+    return success;
+}
+
+bool mapOpenFile(Map* m, const char* path)
+{
+#ifdef MAP_HAVE_MMAP
+    int fd = open(path, O_RDWR);
+
+    if (fd < 0)
+        return false;
+
+    // only the raw layout can be edited in place
+    char magic[4];
+
+    if (pread(fd, magic, 4, 0) == 4 && memcmp(magic, MAP_FILE_MAGIC, 4) == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // the file is mapped as it is, one that isn't whole rows of a raw
+    // level is left to the buffered load rather than extended
+    struct stat st;
+
+    int    height = fstat(fd, &st) == 0 ?
+                        mapRawHeight(st.st_size, m->baseWidth) :
+                        0;
+    size_t size   = ((size_t)m->baseWidth * height) << 2;
+
+    if (height == 0 || (size_t)st.st_size != size)
+    {
+        close(fd);
+        return false;
+    }
+
+    unsigned char* grid =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (grid == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    mapClear(m);
+
+    m->width   = m->baseWidth;
+    m->height  = height;
+    m->sheetId = 0;
+
+    m->grid     = grid;
+    m->gridSize = size;
+    m->fd       = fd;
+
+    setSaved(m, path, MAP_FORMAT_RAW);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool mapSyncFile(Map* m)
+{
+#ifdef MAP_HAVE_MMAP
+    if (m->grid == NULL)
+        return false;
+
+    return msync(m->grid, m->gridSize, MS_SYNC) == 0;
+#else
+    return false;
+#endif
+}
+
+void mapCloseFile(Map* m)
+{
+#ifdef MAP_HAVE_MMAP
+    if (m->grid == NULL)
+        return;
+
+    munmap(m->grid, m->gridSize);
+    close(m->fd);
+
+    m->grid     = NULL;
+    m->gridSize = 0;
+    m->fd       = -1;
+#endif
+}
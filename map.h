@@ -0,0 +1,134 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// a chunk covers CHUNK_TILES x CHUNK_TILES tiles (2x2 pieces each)
+#define CHUNK_SHIFT 5
+#define CHUNK_TILES (1 << CHUNK_SHIFT)
+#define CHUNK_MASK  (CHUNK_TILES - 1)
+#define CHUNK_BYTES (CHUNK_TILES * CHUNK_TILES * 4)
+
+// piece id of an unpainted cell, never materializes a chunk
+#define EMPTY_PIECE 135
+
+enum MAP_IO { MAP_IO_BUFFERED, MAP_IO_MMAP, MAP_IO_STREAM };
+
+enum MAP_FORMAT { MAP_FORMAT_NONE, MAP_FORMAT_RAW, MAP_FORMAT_LVL };
+
+// pieces are kept the way the map file stores them, four bytes per tile
+// ([0][1] over [2][3]) with tiles in row order; occupied has bit tx of row
+// ty set while that tile holds a piece, recounted lazily after bulk writes
+typedef struct MapChunk
+{
+    int           cx, cy;
+    bool          dirty, counted;
+    uint32_t      occupied[CHUNK_TILES];
+    unsigned char pieces[CHUNK_BYTES];
+} MapChunk;
+
+// sparse tile storage, chunks are allocated on first non-empty write and
+// looked up through an open addressed hash of chunk coordinates; with
+// MAP_IO_MMAP the whole level is instead the mapped file itself (grid)
+typedef struct Map
+{
+    int width, height; // in tiles
+    int tileSize;
+
+    // what mapInit was given; raw files have no header, they are always
+    // baseWidth tiles wide and as tall as their size says
+    int baseWidth, baseHeight;
+
+    MapChunk** slots;
+    size_t     capacity, count;
+
+    MapChunk* last; // last chunk hit, strokes mostly stay inside one
+
+    unsigned int sheetId;
+
+    // chunks edited since the last save, and the file they belong to
+    MapChunk**      dirty;
+    size_t          dirtyCount, dirtyCapacity;
+    enum MAP_FORMAT format;
+    char            path[256];
+    uint64_t        garbage; // bytes of replaced chunks left in the file
+
+    enum MAP_IO    io;
+    unsigned char* grid;
+    size_t         gridSize;
+    int            fd;
+} Map;
+
+bool mapInit(Map* m, int width, int height, int tileSize);
+void mapFree(Map* m);
+void mapClear(Map* m);
+
+// the four pieces of a tile, for reading; the tiles that follow it up to the
+// end of its chunk row are contiguous, so rows can be walked linearly
+bool           mapHasChunk(Map* m, int cx, int cy);
+unsigned char* mapGetTile(Map* m, int tx, int ty);
+
+// chunk sized views in tile order, out of level tiles read as empty; the
+// pointer mapChunkData hands out may be written through
+unsigned char* mapChunkData(Map* m, int cx, int cy, bool create);
+bool           mapCopyChunk(Map* m, int cx, int cy, unsigned char out[]);
+
+// which tiles of a chunk hold pieces, bit tx of rows[ty]; false when the
+// chunk was never painted
+bool mapChunkRows(Map* m, int cx, int cy, uint32_t rows[]);
+
+short mapGetPiece(Map* m, int px, int py);
+void  mapSetPiece(Map* m, int px, int py, short id);
+
+size_t mapChunkBytes(const Map* m);
+
+// frees one chunk, streamed levels only keep part of the map in memory
+void mapDropChunk(Map* m, int cx, int cy);
+
+// bulk writers that bypass mapSetPiece mark what they touched
+void mapMarkDirty(Map* m, int cx, int cy);
+void mapClearDirty(Map* m);
+
+// tile (tx, ty) to be written, with the tiles after it up to the end of its
+// chunk row; the chunk is marked edited and its occupancy recounted when
+// next asked, NULL when it doesn't exist and create is false or it failed
+unsigned char* mapWriteTiles(Map* m, int tx, int ty, bool create);
+
+// w x h tiles from (sx, sy) of src over (dx, dy) of dst, cut to both levels,
+// a memcpy per chunk row; unpainted parts of src, or all of it when src is
+// NULL, clear dst; false when a chunk couldn't be made
+bool mapCopyTiles(Map* dst, int dx, int dy, Map* src, int sx, int sy, int w,
+                  int h);
+
+// brings dst up to date with src for saving off the main thread: full copies
+// every chunk and src's file state, otherwise only src's dirty chunks are
+// copied; either way the dirty set moves over to dst
+bool mapSnapshot(Map* dst, Map* src, bool full);
+
+// rows of width tiles a raw file of bytes holds, a short last row counted
+// and padded with empty pieces when read; 0 when there's nothing to read
+int mapRawHeight(uint64_t bytes, int width);
+
+// buffered i/o, buffer holds one row of tiles (width * 4 bytes); loads
+// take either format, level dimensions come from the header or for raw
+// files from mapRawHeight
+bool mapLoadFile(Map* m, const char* path);
+bool mapSaveFile(Map* m, const char* path);
+bool mapSaveRawFile(Map* m, const char* path, unsigned char buffer[]);
+
+// marks the map as a clean copy of path, for loads done outside mapLoadFile
+void mapSetFile(Map* m, const char* path, enum MAP_FORMAT format,
+                uint64_t garbage);
+
+// writes only the dirty chunks back to the file the map came from, in its
+// own format; false means a full save is needed instead
+bool mapSaveChanges(Map* m, const char* path);
+
+// file backed i/o, edits land in the page cache and mapSyncFile flushes them
+bool mapOpenFile(Map* m, const char* path);
+bool mapSyncFile(Map* m);
+void mapCloseFile(Map* m);
+
+#endif
@@ -0,0 +1,741 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "mapfile.h"
+
+static void put16(unsigned char* p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char* p, unsigned int v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char* p, uint64_t v)
+{
+    put32(p, (unsigned int)v);
+    put32(p + 4, (unsigned int)(v >> 32));
+}
+
+static unsigned int get16(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char* p)
+{
+    return get16(p) | ((unsigned int)get16(p + 2) << 16);
+}
+
+static uint64_t get64(const unsigned char* p)
+{
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+size_t chunkEncode(const unsigned char in[], size_t size, unsigned char out[])
+{
+    size_t i = 0, o = 0;
+
+    while (i < size)
+    {
+        size_t run = 1;
+
+        while (i + run < size && run < 128 && in[i + run] == in[i])
+            run++;
+
+        if (run > 1)
+        {
+            // 257 - n: repeat the next byte n times
+            out[o++] = 257 - run;
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        // literals until the next run of at least three
+        size_t lit = 1;
+
+        while (i + lit < size && lit < 128 &&
+               !(i + lit + 2 < size && in[i + lit] == in[i + lit + 1] &&
+                 in[i + lit] == in[i + lit + 2]))
+            lit++;
+
+        // n - 1: copy the next n bytes
+        out[o++] = lit - 1;
+        memcpy(out + o, in + i, lit);
+        o += lit;
+        i += lit;
+    }
+
+    return o;
+}
+
+bool chunkDecode(const unsigned char in[], size_t size, unsigned char out[],
+                 size_t outSize)
+{
+    size_t i = 0, o = 0;
+
+    while (i < size)
+    {
+        unsigned int n = in[i++];
+
+        if (n < 128)
+        {
+            n++;
+
+            if (i + n > size || o + n > outSize)
+                return false;
+
+            memcpy(out + o, in + i, n);
+            i += n;
+        }
+        else
+        {
+            n = 257 - n;
+
+            if (i >= size || o + n > outSize)
+                return false;
+
+            memset(out + o, in[i++], n);
+        }
+
+        o += n;
+    }
+
+    return o == outSize;
+}
+
+bool mapFileIsContainer(FILE* fp)
+{
+    char magic[4];
+
+    bool found =
+        fread(magic, 1, 4, fp) == 4 && memcmp(magic, MAP_FILE_MAGIC, 4) == 0;
+
+    rewind(fp);
+
+    return found;
+}
+
+bool mapFileParseHeader(const unsigned char header[], MapFileHeader* h)
+{
+    if (memcmp(header, MAP_FILE_MAGIC, 4) != 0)
+        return false;
+
+    h->version   = get16(header + 4);
+    h->pieceSize = get16(header + 6);
+    h->width     = get32(header + 8);
+    h->height    = get32(header + 12);
+    h->sheetId   = get32(header + 16);
+    h->chunksX   = get32(header + 20);
+    h->chunksY   = get32(header + 24);
+
+    // a corrupt file in maps is parsed by the index and thumbnails too,
+    // its sizes end up in ints and the table is allocated from them
+    if (h->version == 0 || h->version > MAP_FILE_VERSION ||
+        h->pieceSize != MAP_FILE_PIECE_SIZE || h->width == 0 ||
+        h->height == 0 || h->width > INT_MAX >> CHUNK_SHIFT ||
+        h->height > INT_MAX >> CHUNK_SHIFT)
+        return false;
+
+    return h->chunksX == ((uint64_t)h->width + CHUNK_MASK) >> CHUNK_SHIFT &&
+           h->chunksY == ((uint64_t)h->height + CHUNK_MASK) >> CHUNK_SHIFT;
+}
+
+static bool fileOpen(MapFile* f, const char* path, const char* mode)
+{
+    unsigned char header[MAP_FILE_HEADER_SIZE];
+
+    f->table = NULL;
+    f->fp    = fopen(path, mode);
+
+    if (f->fp == NULL)
+        return false;
+
+    if (fread(header, 1, MAP_FILE_HEADER_SIZE, f->fp) != MAP_FILE_HEADER_SIZE ||
+        !mapFileParseHeader(header, &f->header))
+    {
+        mapFileClose(f);
+        return false;
+    }
+
+    MapFileHeader* h = &f->header;
+
+    size_t count = (size_t)h->chunksX * h->chunksY;
+    off_t  end   = fseeko(f->fp, 0, SEEK_END) == 0 ? ftello(f->fp) : -1;
+
+    // a table longer than the file is a bad header, not a huge level
+    if (end < MAP_FILE_HEADER_SIZE ||
+        (uint64_t)(end - MAP_FILE_HEADER_SIZE) / MAP_FILE_ENTRY_SIZE < count ||
+        fseeko(f->fp, MAP_FILE_HEADER_SIZE, SEEK_SET) != 0)
+    {
+        mapFileClose(f);
+        return false;
+    }
+
+    unsigned char* raw = malloc(count * MAP_FILE_ENTRY_SIZE);
+
+    f->table = malloc(count * sizeof(MapFileChunk));
+
+    if (raw == NULL || f->table == NULL ||
+        fread(raw, MAP_FILE_ENTRY_SIZE, count, f->fp) != count)
+    {
+        free(raw);
+        mapFileClose(f);
+        return false;
+    }
+
+    // chunks replaced by earlier incremental saves
+    uint64_t live = MAP_FILE_HEADER_SIZE + count * MAP_FILE_ENTRY_SIZE;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned char* e = raw + i * MAP_FILE_ENTRY_SIZE;
+
+        f->table[i].offset = get64(e);
+        f->table[i].size   = get32(e + 8);
+        f->table[i].coding = e[12];
+
+        if (f->table[i].coding != CHUNK_EMPTY)
+            live += f->table[i].size;
+    }
+
+    free(raw);
+
+    f->size    = end;
+    f->garbage = (uint64_t)end > live ? end - live : 0;
+
+    return true;
+}
+
+bool mapFileOpen(MapFile* f, const char* path)
+{
+    return fileOpen(f, path, "rb");
+}
+
+bool mapFileOpenWritable(MapFile* f, const char* path)
+{
+    return fileOpen(f, path, "r+b");
+}
+
+bool mapFileReadChunk(MapFile* f, int cx, int cy, unsigned char out[])
+{
+    if (cx < 0 || cy < 0 || (unsigned int)cx >= f->header.chunksX ||
+        (unsigned int)cy >= f->header.chunksY)
+        return false;
+
+    MapFileChunk* c = &f->table[(size_t)cy * f->header.chunksX + cx];
+
+    unsigned char packed[CHUNK_RLE_MAX];
+
+    switch (c->coding)
+    {
+    case CHUNK_EMPTY:
+        memset(out, EMPTY_PIECE, CHUNK_BYTES);
+        return true;
+    case CHUNK_STORED:
+        return c->size == CHUNK_BYTES &&
+               fseeko(f->fp, c->offset, SEEK_SET) == 0 &&
+               fread(out, 1, CHUNK_BYTES, f->fp) == CHUNK_BYTES;
+    case CHUNK_RLE:
+        return c->size <= CHUNK_RLE_MAX &&
+               fseeko(f->fp, c->offset, SEEK_SET) == 0 &&
+               fread(packed, 1, c->size, f->fp) == c->size &&
+               chunkDecode(packed, c->size, out, CHUNK_BYTES);
+    }
+
+    return false;
+}
+
+void mapFileClose(MapFile* f)
+{
+    if (f->fp != NULL)
+        fclose(f->fp);
+
+    free(f->table);
+
+    f->fp    = NULL;
+    f->table = NULL;
+}
+
+static bool isEmptyChunk(const unsigned char pieces[])
+{
+    for (int i = 0; i < CHUNK_BYTES; i++)
+        if (pieces[i] != EMPTY_PIECE)
+            return false;
+
+    return true;
+}
+
+bool mapFileWrite(Map* m, const char* path)
+{
+    unsigned int chunksX = (m->width + CHUNK_MASK) >> CHUNK_SHIFT,
+                 chunksY = (m->height + CHUNK_MASK) >> CHUNK_SHIFT;
+
+    size_t count = (size_t)chunksX * chunksY;
+
+    unsigned char  header[MAP_FILE_HEADER_SIZE] = { 0 };
+    unsigned char* table = calloc(count, MAP_FILE_ENTRY_SIZE);
+
+    FILE* fp = fopen(path, "wb");
+
+    if (table == NULL || fp == NULL)
+    {
+        free(table);
+        if (fp != NULL)
+            fclose(fp);
+        return false;
+    }
+
+    memcpy(header, MAP_FILE_MAGIC, 4);
+    put16(header + 4, MAP_FILE_VERSION);
+    put16(header + 6, m->tileSize >> 1);
+    put32(header + 8, m->width);
+    put32(header + 12, m->height);
+    put32(header + 16, m->sheetId);
+    put32(header + 20, chunksX);
+    put32(header + 24, chunksY);
+
+    // the table is written blank first and filled in once offsets are known
+    bool success = fwrite(header, 1, MAP_FILE_HEADER_SIZE, fp) ==
+                       MAP_FILE_HEADER_SIZE &&
+                   fwrite(table, MAP_FILE_ENTRY_SIZE, count, fp) == count;
+
+    uint64_t offset = MAP_FILE_HEADER_SIZE + count * MAP_FILE_ENTRY_SIZE;
+
+    unsigned char pieces[CHUNK_BYTES], packed[CHUNK_RLE_MAX];
+
+    for (unsigned int cy = 0; cy < chunksY && success; cy++)
+    {
+        for (unsigned int cx = 0; cx < chunksX && success; cx++)
+        {
+            if (!mapCopyChunk(m, cx, cy, pieces) || isEmptyChunk(pieces))
+                continue;
+
+            unsigned char* e =
+                table + ((size_t)cy * chunksX + cx) * MAP_FILE_ENTRY_SIZE;
+            size_t       size   = chunkEncode(pieces, CHUNK_BYTES, packed);
+            unsigned int coding = CHUNK_RLE;
+
+            if (size >= CHUNK_BYTES)
+            {
+                size   = CHUNK_BYTES;
+                coding = CHUNK_STORED;
+            }
+
+            success = fwrite(coding == CHUNK_RLE ? packed : pieces,
+                             1,
+                             size,
+                             fp) == size;
+
+            put64(e, offset);
+            put32(e + 8, size);
+            e[12] = coding;
+
+            offset += size;
+        }
+    }
+
+    if (success)
+        success = fseeko(fp, MAP_FILE_HEADER_SIZE, SEEK_SET) == 0 &&
+                  fwrite(table, MAP_FILE_ENTRY_SIZE, count, fp) == count;
+
+    if (fclose(fp) != 0)
+        success = false;
+
+    free(table);
+
+    return success;
+}
+
+bool mapFileUpdate(Map* m)
+{
+    unsigned char header[MAP_FILE_HEADER_SIZE];
+
+    int fd = open(m->path, O_RDWR);
+
+    if (fd < 0)
+        return false;
+
+    off_t end = lseek(fd, 0, SEEK_END);
+
+    unsigned int chunksX = (m->width + CHUNK_MASK) >> CHUNK_SHIFT;
+
+    bool success = end > 0 && (uint64_t)end > m->garbage << 1 &&
+                   pread(fd, header, MAP_FILE_HEADER_SIZE, 0) ==
+                       MAP_FILE_HEADER_SIZE &&
+                   memcmp(header, MAP_FILE_MAGIC, 4) == 0 &&
+                   get32(header + 8) == (unsigned int)m->width &&
+                   get32(header + 12) == (unsigned int)m->height;
+
+    unsigned char packed[CHUNK_RLE_MAX];
+
+    for (size_t i = 0; i < m->dirtyCount && success; i++)
+    {
+        MapChunk*     c = m->dirty[i];
+        unsigned char e[MAP_FILE_ENTRY_SIZE];
+
+        off_t at = MAP_FILE_HEADER_SIZE +
+                   ((off_t)c->cy * chunksX + c->cx) * MAP_FILE_ENTRY_SIZE;
+
+        if (pread(fd, e, MAP_FILE_ENTRY_SIZE, at) != MAP_FILE_ENTRY_SIZE)
+        {
+            success = false;
+            break;
+        }
+
+        m->garbage += get32(e + 8);
+
+        memset(e, 0, MAP_FILE_ENTRY_SIZE);
+
+        if (!isEmptyChunk(c->pieces))
+        {
+            size_t       size   = chunkEncode(c->pieces, CHUNK_BYTES, packed);
+            unsigned int coding = CHUNK_RLE;
+
+            if (size >= CHUNK_BYTES)
+            {
+                size   = CHUNK_BYTES;
+                coding = CHUNK_STORED;
+            }
+
+            // payload first, the entry only points at it once it's written
+            success = pwrite(fd,
+                             coding == CHUNK_RLE ? packed : c->pieces,
+                             size,
+                             end) == (ssize_t)size;
+
+            put64(e, end);
+            put32(e + 8, size);
+            e[12] = coding;
+
+            end += size;
+        }
+
+        if (success)
+            success = pwrite(fd, e, MAP_FILE_ENTRY_SIZE, at) ==
+                      MAP_FILE_ENTRY_SIZE;
+    }
+
+    if (close(fd) != 0)
+        success = false;
+
+    return success;
+}
+
+// pieces the way they are stored, packed unless that doesn't make them
+// smaller; c gets the size and coding, the offset is left to the caller
+static const unsigned char* packChunk(const unsigned char pieces[],
+                                      unsigned char packed[], MapFileChunk* c)
+{
+    c->size   = chunkEncode(pieces, CHUNK_BYTES, packed);
+    c->coding = CHUNK_RLE;
+
+    if (c->size < CHUNK_BYTES)
+        return packed;
+
+    c->size   = CHUNK_BYTES;
+    c->coding = CHUNK_STORED;
+
+    return pieces;
+}
+
+bool mapFileWriteChunk(MapFile* f, int cx, int cy,
+                       const unsigned char pieces[])
+{
+    if (cx < 0 || cy < 0 || (unsigned int)cx >= f->header.chunksX ||
+        (unsigned int)cy >= f->header.chunksY)
+        return false;
+
+    size_t        i   = (size_t)cy * f->header.chunksX + cx;
+    MapFileChunk  old = f->table[i], c = { 0, 0, CHUNK_EMPTY };
+    unsigned char e[MAP_FILE_ENTRY_SIZE] = { 0 }, packed[CHUNK_RLE_MAX];
+    bool          inPlace = false;
+
+    bool success = true;
+
+    if (!isEmptyChunk(pieces))
+    {
+        const unsigned char* data = packChunk(pieces, packed, &c);
+
+        // back into the old copy's slot when it fits, otherwise the new
+        // copy goes to the end of the file, same as mapFileUpdate
+        inPlace = old.coding != CHUNK_EMPTY && c.size <= old.size;
+
+        off_t at = -1;
+
+        if (inPlace)
+            at = old.offset;
+        else if (fseeko(f->fp, 0, SEEK_END) == 0)
+            at = ftello(f->fp);
+
+        success = at > 0 && fseeko(f->fp, at, SEEK_SET) == 0 &&
+                  fwrite(data, 1, c.size, f->fp) == c.size;
+
+        c.offset = at;
+
+        put64(e, c.offset);
+        put32(e + 8, c.size);
+        e[12] = c.coding;
+    }
+
+    success = success &&
+              fseeko(f->fp,
+                     MAP_FILE_HEADER_SIZE + i * MAP_FILE_ENTRY_SIZE,
+                     SEEK_SET) == 0 &&
+              fwrite(e, 1, MAP_FILE_ENTRY_SIZE, f->fp) == MAP_FILE_ENTRY_SIZE;
+
+    if (!success)
+        return false;
+
+    // the old copy is dead, or the part of its slot the new one doesn't use
+    if (old.coding != CHUNK_EMPTY)
+        f->garbage += old.size - (inPlace ? c.size : 0);
+
+    if (c.coding != CHUNK_EMPTY && !inPlace)
+        f->size = c.offset + c.size;
+
+    f->table[i] = c;
+
+    return true;
+}
+
+bool mapFileWasteful(const MapFile* f)
+{
+    return f->garbage << 1 >= f->size;
+}
+
+// path with its file name dot prefixed, which keeps it out of the index
+static void tempPath(const char* path, char out[], size_t size)
+{
+    const char* name = strrchr(path, '/');
+
+    name = name != NULL ? name + 1 : path;
+
+    snprintf(out, size, "%.*s.%s.tmp", (int)(name - path), path, name);
+}
+
+bool mapFileCompact(MapFile* f, const char* path)
+{
+    MapFileHeader* h     = &f->header;
+    size_t         count = (size_t)h->chunksX * h->chunksY;
+    MapReader      r;
+    char           tmp[512];
+
+    tempPath(path, tmp, sizeof(tmp));
+
+    // the reader has a handle of its own, everything written has to be out
+    if (fflush(f->fp) != 0 || !mapReaderOpen(&r, path, 0))
+        return false;
+
+    unsigned char  header[MAP_FILE_HEADER_SIZE] = { 0 };
+    unsigned char* table = calloc(count, MAP_FILE_ENTRY_SIZE);
+    FILE*          fp    = table != NULL ? fopen(tmp, "wb") : NULL;
+
+    memcpy(header, MAP_FILE_MAGIC, 4);
+    put16(header + 4, MAP_FILE_VERSION);
+    put16(header + 6, h->pieceSize);
+    put32(header + 8, h->width);
+    put32(header + 12, h->height);
+    put32(header + 16, h->sheetId);
+    put32(header + 20, h->chunksX);
+    put32(header + 24, h->chunksY);
+
+    // the table is written blank first and filled in once offsets are known
+    bool success = fp != NULL && r.format == MAP_FORMAT_LVL &&
+                   fwrite(header, 1, MAP_FILE_HEADER_SIZE, fp) ==
+                       MAP_FILE_HEADER_SIZE &&
+                   fwrite(table, MAP_FILE_ENTRY_SIZE, count, fp) == count;
+
+    uint64_t      end = MAP_FILE_HEADER_SIZE + count * MAP_FILE_ENTRY_SIZE;
+    unsigned char pieces[CHUNK_BYTES], packed[CHUNK_RLE_MAX];
+    int           cx, cy;
+
+    // one chunk in memory at a time, however big the level is
+    while (success && mapReaderNext(&r, &cx, &cy, pieces))
+    {
+        MapFileChunk         c;
+        const unsigned char* data = packChunk(pieces, packed, &c);
+        unsigned char*       e =
+            table + ((size_t)cy * h->chunksX + cx) * MAP_FILE_ENTRY_SIZE;
+
+        success = fwrite(data, 1, c.size, fp) == c.size;
+
+        put64(e, end);
+        put32(e + 8, c.size);
+        e[12] = c.coding;
+
+        end += c.size;
+    }
+
+    success = success && !r.failed &&
+              fseeko(fp, MAP_FILE_HEADER_SIZE, SEEK_SET) == 0 &&
+              fwrite(table, MAP_FILE_ENTRY_SIZE, count, fp) == count;
+
+    mapReaderClose(&r);
+    free(table);
+
+    if (fp != NULL && fclose(fp) != 0)
+        success = false;
+
+    // opened before the rename, the handle follows the file over
+    MapFile next;
+
+    if (success && mapFileOpenWritable(&next, tmp))
+    {
+        if (rename(tmp, path) == 0)
+        {
+            mapFileClose(f);
+            *f = next;
+
+            return true;
+        }
+
+        mapFileClose(&next);
+    }
+
+    remove(tmp);
+
+    return false;
+}
+
+bool mapReaderOpen(MapReader* r, const char* path, int rawWidth)
+{
+    r->next    = 0;
+    r->failed  = false;
+    r->band    = NULL;
+    r->sheetId = 0;
+    r->garbage = 0;
+
+    if (mapFileOpen(&r->file, path))
+    {
+        MapFileHeader* h = &r->file.header;
+
+        r->format  = MAP_FORMAT_LVL;
+        r->width   = h->width;
+        r->height  = h->height;
+        r->chunksX = h->chunksX;
+        r->chunksY = h->chunksY;
+        r->sheetId = h->sheetId;
+        r->garbage = r->file.garbage;
+
+        return true;
+    }
+
+    // headerless files are the original raw dump
+    r->file.table = NULL;
+    r->file.fp    = fopen(path, "rb");
+
+    if (r->file.fp == NULL)
+        return false;
+
+    // a container mapFileOpen turned down is broken, not raw
+    if (mapFileIsContainer(r->file.fp))
+    {
+        mapFileClose(&r->file);
+        return false;
+    }
+
+    int height = fseeko(r->file.fp, 0, SEEK_END) == 0 ?
+                     mapRawHeight(ftello(r->file.fp), rawWidth) :
+                     0;
+
+    if (height == 0 || fseeko(r->file.fp, 0, SEEK_SET) != 0)
+    {
+        mapFileClose(&r->file);
+        return false;
+    }
+
+    r->format  = MAP_FORMAT_RAW;
+    r->width   = rawWidth;
+    r->height  = height;
+    r->chunksX = (rawWidth + CHUNK_MASK) >> CHUNK_SHIFT;
+    r->chunksY = (height + CHUNK_MASK) >> CHUNK_SHIFT;
+    r->band    = malloc(((size_t)rawWidth << 2) << CHUNK_SHIFT);
+
+    if (r->band == NULL)
+    {
+        mapFileClose(&r->file);
+        return false;
+    }
+
+    return true;
+}
+
+// the next chunk holding anything but empty pieces, false at the end of the
+// level or once a read fails
+bool mapReaderNext(MapReader* r, int* cx, int* cy, unsigned char out[])
+{
+    while (r->next < r->chunksX * r->chunksY && !r->failed)
+    {
+        int x = r->next % r->chunksX, y = r->next / r->chunksX;
+
+        r->next++;
+
+        if (r->format == MAP_FORMAT_LVL)
+        {
+            if (r->file.table[r->next - 1].coding == CHUNK_EMPTY)
+                continue;
+
+            if (!mapFileReadChunk(&r->file, x, y, out))
+            {
+                r->failed = true;
+                break;
+            }
+        }
+        else
+        {
+            size_t row  = (size_t)r->width << 2;
+            int    cols = r->width - (x << CHUNK_SHIFT),
+                rows    = r->height - (y << CHUNK_SHIFT);
+
+            if (cols > CHUNK_TILES)
+                cols = CHUNK_TILES;
+            if (rows > CHUNK_TILES)
+                rows = CHUNK_TILES;
+
+            // a whole chunk row is read at its first chunk, short files read
+            // as empty the way mapLoadFile treats them
+            if (x == 0)
+            {
+                size_t size = row * rows,
+                       n    = fread(r->band, 1, size, r->file.fp);
+
+                if (n < size)
+                    memset(r->band + n, EMPTY_PIECE, size - n);
+            }
+
+            if (cols < CHUNK_TILES || rows < CHUNK_TILES)
+                memset(out, EMPTY_PIECE, CHUNK_BYTES);
+
+            for (int ty = 0; ty < rows; ty++)
+                memcpy(out + (ty << (CHUNK_SHIFT + 2)),
+                       r->band + ty * row + ((size_t)x << (CHUNK_SHIFT + 2)),
+                       cols << 2);
+
+            if (isEmptyChunk(out))
+                continue;
+        }
+
+        *cx = x;
+        *cy = y;
+
+        return true;
+    }
+
+    return false;
+}
+
+void mapReaderClose(MapReader* r)
+{
+    mapFileClose(&r->file);
+    free(r->band);
+
+    r->band = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "map.h"
+
+// container layout, all fields little endian:
+//
+//   header   32 bytes, see MapFileHeader
+//   table    chunksX * chunksY entries of 16 bytes, row order
+//   payload  one block per non-empty chunk, CHUNK_BYTES once decoded
+//
+// a table entry is { u64 offset, u32 size, u8 coding, 3 bytes pad } so a
+// single chunk can be read with one seek
+#define MAP_FILE_MAGIC       "LVLM"
+#define MAP_FILE_VERSION     1
+#define MAP_FILE_HEADER_SIZE 32
+#define MAP_FILE_ENTRY_SIZE  16
+
+// pieces are drawn 16 pixels square, files saying otherwise aren't ours
+#define MAP_FILE_PIECE_SIZE 16
+
+enum CHUNK_CODING { CHUNK_EMPTY, CHUNK_STORED, CHUNK_RLE };
+
+typedef struct MapFileHeader
+{
+    unsigned int version, pieceSize, sheetId;
+    unsigned int width, height; // in tiles
+    unsigned int chunksX, chunksY;
+} MapFileHeader;
+
+typedef struct MapFileChunk
+{
+    uint64_t     offset;
+    unsigned int size, coding;
+} MapFileChunk;
+
+typedef struct MapFile
+{
+    FILE*         fp;
+    MapFileHeader header;
+    MapFileChunk* table;
+    uint64_t      size, garbage; // bytes, and those no entry points at
+} MapFile;
+
+bool mapFileIsContainer(FILE* fp);
+
+// false for anything but a header this version wrote: dimensions are
+// nonzero and small enough for an int once in chunks, the chunk counts
+// match them
+bool mapFileParseHeader(const unsigned char header[], MapFileHeader* h);
+
+bool mapFileOpen(MapFile* f, const char* path);
+bool mapFileReadChunk(MapFile* f, int cx, int cy, unsigned char out[]);
+void mapFileClose(MapFile* f);
+
+// writable handle for rewriting single chunks, the table entry in f is
+// kept in step with the file; a chunk goes back into its old slot when it
+// fits there and to the end of the file otherwise, what it leaves behind
+// counts as garbage
+bool mapFileOpenWritable(MapFile* f, const char* path);
+bool mapFileWriteChunk(MapFile* f, int cx, int cy,
+                       const unsigned char pieces[]);
+
+// past half the file in garbage, same as mapFileUpdate refuses at; then
+// the level at path, which f is open on, is copied chunk by chunk without
+// it into a temporary file that's renamed over it and f moves to that
+bool mapFileWasteful(const MapFile* f);
+bool mapFileCompact(MapFile* f, const char* path);
+
+bool mapFileWrite(Map* m, const char* path);
+
+// appends the map's dirty chunks to m->path and repoints their table
+// entries; refuses once half the file is replaced chunks so a full
+// mapFileWrite can compact it
+bool mapFileUpdate(Map* m);
+
+// streams a level chunk by chunk in row order, either format; raw files
+// have no header so they are read rawWidth wide and mapRawHeight tall
+typedef struct MapReader
+{
+    MapFile         file;
+    enum MAP_FORMAT format;
+    int             width, height, chunksX, chunksY;
+    unsigned int    sheetId;
+    uint64_t        garbage;
+
+    int            next;   // chunks scanned so far
+    bool           failed; // a read or decode error ended the level early
+    unsigned char* band;   // raw files, one chunk row of tiles
+} MapReader;
+
+bool mapReaderOpen(MapReader* r, const char* path, int rawWidth);
+bool mapReaderNext(MapReader* r, int* cx, int* cy, unsigned char out[]);
+void mapReaderClose(MapReader* r);
+
+// PackBits style run length coding of one chunk, output never exceeds
+// CHUNK_RLE_MAX bytes
+#define CHUNK_RLE_MAX (CHUNK_BYTES + CHUNK_BYTES / 128 + 1)
+
+size_t chunkEncode(const unsigned char in[], size_t size, unsigned char out[]);
+bool   chunkDecode(const unsigned char in[], size_t size, unsigned char out[],
+                   size_t outSize);
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define MAP_HAVE_INOTIFY
+#endif
+#include "mapindex.h"
+#include "mapfile.h"
+
+static int compareEntry(const void* a, const void* b)
+{
+    return strcmp(((const MapEntry*)a)->name, ((const MapEntry*)b)->name);
+}
+
+// slot of name, or where it would be inserted
+static size_t findEntry(const MapIndex* x, const char* name, bool* found)
+{
+    size_t lo = 0, hi = x->count;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) >> 1;
+        int    cmp = strcmp(x->entries[mid].name, name);
+
+        if (cmp == 0)
+        {
+            *found = true;
+            return mid;
+        }
+
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *found = false;
+
+    return lo;
+}
+
+static bool isListed(const char* name)
+{
+    return name[0] != '.' && strlen(name) < MAP_NAME_SIZE;
+}
+
+// hash and, for containers, dimensions out of a single pass over the file
+bool mapIndexRead(const char* dir, MapEntry* e)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, e->name);
+
+    FILE* fp = fopen(path, "rb");
+
+    if (fp == NULL)
+        return false;
+
+    unsigned char buffer[1 << 16];
+    size_t        n, total = 0;
+    uint64_t      hash = 0xcbf29ce484222325ULL;
+
+    e->width = e->height = 0;
+
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        MapFileHeader h;
+
+        if (total == 0 && n >= MAP_FILE_HEADER_SIZE &&
+            mapFileParseHeader(buffer, &h))
+        {
+            e->width  = h.width;
+            e->height = h.height;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            hash = (hash ^ buffer[i]) * 0x100000001b3ULL;
+
+        total += n;
+    }
+
+    fclose(fp);
+
+    e->hash = hash;
+
+    return true;
+}
+
+// brings one file's entry up to date, dropping it if the file is gone
+static void updateEntry(MapIndex* x, const char* name)
+{
+    if (!isListed(name))
+        return;
+
+    char        path[512];
+    struct stat st;
+    bool        found;
+
+    snprintf(path, sizeof(path), "%s/%s", x->dir, name);
+
+    size_t i = findEntry(x, name, &found);
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        if (found)
+        {
+            memmove(x->entries + i,
+                    x->entries + i + 1,
+                    (x->count - i - 1) * sizeof(MapEntry));
+            x->count--;
+            x->changed = true;
+        }
+        return;
+    }
+
+    if (found && x->entries[i].size == (uint64_t)st.st_size &&
+        x->entries[i].mtime == (int64_t)st.st_mtime)
+        return;
+
+    if (!found)
+    {
+        if (x->count == x->capacity)
+        {
+            size_t    capacity = x->capacity ? x->capacity << 1 : 64;
+            MapEntry* entries =
+                realloc(x->entries, capacity * sizeof(MapEntry));
+
+            if (entries == NULL)
+                return;
+
+            x->entries  = entries;
+            x->capacity = capacity;
+        }
+
+        memmove(x->entries + i + 1,
+                x->entries + i,
+                (x->count - i) * sizeof(MapEntry));
+        x->count++;
+
+        strcpy(x->entries[i].name, name);
+    }
+
+    MapEntry* e = &x->entries[i];
+
+    // listed straight away, the hash is read on a worker
+    e->size    = st.st_size;
+    e->mtime   = st.st_mtime;
+    e->width   = 0;
+    e->height  = 0;
+    e->hash    = 0;
+    e->pending = true;
+    e->queued  = false;
+
+    x->changed = true;
+    x->unread  = true;
+}
+
+void mapIndexResolve(MapIndex* x, const MapEntry* e)
+{
+    bool   found;
+    size_t i = findEntry(x, e->name, &found);
+
+    if (!found)
+        return;
+
+    MapEntry* to = &x->entries[i];
+
+    if (!to->pending || to->size != e->size || to->mtime != e->mtime)
+        return;
+
+    to->width   = e->width;
+    to->height  = e->height;
+    to->hash    = e->hash;
+    to->pending = false;
+
+    x->changed = true;
+}
+
+static void scanDir(MapIndex* x)
+{
+    x->scanned = time(NULL);
+
+    DIR* d = opendir(x->dir);
+
+    if (d == NULL)
+        return;
+
+    struct dirent* dir;
+
+    // new and changed files
+    while ((dir = readdir(d)) != NULL)
+        updateEntry(x, dir->d_name);
+
+    closedir(d);
+
+    // and the ones that are gone, from the back since they get removed
+    for (size_t i = x->count; i-- > 0;)
+    {
+        char name[MAP_NAME_SIZE];
+        strcpy(name, x->entries[i].name);
+
+        updateEntry(x, name);
+    }
+}
+
+static void loadCache(MapIndex* x)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", x->dir, MAP_INDEX_FILE);
+
+    FILE* fp = fopen(path, "r");
+
+    if (fp == NULL)
+        return;
+
+    MapEntry e;
+
+    // size mtime width height hash name, one file per line; exactly one
+    // space goes before the name, which may start with spaces of its own
+    while (fscanf(fp,
+                  "%" SCNu64 " %" SCNd64 " %d %d %" SCNx64,
+                  &e.size,
+                  &e.mtime,
+                  &e.width,
+                  &e.height,
+                  &e.hash) == 5 &&
+           fgetc(fp) == ' ' && fgets(e.name, sizeof(e.name), fp) != NULL)
+    {
+        e.name[strcspn(e.name, "\n")] = '\0';
+        e.pending                     = false;
+        e.queued                      = false;
+
+        if (x->count == x->capacity)
+        {
+            size_t    capacity = x->capacity ? x->capacity << 1 : 64;
+            MapEntry* entries =
+                realloc(x->entries, capacity * sizeof(MapEntry));
+
+            if (entries == NULL)
+                break;
+
+            x->entries  = entries;
+            x->capacity = capacity;
+        }
+
+        if (isListed(e.name))
+            x->entries[x->count++] = e;
+    }
+
+    fclose(fp);
+
+    qsort(x->entries, x->count, sizeof(MapEntry), compareEntry);
+}
+
+bool mapIndexOpen(MapIndex* x, const char* dir)
+{
+    x->dir[0] = '\0';
+    strncat(x->dir, dir, sizeof(x->dir) - 1);
+
+    x->entries  = NULL;
+    x->count    = 0;
+    x->capacity = 0;
+    x->watch    = -1;
+    x->scanned  = 0;
+    x->changed  = false;
+    x->unread   = false;
+
+    if (access(dir, F_OK) != 0)
+        mkdir(dir, 0700);
+
+#ifdef MAP_HAVE_INOTIFY
+    // watching starts before the scan so nothing slips in between
+    x->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (x->watch >= 0 &&
+        inotify_add_watch(x->watch,
+                          dir,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                              IN_DELETE) < 0)
+    {
+        close(x->watch);
+        x->watch = -1;
+    }
+#endif
+
+    loadCache(x);
+    scanDir(x);
+
+    return mapIndexSave(x);
+}
+
+void mapIndexClose(MapIndex* x)
+{
+    mapIndexSave(x);
+
+    if (x->watch >= 0)
+        close(x->watch);
+
+    free(x->entries);
+
+    x->entries = NULL;
+    x->count = x->capacity = 0;
+    x->watch                = -1;
+}
+
+static void readEvents(MapIndex* x)
+{
+#ifdef MAP_HAVE_INOTIFY
+    char buffer[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t n;
+
+    while ((n = read(x->watch, buffer, sizeof(buffer))) > 0)
+    {
+        for (char* p = buffer; p < buffer + n;)
+        {
+            struct inotify_event* ev = (struct inotify_event*)p;
+
+            // the kernel dropped events, only a full pass is safe now
+            if (ev->mask & IN_Q_OVERFLOW)
+                scanDir(x);
+            else if (ev->len > 0)
+                updateEntry(x, ev->name);
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+#endif
+}
+
+void mapIndexRefresh(MapIndex* x)
+{
+    if (x->watch >= 0)
+        readEvents(x);
+    else if (time(NULL) - x->scanned >= MAP_INDEX_RESCAN)
+        scanDir(x);
+}
+
+void mapIndexRescan(MapIndex* x)
+{
+    if (x->watch >= 0)
+        readEvents(x);
+    else
+        scanDir(x);
+}
+
+bool mapIndexSave(MapIndex* x)
+{
+    if (!x->changed)
+        return true;
+
+    char path[512], tmp[512];
+    snprintf(path, sizeof(path), "%s/%s", x->dir, MAP_INDEX_FILE);
+    snprintf(tmp, sizeof(tmp), "%s/%s.tmp", x->dir, MAP_INDEX_FILE);
+
+    FILE* fp = fopen(tmp, "w");
+
+    if (fp == NULL)
+        return false;
+
+    for (size_t i = 0; i < x->count; i++)
+    {
+        MapEntry* e = &x->entries[i];
+
+        if (e->pending)
+            continue;
+
+        fprintf(fp,
+                "%" PRIu64 " %" PRId64 " %d %d %016" PRIx64 " %s\n",
+                e->size,
+                e->mtime,
+                e->width,
+                e->height,
+                e->hash,
+                e->name);
+    }
+
+    // written aside and renamed over so a crash never leaves half an index
+    bool success = fclose(fp) == 0 && rename(tmp, path) == 0;
+
+    if (success)
+        x->changed = false;
+
+    return success;
+}
@@ -0,0 +1,62 @@
+#ifndef MAPINDEX_H
+#define MAPINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// cached next to the maps as MAP_INDEX_FILE, dot files aren't listed;
+// without inotify the directory is walked every MAP_INDEX_RESCAN seconds
+#define MAP_INDEX_FILE   ".index"
+#define MAP_NAME_SIZE    256
+#define MAP_INDEX_RESCAN 2
+
+typedef struct MapEntry
+{
+    char     name[MAP_NAME_SIZE];
+    uint64_t size;
+    int64_t  mtime;
+    int      width, height; // in tiles, 0 for raw files which don't say
+    uint64_t hash;          // FNV-1a of the whole file
+
+    // new or changed files are listed right away and read off the main
+    // thread, see mapIndexRead; queued once one has been asked for
+    bool pending, queued;
+} MapEntry;
+
+// every level in a directory, sorted by name; only files whose size or
+// mtime changed since the cache was written get read again, and inotify
+// (where there is one) keeps it current after that
+typedef struct MapIndex
+{
+    char      dir[256];
+    MapEntry* entries;
+    size_t    count, capacity;
+    int       watch;   // inotify fd, -1 rescans the directory instead
+    int64_t   scanned; // time of the last full pass
+    bool      changed;
+    bool      unread; // entries may be pending and not queued yet
+} MapIndex;
+
+bool mapIndexOpen(MapIndex* x, const char* dir);
+void mapIndexClose(MapIndex* x);
+
+// picks up files added, changed or removed since the last call; an
+// unwatched directory is only walked once MAP_INDEX_RESCAN has passed
+void mapIndexRefresh(MapIndex* x);
+
+// the same, but an unwatched directory is walked now
+void mapIndexRescan(MapIndex* x);
+
+// pending entries aren't saved, they are read again next time
+bool mapIndexSave(MapIndex* x);
+
+// hash and size of e's file in dir, safe on any thread since it only
+// touches e
+bool mapIndexRead(const char* dir, MapEntry* e);
+
+// a copy handed to mapIndexRead coming back; dropped when the file has
+// changed again since
+void mapIndexResolve(MapIndex* x, const MapEntry* e);
+
+#endif
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "stamp.h"
+
+void stampInit(Stamp* s)
+{
+    SDL_memset(s, 0, sizeof(Stamp));
+
+    s->parity       = -1;
+    s->previewSheet = -1;
+}
+
+void stampFree(Stamp* s)
+{
+    free(s->pieces);
+    free(s->tiles);
+    free(s->mask);
+
+    if (s->preview != NULL)
+        SDL_DestroyTexture(s->preview);
+
+    // whoever is told about changes stays
+    s->pieces       = NULL;
+    s->tiles        = NULL;
+    s->mask         = NULL;
+    s->preview      = NULL;
+    s->w            = 0;
+    s->h            = 0;
+    s->parity       = -1;
+    s->previewSheet = -1;
+}
+
+// room for w x h pieces at either parity, the old stamp is dropped
+static bool resize(Stamp* s, int w, int h)
+{
+    stampFree(s);
+
+    if (w < 1 || h < 1 || w > STAMP_SIDE || h > STAMP_SIDE)
+        return false;
+
+    size_t tiles = (size_t)((w >> 1) + 1) * ((h >> 1) + 1) << 2;
+
+    s->pieces = malloc((size_t)w * h);
+    s->tiles  = malloc(tiles);
+    s->mask   = malloc(tiles);
+
+    if (s->pieces == NULL || s->tiles == NULL || s->mask == NULL)
+    {
+        stampFree(s);
+        return false;
+    }
+
+    s->w = w;
+    s->h = h;
+
+    return true;
+}
+
+bool stampFromMap(Stamp* s, Map* m, int px, int py, int w, int h)
+{
+    if (!resize(s, w, h))
+        return false;
+
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            short id = mapGetPiece(m, px + x, py + y);
+
+            s->pieces[y * w + x] = id >= EMPTY_PIECE ? STAMP_CLEAR : id;
+        }
+    }
+
+    return true;
+}
+
+bool stampFromPieces(Stamp* s, const unsigned char ids[], int w, int h)
+{
+    if (!resize(s, w, h))
+        return false;
+
+    memcpy(s->pieces, ids, (size_t)w * h);
+
+    return true;
+}
+
+// the pieces as map tiles with the top left piece at the given parity, the
+// cells around the edge the stamp doesn't reach are masked off
+static void layOut(Stamp* s, int parity)
+{
+    if (s->parity == parity)
+        return;
+
+    int ox = parity & 1, oy = parity >> 1;
+
+    s->tilesW = (s->w + ox + 1) >> 1;
+    s->tilesH = (s->h + oy + 1) >> 1;
+    s->parity = parity;
+
+    for (int ty = 0; ty < s->tilesH; ty++)
+    {
+        for (int tx = 0; tx < s->tilesW; tx++)
+        {
+            int i = (ty * s->tilesW + tx) << 2;
+
+            for (int k = 0; k < 4; k++)
+            {
+                int x = (tx << 1) + (k & 1) - ox, y = (ty << 1) + (k >> 1) - oy;
+                int id = x >= 0 && y >= 0 && x < s->w && y < s->h ?
+                             s->pieces[y * s->w + x] :
+                             STAMP_CLEAR;
+
+                s->tiles[i + k] = id == STAMP_CLEAR ? 0 : id;
+                s->mask[i + k]  = id == STAMP_CLEAR ? 0 : 0xff;
+            }
+        }
+    }
+}
+
+// whether n bytes would put anything into a chunk that isn't there yet
+static bool paints(const unsigned char* src, const unsigned char* mask, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (mask[i] != 0 && src[i] != EMPTY_PIECE)
+            return true;
+
+    return false;
+}
+
+// n bytes of one chunk row, n a multiple of 4 and at most a row, with
+// their first tile holding pieces (px, py) to (px + 1, py + 1); bytes are
+// taken from src where mask is set, 16 at a time, and what changed is
+// reported a piece row at a time so undo sees runs
+static void blend(Stamp* s, unsigned char* dst, const unsigned char* src,
+                  const unsigned char* mask, int n, int px, int py)
+{
+    unsigned char old[CHUNK_TILES << 2];
+    uint64_t      diff[2] = { 0, 0 };
+    int           i       = 0;
+
+    memcpy(old, dst, n);
+
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i k = _mm_loadu_si128((const __m128i*)(mask + i)),
+                v = _mm_loadu_si128((const __m128i*)(src + i)),
+                d = _mm_loadu_si128((const __m128i*)(dst + i));
+
+        diff[i >> 6] |=
+            (uint64_t)_mm_movemask_epi8(
+                _mm_andnot_si128(_mm_cmpeq_epi8(v, d), k))
+            << (i & 63);
+
+        _mm_storeu_si128(
+            (__m128i*)(dst + i),
+            _mm_or_si128(_mm_and_si128(k, v), _mm_andnot_si128(k, d)));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        if (mask[i] != 0 && src[i] != dst[i])
+            diff[i >> 6] |= (uint64_t)1 << (i & 63);
+
+        dst[i] = (src[i] & mask[i]) | (dst[i] & ~mask[i]);
+    }
+
+    if (s->changed == NULL)
+        return;
+
+    // bytes 0 and 1 of each tile are the upper piece row, 2 and 3 the lower
+    for (int r = 0; r < 2; r++)
+    {
+        for (int w = 0; w < 2; w++)
+        {
+            uint64_t bits = diff[w] & (r == 0 ? 0x3333333333333333ULL :
+                                                0xccccccccccccccccULL);
+
+            for (; bits != 0; bits &= bits - 1)
+            {
+                int b = (w << 6) + __builtin_ctzll(bits);
+
+                s->changed(s->data,
+                           px + ((b >> 2) << 1) + (b & 1),
+                           py + r,
+                           old[b],
+                           dst[b]);
+            }
+        }
+    }
+}
+
+bool stampApply(Stamp* s, Map* m, int px, int py)
+{
+    if (s->w == 0)
+        return true;
+
+    layOut(s, (px & 1) | ((py & 1) << 1));
+
+    // the tile holding the top left piece, rounding down off the level too
+    int tx = px >> 1, ty = py >> 1;
+
+    int x0 = SDL_max(0, -tx), y0 = SDL_max(0, -ty),
+        x1 = SDL_min(s->tilesW, m->width - tx),
+        y1 = SDL_min(s->tilesH, m->height - ty);
+
+    for (int y = y0; y < y1; y++)
+    {
+        for (int x = x0, n; x < x1; x += n)
+        {
+            n = SDL_min(x1 - x, CHUNK_TILES - ((tx + x) & CHUNK_MASK));
+
+            size_t               i    = (size_t)(y * s->tilesW + x) << 2;
+            const unsigned char* src  = s->tiles + i;
+            const unsigned char* mask = s->mask + i;
+
+            unsigned char* to = mapWriteTiles(m, tx + x, ty + y, false);
+
+            // only made when something other than empty goes into it
+            if (to == NULL && paints(src, mask, n << 2) &&
+                (to = mapWriteTiles(m, tx + x, ty + y, true)) == NULL)
+                return false;
+
+            if (to != NULL)
+                blend(s, to, src, mask, n << 2, (tx + x) << 1, (ty + y) << 1);
+        }
+    }
+
+    return true;
+}
+
+// each piece copied out of its cell, see-through ones left clear
+static void drawPreview(Stamp* s, const Atlas* a, int sheet, Uint32* pixels,
+                        int pitch)
+{
+    const SDL_Surface* atlas = a->surface;
+
+    for (int py = 0; py < s->h; py++)
+    {
+        for (int px = 0; px < s->w; px++)
+        {
+            int     id  = s->pieces[py * s->w + px];
+            Uint32* dst = pixels + py * ATLAS_PIECE * pitch + px * ATLAS_PIECE;
+
+            if (id == STAMP_CLEAR)
+            {
+                for (int y = 0; y < ATLAS_PIECE; y++)
+                    memset(dst + y * pitch, 0, ATLAS_PIECE * 4);
+                continue;
+            }
+
+            if (id > EMPTY_PIECE)
+                id = EMPTY_PIECE;
+
+            const SDL_Rect* cell = &a->clips[sheet][id];
+
+            for (int y = 0; y < ATLAS_PIECE; y++)
+                memcpy(dst + y * pitch,
+                       (const unsigned char*)atlas->pixels +
+                           (cell->y + y) * atlas->pitch + cell->x * 4,
+                       ATLAS_PIECE * 4);
+        }
+    }
+}
+
+SDL_Texture* stampPreview(Stamp* s, SDL_Renderer* r, const Atlas* a,
+                          int sheet)
+{
+    if (s->w == 0 || a->surface == NULL)
+        return NULL;
+
+    if (s->previewSheet == sheet)
+        return s->preview;
+
+    if (s->preview != NULL)
+        SDL_DestroyTexture(s->preview);
+
+    int     w = s->w * ATLAS_PIECE, h = s->h * ATLAS_PIECE;
+    Uint32* pixels = malloc((size_t)w * h * 4);
+
+    s->previewSheet = sheet;
+    s->preview      = pixels != NULL ? SDL_CreateTexture(r,
+                                                    SDL_PIXELFORMAT_RGBA32,
+                                                    SDL_TEXTUREACCESS_STATIC,
+                                                    w,
+                                                    h) :
+                                       NULL;
+
+    if (s->preview != NULL)
+    {
+        drawPreview(s, a, sheet, pixels, w);
+
+        SDL_UpdateTexture(s->preview, NULL, pixels, w * 4);
+        SDL_SetTextureBlendMode(s->preview, SDL_BLENDMODE_BLEND);
+    }
+
+    free(pixels);
+
+    return s->preview;
+}
@@ -0,0 +1,53 @@
+#ifndef STAMP_H
+#define STAMP_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "atlas.h"
+
+// stamps are at most STAMP_SIDE pieces a side, which keeps the preview
+// within 2048 pixels; STAMP_CLEAR cells are see-through, the level keeps
+// whatever it has under them
+#define STAMP_SIDE  128
+#define STAMP_CLEAR 0xff
+
+// a small rectangle of pieces a shortcut holds instead of a single one. It
+// is kept a second time laid out the way the map stores tiles, for the
+// piece parity it last went down at, next to a byte mask of the cells it
+// covers, so stamping is a masked blend along each chunk row
+typedef struct Stamp
+{
+    int            w, h;   // in pieces, 0 while empty
+    unsigned char* pieces; // w * h in row order
+
+    unsigned char *tiles, *mask; // tilesW * tilesH tiles each
+    int            tilesW, tilesH;
+    int            parity; // bit 0 odd x, bit 1 odd y, -1 before laid out
+
+    // every piece a stamp changed, after it was written
+    void (*changed)(void* data, int px, int py, short old, short id);
+    void* data;
+
+    SDL_Texture* preview;      // ATLAS_PIECE pixels per piece
+    int          previewSheet; // -1 once it needs redrawing
+} Stamp;
+
+void stampInit(Stamp* s);
+void stampFree(Stamp* s);
+
+// w x h pieces of m from (px, py), its empty pieces see-through
+bool stampFromMap(Stamp* s, Map* m, int px, int py, int w, int h);
+
+// w x h piece ids in row order, all of them drawn
+bool stampFromPieces(Stamp* s, const unsigned char ids[], int w, int h);
+
+// s over m with its top left at piece (px, py), cut to the level; false
+// when a chunk couldn't be made
+bool stampApply(Stamp* s, Map* m, int px, int py);
+
+// the stamp in sheet's pieces, see-through cells left clear; NULL while
+// it's empty
+SDL_Texture* stampPreview(Stamp* s, SDL_Renderer* r, const Atlas* a,
+                          int sheet);
+
+#endif
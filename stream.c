@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream.h"
+
+static int streamThread(void* data)
+{
+    Stream* s = data;
+
+    bool failed = false; // a write since the last sync didn't make it
+
+    SDL_LockMutex(s->lock);
+
+    while (true)
+    {
+        while (s->todo == NULL && !s->quit)
+            SDL_CondWait(s->wake, s->lock);
+
+        // queued writes are still finished when closing
+        if (s->todo == NULL)
+            break;
+
+        StreamJob* j = s->todo;
+
+        s->todo = j->next;
+        if (s->todo == NULL)
+            s->todoTail = NULL;
+
+        SDL_UnlockMutex(s->lock);
+
+        switch (j->type)
+        {
+        case STREAM_READ:
+            j->success = mapFileReadChunk(&s->file, j->cx, j->cy, j->pieces);
+            break;
+        case STREAM_WRITE:
+            j->success = mapFileWriteChunk(&s->file, j->cx, j->cy, j->pieces);
+            failed |= !j->success;
+            break;
+        case STREAM_SYNC:
+            j->success = fflush(s->file.fp) == 0 && !failed;
+            failed     = false;
+
+            // a failed compaction leaves the file and handle as they were
+            if (j->success && mapFileWasteful(&s->file) &&
+                !mapFileCompact(&s->file, s->path))
+                printf("Failed to compact %s!\n", s->path);
+            break;
+        }
+
+        j->next = NULL;
+
+        SDL_LockMutex(s->lock);
+
+        if (j->type == STREAM_SYNC)
+        {
+            s->syncsDone++;
+            s->syncFailed = !j->success;
+            SDL_CondBroadcast(s->synced);
+        }
+
+        if (s->doneTail != NULL)
+            s->doneTail->next = j;
+        else
+            s->done = j;
+        s->doneTail = j;
+    }
+
+    SDL_UnlockMutex(s->lock);
+
+    return 0;
+}
+
+static void freeJobs(StreamJob* j)
+{
+    while (j != NULL)
+    {
+        StreamJob* next = j->next;
+        free(j);
+        j = next;
+    }
+}
+
+// jobs are built up on the main thread and handed over in one go
+static void queueJobs(Stream* s, StreamJob* head, StreamJob* tail)
+{
+    if (head == NULL)
+        return;
+
+    for (StreamJob* j = head; j != NULL; j = j->next)
+        s->pending++;
+
+    SDL_LockMutex(s->lock);
+
+    if (s->todoTail != NULL)
+        s->todoTail->next = head;
+    else
+        s->todo = head;
+    s->todoTail = tail;
+
+    SDL_CondSignal(s->wake);
+    SDL_UnlockMutex(s->lock);
+}
+
+static StreamJob* newJob(enum STREAM_JOB type, int cx, int cy,
+                         StreamJob** head, StreamJob** tail)
+{
+    StreamJob* j = malloc(sizeof(StreamJob));
+
+    if (j == NULL)
+        return NULL;
+
+    j->type = type;
+    j->cx   = cx;
+    j->cy   = cy;
+    j->next = NULL;
+
+    if (*tail != NULL)
+        (*tail)->next = j;
+    else
+        *head = j;
+    *tail = j;
+
+    return j;
+}
+
+void streamInit(Stream* s, size_t budget)
+{
+    memset(s, 0, sizeof(Stream));
+
+    s->budget = budget;
+}
+
+bool streamActive(const Stream* s)
+{
+    return s->thread != NULL;
+}
+
+bool streamBusy(const Stream* s)
+{
+    return s->pending > 0;
+}
+
+void streamClose(Stream* s)
+{
+    if (s->thread != NULL)
+    {
+        SDL_LockMutex(s->lock);
+        s->quit = true;
+        SDL_CondSignal(s->wake);
+        SDL_UnlockMutex(s->lock);
+
+        SDL_WaitThread(s->thread, NULL);
+    }
+
+    if (s->synced != NULL)
+        SDL_DestroyCond(s->synced);
+    if (s->wake != NULL)
+        SDL_DestroyCond(s->wake);
+    if (s->lock != NULL)
+        SDL_DestroyMutex(s->lock);
+
+    freeJobs(s->todo);
+    freeJobs(s->done);
+    mapFileClose(&s->file);
+
+    free(s->state);
+    free(s->seen);
+
+    streamInit(s, s->budget);
+}
+
+bool streamOpen(Stream* s, Map* m, const char* path)
+{
+    streamClose(s);
+
+    if (!mapFileOpenWritable(&s->file, path))
+        return false;
+
+    s->path[0] = '\0';
+    strncat(s->path, path, sizeof(s->path) - 1);
+
+    s->chunksX = s->file.header.chunksX;
+    s->chunksY = s->file.header.chunksY;
+
+    size_t count = (size_t)s->chunksX * s->chunksY;
+
+    s->state  = calloc(count, sizeof(unsigned char));
+    s->seen   = calloc(count, sizeof(unsigned int));
+    s->lock   = SDL_CreateMutex();
+    s->wake   = SDL_CreateCond();
+    s->synced = SDL_CreateCond();
+
+    if (s->state != NULL && s->seen != NULL && s->lock != NULL &&
+        s->wake != NULL && s->synced != NULL)
+    {
+        // blank chunks on disk have nothing to wait for; the table belongs
+        // to the stream thread from here on
+        for (size_t i = 0; i < count; i++)
+            s->state[i] = s->file.table[i].coding == CHUNK_EMPTY ?
+                              STREAM_HOT :
+                              STREAM_COLD;
+
+        s->thread = SDL_CreateThread(streamThread, "stream", s);
+    }
+
+    if (s->thread == NULL)
+    {
+        streamClose(s);
+        return false;
+    }
+
+    mapClear(m);
+
+    m->width   = s->file.header.width;
+    m->height  = s->file.header.height;
+    m->sheetId = s->file.header.sheetId;
+
+    s->lastX = s->lastY = -1;
+
+    return true;
+}
+
+bool streamReady(const Stream* s, int cx, int cy)
+{
+    if (s->thread == NULL)
+        return true;
+
+    if (cx < 0 || cy < 0 || cx >= s->chunksX || cy >= s->chunksY)
+        return false;
+
+    return s->state[(size_t)cy * s->chunksX + cx] == STREAM_HOT;
+}
+
+typedef struct StreamVictim
+{
+    unsigned int seen;
+    MapChunk*    chunk;
+} StreamVictim;
+
+static int compareSeen(const void* a, const void* b)
+{
+    unsigned int x = ((const StreamVictim*)a)->seen,
+                 y = ((const StreamVictim*)b)->seen;
+
+    return (x > y) - (x < y);
+}
+
+// oldest first down to three quarters of the budget, so this doesn't run
+// again on the very next chunk that comes in
+static void streamEvict(Stream* s, Map* m, StreamJob** head,
+                        StreamJob** tail)
+{
+    size_t limit = s->budget / sizeof(MapChunk);
+
+    if (m->count <= limit)
+        return;
+
+    StreamVictim* old = malloc(m->count * sizeof(StreamVictim));
+    size_t        n   = 0;
+
+    if (old == NULL)
+        return;
+
+    // anything not in view this frame can go
+    for (size_t i = 0; i < m->capacity; i++)
+    {
+        MapChunk* c = m->slots[i];
+
+        if (c == NULL)
+            continue;
+
+        unsigned int seen = s->seen[(size_t)c->cy * s->chunksX + c->cx];
+
+        if (seen != s->frame)
+            old[n++] = (StreamVictim){ seen, c };
+    }
+
+    qsort(old, n, sizeof(StreamVictim), compareSeen);
+
+    for (size_t i = 0; i < n && m->count > limit - (limit >> 2); i++)
+    {
+        MapChunk* c  = old[i].chunk;
+        int       cx = c->cx, cy = c->cy;
+
+        // edits leave with the chunk, a later read queues up behind them
+        if (c->dirty)
+        {
+            StreamJob* j = newJob(STREAM_WRITE, cx, cy, head, tail);
+
+            if (j == NULL)
+                break;
+
+            memcpy(j->pieces, c->pieces, CHUNK_BYTES);
+        }
+
+        mapDropChunk(m, cx, cy);
+        s->state[(size_t)cy * s->chunksX + cx] = STREAM_COLD;
+    }
+
+    free(old);
+}
+
+void streamUpdate(Stream* s, Map* m, SDL_Rect camera, float scale, int viewX,
+                  int viewY)
+{
+    if (s->thread == NULL)
+        return;
+
+    s->frame++;
+
+    SDL_LockMutex(s->lock);
+
+    StreamJob* done = s->done;
+    s->done = s->doneTail = NULL;
+
+    SDL_UnlockMutex(s->lock);
+
+    while (done != NULL)
+    {
+        StreamJob* j = done;
+        done         = j->next;
+
+        s->pending--;
+
+        size_t i = (size_t)j->cy * s->chunksX + j->cx;
+
+        switch (j->type)
+        {
+        case STREAM_READ:
+            if (!j->success)
+            {
+                // left cold, the next frame asks for it again
+                printf("Failed to read chunk %d,%d!\n", j->cx, j->cy);
+                s->state[i] = STREAM_COLD;
+                break;
+            }
+
+            unsigned char* pieces = mapChunkData(m, j->cx, j->cy, true);
+
+            if (pieces == NULL)
+            {
+                s->state[i] = STREAM_COLD;
+                break;
+            }
+
+            memcpy(pieces, j->pieces, CHUNK_BYTES);
+            s->state[i] = STREAM_HOT;
+            break;
+        case STREAM_WRITE:
+            if (!j->success)
+                printf("Failed to write chunk %d,%d!\n", j->cx, j->cy);
+            break;
+        case STREAM_SYNC:
+            s->saved = j->success ? 1 : -1;
+            break;
+        }
+
+        free(j);
+    }
+
+    // chunks in view plus a margin, stretched ahead in the pan direction
+    int x0 = (int)(camera.x / scale) >> CHUNK_SHIFT,
+        y0 = (int)(camera.y / scale) >> CHUNK_SHIFT,
+        x1 = (int)((camera.x + camera.w) / scale) >> CHUNK_SHIFT,
+        y1 = (int)((camera.y + camera.h) / scale) >> CHUNK_SHIFT;
+
+    x0 -= STREAM_MARGIN;
+    y0 -= STREAM_MARGIN;
+    x1 += STREAM_MARGIN;
+    y1 += STREAM_MARGIN;
+
+    if (s->lastX >= 0)
+    {
+        if (viewX > s->lastX)
+            x1 += STREAM_PREFETCH;
+        else if (viewX < s->lastX)
+            x0 -= STREAM_PREFETCH;
+
+        if (viewY > s->lastY)
+            y1 += STREAM_PREFETCH;
+        else if (viewY < s->lastY)
+            y0 -= STREAM_PREFETCH;
+    }
+
+    s->lastX = viewX;
+    s->lastY = viewY;
+
+    x0 = SDL_max(x0, 0);
+    y0 = SDL_max(y0, 0);
+    x1 = SDL_min(x1, s->chunksX - 1);
+    y1 = SDL_min(y1, s->chunksY - 1);
+
+    StreamJob *head = NULL, *tail = NULL;
+
+    for (int cy = y0; cy <= y1; cy++)
+    {
+        for (int cx = x0; cx <= x1; cx++)
+        {
+            size_t i = (size_t)cy * s->chunksX + cx;
+
+            s->seen[i] = s->frame;
+
+            if (s->state[i] != STREAM_COLD)
+                continue;
+
+            if (newJob(STREAM_READ, cx, cy, &head, &tail) != NULL)
+                s->state[i] = STREAM_LOADING;
+        }
+    }
+
+    streamEvict(s, m, &head, &tail);
+
+    queueJobs(s, head, tail);
+}
+
+void streamFlush(Stream* s, Map* m)
+{
+    if (s->thread == NULL)
+        return;
+
+    StreamJob *head = NULL, *tail = NULL;
+
+    for (size_t i = 0; i < m->dirtyCount; i++)
+    {
+        MapChunk*  c = m->dirty[i];
+        StreamJob* j = newJob(STREAM_WRITE, c->cx, c->cy, &head, &tail);
+
+        if (j == NULL)
+        {
+            freeJobs(head);
+            s->saved = -1;
+            return;
+        }
+
+        memcpy(j->pieces, c->pieces, CHUNK_BYTES);
+    }
+
+    if (newJob(STREAM_SYNC, 0, 0, &head, &tail) == NULL)
+    {
+        freeJobs(head);
+        s->saved = -1;
+        return;
+    }
+
+    mapClearDirty(m);
+
+    queueJobs(s, head, tail);
+
+    s->syncs++;
+}
+
+bool streamSync(Stream* s, Map* m)
+{
+    if (s->thread == NULL)
+        return true;
+
+    int target = s->syncs + 1;
+
+    streamFlush(s, m);
+
+    // nothing was queued, there's nothing to wait for
+    if (s->syncs != target)
+        return false;
+
+    SDL_LockMutex(s->lock);
+
+    while (s->syncsDone < target)
+        SDL_CondWait(s->synced, s->lock);
+
+    bool failed = s->syncFailed;
+
+    SDL_UnlockMutex(s->lock);
+
+    return !failed;
+}
+
+int streamPoll(Stream* s)
+{
+    int saved = s->saved;
+
+    s->saved = 0;
+
+    return saved;
+}
@@ -0,0 +1,90 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "mapfile.h"
+
+// chunks kept around the view, and how far ahead of a pan they are fetched
+#define STREAM_MARGIN   1
+#define STREAM_PREFETCH 4
+
+#define STREAM_BUDGET (256 << 20)
+
+enum STREAM_JOB { STREAM_READ, STREAM_WRITE, STREAM_SYNC };
+
+// what the main thread knows about a chunk of the file
+enum STREAM_STATE { STREAM_COLD, STREAM_LOADING, STREAM_HOT };
+
+// one unit of work for the i/o thread, it comes back on the done list
+typedef struct StreamJob
+{
+    enum STREAM_JOB   type;
+    int               cx, cy;
+    bool              success;
+    unsigned char     pieces[CHUNK_BYTES];
+    struct StreamJob* next;
+} StreamJob;
+
+// levels too big for memory stay in their container file and only the
+// chunks around the camera are resident; the rest is evicted least recently
+// seen first once the map goes over budget, dirty ones are written back.
+// all file access happens on the stream thread, which also compacts the
+// file after a sync once replaced chunks are half of it
+typedef struct Stream
+{
+    MapFile file;
+    char    path[256]; // the level, it's compacted in place of itself
+
+    SDL_Thread* thread;
+    SDL_mutex*  lock;
+    SDL_cond*   wake;
+    SDL_cond*   synced; // a sync job has run
+
+    // under lock
+    StreamJob *todo, *todoTail, *done, *doneTail;
+    bool       quit;
+    int        syncsDone;
+    bool       syncFailed; // how the last of them went
+
+    // main thread only, one entry per chunk of the level
+    unsigned char* state;
+    unsigned int*  seen; // frame the chunk was last in view
+    int            chunksX, chunksY;
+
+    size_t       budget; // bytes of resident chunks
+    unsigned int frame;
+    int          lastX, lastY; // view position a frame ago, for prefetch
+    int          saved;        // 1 or -1 once a flush is on disk
+    int          pending;      // jobs handed over that haven't come back
+    int          syncs;        // sync jobs handed over
+} Stream;
+
+void streamInit(Stream* s, size_t budget);
+void streamClose(Stream* s);
+bool streamActive(const Stream* s);
+
+// chunks or writes are still on their way, the view may change without input
+bool streamBusy(const Stream* s);
+
+// clears m and attaches it to a container file, nothing is read yet
+bool streamOpen(Stream* s, Map* m, const char* path);
+
+// takes in chunks read since the last frame, requests the ones the camera
+// is about to need and evicts what is over budget; camera is in pixels,
+// scale the size of a tile on screen
+void streamUpdate(Stream* s, Map* m, SDL_Rect camera, float scale, int viewX,
+                  int viewY);
+
+// true once the chunk is in memory or known to be empty on disk
+bool streamReady(const Stream* s, int cx, int cy);
+
+// queues every dirty chunk for writing, streamPoll reports when it's done
+void streamFlush(Stream* s, Map* m);
+int  streamPoll(Stream* s);
+
+// streamFlush, then blocks until the file holds everything written so far,
+// for readers that open it themselves; false if that didn't make it
+bool streamSync(Stream* s, Map* m);
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <SDL2/SDL_image.h>
+#include "thumbs.h"
+#include "mapfile.h"
+
+static void cachePath(Thumbs* t, uint64_t hash, char path[], size_t size)
+{
+    snprintf(path,
+             size,
+             "%s/%s/%016llx.png",
+             t->dir,
+             THUMB_DIR,
+             (unsigned long long)(hash ^ t->atlas->hash));
+}
+
+// one pixel per sample point; where a pixel covers several pieces it takes
+// the piece's average colour, where it's inside one the sheet is sampled
+static SDL_Surface* composite(Thumbs* t, ThumbJob* j)
+{
+    MapReader reader;
+
+    if (!mapReaderOpen(&reader, j->path, j->width))
+        return NULL;
+
+    int   pw = reader.width << 1, ph = reader.height << 1;
+    float s  = (float)SDL_max(pw, ph) / THUMB_SIZE;
+    int   tw = SDL_max((int)(pw / s), 1), th = SDL_max((int)(ph / s), 1);
+
+    SDL_Surface* out =
+        SDL_CreateRGBSurfaceWithFormat(0, tw, th, 32, SDL_PIXELFORMAT_RGBA32);
+
+    if (out == NULL)
+    {
+        mapReaderClose(&reader);
+        return NULL;
+    }
+
+    memset(out->pixels, 0, (size_t)out->pitch * th);
+
+    // the pieces and colours of the level's own sheet
+    int             sheet = atlasSheet(t->atlas, reader.sheetId);
+    const SDL_Rect* clips = t->atlas->clips[sheet];
+    SDL_Surface*    atlas = t->atlas->surface;
+    unsigned char   pieces[CHUNK_BYTES];
+    int             cx, cy;
+
+    while (mapReaderNext(&reader, &cx, &cy, pieces))
+    {
+        // pieces covered by this chunk, then the pixels sampling them
+        int p0x = cx << (CHUNK_SHIFT + 1), p0y = cy << (CHUNK_SHIFT + 1),
+            p1x = p0x + (CHUNK_TILES << 1), p1y = p0y + (CHUNK_TILES << 1);
+
+        int u0 = SDL_max((int)(p0x / s - 0.5f), 0),
+            v0 = SDL_max((int)(p0y / s - 0.5f), 0),
+            u1 = SDL_min((int)(p1x / s + 0.5f), tw - 1),
+            v1 = SDL_min((int)(p1y / s + 0.5f), th - 1);
+
+        for (int v = v0; v <= v1; v++)
+        {
+            float fy = (v + 0.5f) * s;
+            int   py = (int)fy;
+
+            if (py < p0y || py >= p1y || py >= ph)
+                continue;
+
+            unsigned char* row = (unsigned char*)out->pixels + v * out->pitch;
+
+            for (int u = u0; u <= u1; u++)
+            {
+                float fx = (u + 0.5f) * s;
+                int   px = (int)fx;
+
+                if (px < p0x || px >= p1x || px >= pw)
+                    continue;
+
+                int lx = px - p0x, ly = py - p0y;
+                int id = pieces[(((ly >> 1) << CHUNK_SHIFT) + (lx >> 1)) * 4 +
+                                ((ly & 1) << 1) + (lx & 1)];
+
+                if (id >= EMPTY_PIECE)
+                    continue;
+
+                const unsigned char* c = t->atlas->average[sheet][id];
+
+                if (s < 1.0f)
+                {
+                    int sx = clips[id].x + (int)((fx - px) * clips[id].w),
+                        sy = clips[id].y + (int)((fy - py) * clips[id].h);
+
+                    c = (unsigned char*)atlas->pixels + sy * atlas->pitch +
+                        sx * 4;
+                }
+
+                memcpy(row + u * 4, c, 4);
+            }
+        }
+    }
+
+    bool failed = reader.failed;
+
+    mapReaderClose(&reader);
+
+    if (failed)
+    {
+        SDL_FreeSurface(out);
+        return NULL;
+    }
+
+    return out;
+}
+
+static int thumbsThread(void* data)
+{
+    Thumbs* t = data;
+
+    SDL_LockMutex(t->lock);
+
+    while (true)
+    {
+        while (t->todo == NULL && !t->quit)
+            SDL_CondWait(t->wake, t->lock);
+
+        if (t->quit)
+            break;
+
+        ThumbJob* j = t->todo;
+        t->todo     = j->next;
+
+        SDL_UnlockMutex(t->lock);
+
+        if (j->type == THUMB_HASH)
+        {
+            // an unreadable file still resolves, it's read again once it
+            // changes
+            mapIndexRead(t->dir, &j->entry);
+        }
+        else
+        {
+            char cache[512];
+            cachePath(t, j->hash, cache, sizeof(cache));
+
+            j->surface = composite(t, j);
+
+            if (j->surface != NULL && IMG_SavePNG(j->surface, cache) != 0)
+                printf("Failed to cache thumbnail %s!\n", cache);
+        }
+
+        SDL_LockMutex(t->lock);
+
+        j->next = t->done;
+        t->done = j;
+    }
+
+    SDL_UnlockMutex(t->lock);
+
+    return 0;
+}
+
+bool thumbsInit(Thumbs* t, const Atlas* atlas, const char* dir,
+                int rawWidth)
+{
+    memset(t, 0, sizeof(Thumbs));
+
+    t->atlas = atlas;
+
+    t->dir[0] = '\0';
+    strncat(t->dir, dir, sizeof(t->dir) - 1);
+    t->rawWidth = rawWidth;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, THUMB_DIR);
+
+    if (access(path, F_OK) != 0)
+        mkdir(path, 0700);
+
+    // nothing to draw previews from
+    if (atlas->surface == NULL)
+        return false;
+
+    t->lock = SDL_CreateMutex();
+    t->wake = SDL_CreateCond();
+
+    if (t->lock == NULL || t->wake == NULL)
+        return false;
+
+    int count = SDL_min(SDL_max(SDL_GetCPUCount() - 1, 1), THUMB_WORKERS);
+
+    for (int i = 0; i < count; i++)
+    {
+        t->workers[t->workerCount] =
+            SDL_CreateThread(thumbsThread, "thumbs", t);
+
+        if (t->workers[t->workerCount] != NULL)
+            t->workerCount++;
+    }
+
+    return t->workerCount > 0;
+}
+
+static void freeJobs(ThumbJob* j)
+{
+    while (j != NULL)
+    {
+        ThumbJob* next = j->next;
+
+        if (j->surface != NULL)
+            SDL_FreeSurface(j->surface);
+        free(j);
+
+        j = next;
+    }
+}
+
+void thumbsFree(Thumbs* t)
+{
+    // half made previews are dropped, the next run makes them again
+    if (t->lock != NULL)
+    {
+        SDL_LockMutex(t->lock);
+        t->quit = true;
+        SDL_CondBroadcast(t->wake);
+        SDL_UnlockMutex(t->lock);
+    }
+
+    for (int i = 0; i < t->workerCount; i++)
+        SDL_WaitThread(t->workers[i], NULL);
+
+    freeJobs(t->todo);
+    freeJobs(t->done);
+
+    for (int i = 0; i < THUMB_SLOTS; i++)
+        if (t->slots[i].texture != NULL)
+            SDL_DestroyTexture(t->slots[i].texture);
+
+    if (t->wake != NULL)
+        SDL_DestroyCond(t->wake);
+    if (t->lock != NULL)
+        SDL_DestroyMutex(t->lock);
+
+    memset(t, 0, sizeof(Thumbs));
+}
+
+// the slot holding hash; with claim a missing one takes over an empty slot
+// of its set or the one asked for longest ago, NULL when every slot there
+// is waiting on a worker or on screen this frame, so rows sharing a set
+// don't take turns evicting each other
+static ThumbSlot* findSlot(Thumbs* t, uint64_t hash, bool claim)
+{
+    int        sets   = THUMB_SLOTS / THUMB_WAYS;
+    ThumbSlot* set    = &t->slots[hash % sets * THUMB_WAYS];
+    ThumbSlot* victim = NULL;
+
+    for (int i = 0; i < THUMB_WAYS; i++)
+    {
+        ThumbSlot* s = &set[i];
+
+        if (s->used && s->hash == hash)
+        {
+            s->seen = ++t->lookups;
+            return s;
+        }
+
+        if (s->pending || (s->used && s->seen > t->frameStart))
+            continue;
+
+        if (victim == NULL ||
+            (victim->used && (!s->used || s->seen < victim->seen)))
+            victim = s;
+    }
+
+    if (!claim || victim == NULL)
+        return NULL;
+
+    // a different level had the slot, it'll be read back from disk if needed
+    if (victim->texture != NULL)
+        SDL_DestroyTexture(victim->texture);
+
+    victim->hash    = hash;
+    victim->texture = NULL;
+    victim->seen    = ++t->lookups;
+    victim->used    = true;
+    victim->pending = false;
+    victim->failed  = false;
+
+    return victim;
+}
+
+// newest first, it's what is on screen
+static void queueJob(Thumbs* t, ThumbJob* j)
+{
+    t->queued++;
+
+    SDL_LockMutex(t->lock);
+    j->next = t->todo;
+    t->todo = j;
+    SDL_CondSignal(t->wake);
+    SDL_UnlockMutex(t->lock);
+}
+
+SDL_Texture* thumbsGet(Thumbs* t, SDL_Renderer* r, const MapEntry* e)
+{
+    if (t->workerCount == 0 || e->pending)
+        return NULL;
+
+    ThumbSlot* s = findSlot(t, e->hash, true);
+
+    // the set is full of levels being made or drawn, asked again next frame
+    if (s == NULL)
+        return NULL;
+
+    if (s->texture != NULL || s->pending || s->failed)
+        return s->texture;
+
+    // a cached preview is a small png, cheap enough to read in the frame
+    char cache[512];
+    cachePath(t, e->hash, cache, sizeof(cache));
+
+    SDL_Surface* surface = IMG_Load(cache);
+
+    if (surface != NULL)
+    {
+        s->texture = SDL_CreateTextureFromSurface(r, surface);
+        SDL_FreeSurface(surface);
+
+        return s->texture;
+    }
+
+    ThumbJob* j = malloc(sizeof(ThumbJob));
+
+    if (j == NULL)
+        return NULL;
+
+    snprintf(j->path, sizeof(j->path), "%s/%s", t->dir, e->name);
+
+    j->type    = THUMB_PREVIEW;
+    j->hash    = e->hash;
+    j->size    = e->size;
+    j->surface = NULL;
+
+    // raw files are as tall as their size says at the default width
+    j->width  = e->width > 0 ? e->width : t->rawWidth;
+    j->height = e->width > 0 ? e->height : mapRawHeight(e->size, t->rawWidth);
+
+    if (j->height <= 0)
+    {
+        free(j);
+        return NULL;
+    }
+
+    s->pending = true;
+
+    queueJob(t, j);
+
+    return NULL;
+}
+
+// entries the index listed without a hash, each handed over once
+static void queueHashes(Thumbs* t, MapIndex* x)
+{
+    if (!x->unread)
+        return;
+
+    x->unread = false;
+
+    for (size_t i = 0; i < x->count; i++)
+    {
+        MapEntry* e = &x->entries[i];
+
+        if (!e->pending || e->queued)
+            continue;
+
+        ThumbJob* j = malloc(sizeof(ThumbJob));
+
+        // tried again next frame
+        if (j == NULL)
+        {
+            x->unread = true;
+            return;
+        }
+
+        j->type    = THUMB_HASH;
+        j->surface = NULL;
+        j->entry   = *e;
+        e->queued  = true;
+
+        queueJob(t, j);
+    }
+}
+
+void thumbsUpdate(Thumbs* t, SDL_Renderer* r, MapIndex* x)
+{
+    // without workers there are no previews, hashes are read here
+    if (t->workerCount == 0)
+    {
+        for (size_t i = 0; x->unread && i < x->count; i++)
+        {
+            MapEntry e = x->entries[i];
+
+            if (!e.pending)
+                continue;
+
+            mapIndexRead(x->dir, &e);
+            mapIndexResolve(x, &e);
+        }
+
+        x->unread = false;
+        return;
+    }
+
+    t->frameStart = t->lookups;
+
+    SDL_LockMutex(t->lock);
+
+    ThumbJob* done = t->done;
+    t->done        = NULL;
+
+    SDL_UnlockMutex(t->lock);
+
+    for (ThumbJob* j = done; j != NULL; j = j->next)
+    {
+        if (j->type == THUMB_HASH)
+        {
+            t->queued--;
+            mapIndexResolve(x, &j->entry);
+            continue;
+        }
+
+        // pending slots aren't given away, it's still there
+        ThumbSlot* s = findSlot(t, j->hash, false);
+
+        t->queued--;
+
+        if (s == NULL)
+            continue;
+
+        s->pending = false;
+        s->failed  = j->surface == NULL;
+
+        if (j->surface != NULL)
+            s->texture = SDL_CreateTextureFromSurface(r, j->surface);
+    }
+
+    freeJobs(done);
+
+    queueHashes(t, x);
+}
+
+bool thumbsBusy(const Thumbs* t)
+{
+    return t->queued > 0;
+}
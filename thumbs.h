@@ -0,0 +1,87 @@
+#ifndef THUMBS_H
+#define THUMBS_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "mapindex.h"
+#include "atlas.h"
+
+// previews are at most THUMB_SIZE square, kept as png under THUMB_DIR in
+// the maps directory and named after the level's content hash mixed with
+// the atlas's, so changed sheets don't bring back stale previews
+#define THUMB_SIZE    128
+#define THUMB_DIR     ".thumbs"
+#define THUMB_SLOTS   256
+#define THUMB_WAYS    8
+#define THUMB_WORKERS 4
+
+// workers also read the hash of levels the index has only just listed,
+// since previews are keyed by it
+enum THUMB_JOB { THUMB_PREVIEW, THUMB_HASH };
+
+typedef struct ThumbJob
+{
+    enum THUMB_JOB   type;
+    char             path[512];
+    uint64_t         hash, size;
+    int              width, height;
+    SDL_Surface*     surface; // the finished preview, NULL if it failed
+    MapEntry         entry;   // THUMB_HASH, filled in by mapIndexRead
+    struct ThumbJob* next;
+} ThumbJob;
+
+// one texture per hash, THUMB_WAYS slots to a set and the least recently
+// asked for one replaced; pending is set while a worker has the level and
+// keeps the slot, failed while it couldn't be read so it isn't retried
+typedef struct ThumbSlot
+{
+    uint64_t     hash;
+    SDL_Texture* texture;
+    unsigned int seen; // lookup it was last asked for in
+    bool         used, pending, failed;
+} ThumbSlot;
+
+// previews are composited from the atlas on a pool of worker threads, each
+// level from the sheet its header names; everything touching the renderer
+// stays on the main thread
+typedef struct Thumbs
+{
+    char dir[256];
+    int  rawWidth; // raw files don't say, they are read at this width
+
+    const Atlas* atlas; // only read, by every worker
+
+    SDL_Thread* workers[THUMB_WORKERS];
+    int         workerCount;
+    SDL_mutex*  lock;
+    SDL_cond*   wake;
+
+    // under lock, newest request first since that's what is on screen
+    ThumbJob *todo, *done;
+    bool      quit;
+
+    // main thread only, jobs not yet back through thumbsUpdate, lookups so
+    // far and how many there were when the frame started
+    int          queued;
+    unsigned int lookups, frameStart;
+
+    ThumbSlot slots[THUMB_SLOTS];
+} Thumbs;
+
+bool thumbsInit(Thumbs* t, const Atlas* atlas, const char* dir,
+                int rawWidth);
+void thumbsFree(Thumbs* t);
+
+// the preview for e once it exists, otherwise it's asked for and NULL
+// comes back until a later frame; cached previews are read right away and
+// entries still waiting on their hash get nothing
+SDL_Texture* thumbsGet(Thumbs* t, SDL_Renderer* r, const MapEntry* e);
+
+// uploads what the workers finished since the last frame and hands x the
+// hashes they read, then queues the entries still pending; once a frame
+void thumbsUpdate(Thumbs* t, SDL_Renderer* r, MapIndex* x);
+
+// previews are still being made, the list changes without input
+bool thumbsBusy(const Thumbs* t);
+
+#endif
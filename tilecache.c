@@ -0,0 +1,199 @@
+#include "tilecache.h"
+
+// target textures can be wiped by the renderer (lost device, resize on some
+// backends), the next draw rebakes everything
+static int watchReset(void* data, SDL_Event* e)
+{
+    TileCache* c = data;
+
+    if (e->type == SDL_RENDER_TARGETS_RESET ||
+        e->type == SDL_RENDER_DEVICE_RESET)
+        SDL_AtomicSet(&c->reset, 1);
+
+    return 0;
+}
+
+bool tileCacheInit(TileCache* c, SDL_Renderer* r, Batch* sheet,
+                   SDL_Rect clips[], int pieceSize)
+{
+    SDL_memset(c, 0, sizeof(TileCache));
+
+    c->renderer  = r;
+    c->sheet     = sheet;
+    c->clips     = clips;
+    c->pieceSize = pieceSize;
+
+    c->disabled = sheet->texture == NULL || !SDL_RenderTargetSupported(r);
+
+    if (!c->disabled)
+        SDL_AddEventWatch(watchReset, c);
+
+    return !c->disabled;
+}
+
+void tileCacheFree(TileCache* c)
+{
+    if (!c->disabled)
+        SDL_DelEventWatch(watchReset, c);
+
+    for (int i = 0; i < TILE_CACHE_SLOTS; i++)
+        if (c->slots[i].texture != NULL)
+            SDL_DestroyTexture(c->slots[i].texture);
+
+    SDL_memset(c->slots, 0, sizeof(c->slots));
+}
+
+void tileCacheClear(TileCache* c)
+{
+    for (int i = 0; i < TILE_CACHE_SLOTS; i++)
+    {
+        c->slots[i].baked = false;
+        c->slots[i].used  = 0;
+    }
+}
+
+void tileCacheInvalidate(TileCache* c, int px, int py)
+{
+    int cx = px >> (CHUNK_SHIFT + 1), cy = py >> (CHUNK_SHIFT + 1);
+
+    for (int i = 0; i < TILE_CACHE_SLOTS; i++)
+        if (c->slots[i].cx == cx && c->slots[i].cy == cy)
+            c->slots[i].baked = false;
+}
+
+void tileCacheFrame(TileCache* c)
+{
+    c->frame++;
+    c->bakes = 0;
+    c->draws = 0;
+}
+
+// the slot holding (cx, cy), otherwise the least recently drawn one is
+// handed over; textures are only created as slots are first needed
+static TileCacheSlot* findSlot(TileCache* c, int cx, int cy)
+{
+    TileCacheSlot* victim = &c->slots[0];
+
+    for (int i = 0; i < TILE_CACHE_SLOTS; i++)
+    {
+        TileCacheSlot* s = &c->slots[i];
+
+        if (s->texture != NULL && s->cx == cx && s->cy == cy)
+            return s;
+
+        if (victim->texture != NULL &&
+            (s->texture == NULL || s->used < victim->used))
+            victim = s;
+    }
+
+    if (victim->texture == NULL)
+    {
+        int side = (CHUNK_TILES << 1) * c->pieceSize;
+
+        victim->texture = SDL_CreateTexture(c->renderer,
+                                            SDL_PIXELFORMAT_ARGB8888,
+                                            SDL_TEXTUREACCESS_TARGET,
+                                            side,
+                                            side);
+
+        if (victim->texture == NULL)
+            return NULL;
+
+        SDL_SetTextureBlendMode(victim->texture, SDL_BLENDMODE_BLEND);
+    }
+
+    victim->cx    = cx;
+    victim->cy    = cy;
+    victim->baked = false;
+
+    return victim;
+}
+
+// pieces never overlap, so they are copied straight in without blending
+// and transparent ones stay transparent in the target
+static bool bake(TileCache* c, Map* m, TileCacheSlot* s)
+{
+    unsigned char pieces[CHUNK_BYTES];
+    uint32_t      rows[CHUNK_TILES];
+
+    if (!mapCopyChunk(m, s->cx, s->cy, pieces) ||
+        !mapChunkRows(m, s->cx, s->cy, rows))
+        return false;
+
+    // anything already queued belongs on the screen, not in this chunk
+    batchFlush(c->sheet);
+
+    // switching targets drops the clip rect, the frame may be drawn clipped
+    SDL_Texture*  target = SDL_GetRenderTarget(c->renderer);
+    SDL_bool      clipped = SDL_RenderIsClipEnabled(c->renderer);
+    SDL_Rect      clip;
+    SDL_BlendMode blend;
+    Uint8         r, g, b, a;
+
+    SDL_RenderGetClipRect(c->renderer, &clip);
+
+    if (SDL_SetRenderTarget(c->renderer, s->texture) < 0)
+        return false;
+
+    SDL_GetRenderDrawColor(c->renderer, &r, &g, &b, &a);
+    SDL_GetTextureBlendMode(c->sheet->texture, &blend);
+
+    SDL_SetRenderDrawColor(c->renderer, 0x00, 0x00, 0x00, 0x00);
+    SDL_RenderClear(c->renderer);
+    SDL_SetTextureBlendMode(c->sheet->texture, SDL_BLENDMODE_NONE);
+
+    for (int ty = 0; ty < CHUNK_TILES; ty++)
+    {
+        // painted tiles of the row, lowest column first
+        for (uint32_t bits = rows[ty]; bits != 0; bits &= bits - 1)
+        {
+            int            tx = __builtin_ctz(bits);
+            unsigned char* t  = pieces + (((ty << CHUNK_SHIFT) + tx) << 2);
+
+            for (int k = 0; k < 4; k++)
+            {
+                SDL_Rect dst = { ((tx << 1) + (k & 1)) * c->pieceSize,
+                                 ((ty << 1) + (k >> 1)) * c->pieceSize,
+                                 c->pieceSize,
+                                 c->pieceSize };
+
+                batchAdd(c->sheet, &c->clips[t[k]], &dst);
+            }
+        }
+    }
+
+    batchFlush(c->sheet);
+
+    SDL_SetTextureBlendMode(c->sheet->texture, blend);
+    SDL_SetRenderDrawColor(c->renderer, r, g, b, a);
+    SDL_SetRenderTarget(c->renderer, target);
+    SDL_RenderSetClipRect(c->renderer, clipped ? &clip : NULL);
+
+    c->bakes++;
+    c->totalBakes++;
+
+    return true;
+}
+
+bool tileCacheDraw(TileCache* c, Map* m, int cx, int cy, const SDL_Rect* dst)
+{
+    if (c->disabled)
+        return false;
+
+    if (SDL_AtomicSet(&c->reset, 0))
+        tileCacheClear(c);
+
+    TileCacheSlot* s = findSlot(c, cx, cy);
+
+    if (s == NULL || (!s->baked && !(s->baked = bake(c, m, s))))
+        return false;
+
+    s->used = c->frame;
+
+    SDL_RenderCopy(c->renderer, s->texture, NULL, dst);
+
+    c->draws++;
+    c->totalDraws++;
+
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <SDL2/SDL.h>
+#include "map.h"
+#include "batch.h"
+
+// a screen spans at most 4x3 chunks down to the editor's LOD_ZOOM, the rest
+// is headroom for panning back and forth without rebaking
+#define TILE_CACHE_SLOTS 16
+
+typedef struct TileCacheSlot
+{
+    int          cx, cy;
+    SDL_Texture* texture;
+    bool         baked; // texture matches the chunk, cleared by edits
+    Uint32       used;  // frame it was last drawn in
+} TileCacheSlot;
+
+// painted chunks are baked into render targets at 1:1 so a frame costs one
+// copy per visible chunk instead of four per tile; without render targets
+// tileCacheDraw refuses and the caller draws the tiles itself
+typedef struct TileCache
+{
+    SDL_Renderer* renderer;
+    Batch*        sheet; // pieces are baked through it
+    SDL_Rect*     clips;
+    int           pieceSize;
+
+    bool         disabled;
+    SDL_atomic_t reset; // the renderer dropped target contents
+
+    TileCacheSlot slots[TILE_CACHE_SLOTS];
+    Uint32        frame;
+
+    int           bakes, draws; // this frame
+    unsigned long totalBakes, totalDraws;
+} TileCache;
+
+bool tileCacheInit(TileCache* c, SDL_Renderer* r, Batch* sheet,
+                   SDL_Rect clips[], int pieceSize);
+void tileCacheFree(TileCache* c);
+
+// forget every baked chunk, for when a different level is loaded
+void tileCacheClear(TileCache* c);
+
+// piece coordinates, the chunk holding the piece is rebaked when next drawn
+void tileCacheInvalidate(TileCache* c, int px, int py);
+
+// starts a frame, the bake and draw counts restart from zero
+void tileCacheFrame(TileCache* c);
+
+// draws chunk (cx, cy) of m into dst, baking it first if it changed
+bool tileCacheDraw(TileCache* c, Map* m, int cx, int cy, const SDL_Rect* dst);
+
+#endif
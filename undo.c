@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <string.h>
+#include "undo.h"
+
+#define RUN_BYTES    32 // room a run needs at most, two varints and 3 bytes
+#define CHUNK_PIECES (CHUNK_TILES << 1)
+
+static UndoEntry* entryAt(Undo* u, int i)
+{
+    return &u->entries[(u->first + i) % UNDO_ENTRIES];
+}
+
+static void dropOldest(Undo* u)
+{
+    u->first = (u->first + 1) % UNDO_ENTRIES;
+    u->count--;
+    u->done = u->done > 0 ? u->done - 1 : 0;
+
+    // half of a joined pair can't be undone alone
+    if (u->count > 0)
+        entryAt(u, 0)->joined = false;
+}
+
+bool undoInit(Undo* u, size_t budget)
+{
+    memset(u, 0, sizeof(Undo));
+
+    u->budget = budget;
+    u->ring   = malloc(budget);
+
+    return u->ring != NULL;
+}
+
+void undoFree(Undo* u)
+{
+    free(u->ring);
+    u->ring = NULL;
+}
+
+void undoClear(Undo* u)
+{
+    u->first     = 0;
+    u->count     = 0;
+    u->done      = 0;
+    u->recording = false;
+}
+
+// n more bytes at the end of the entry being recorded; entries in the way
+// are dropped oldest first, and at the end of the ring the entry so far
+// moves to the start
+static bool reserve(Undo* u, size_t n)
+{
+    UndoEntry* e = &u->entry;
+
+    if (e->size + n > u->budget)
+        return false;
+
+    // entries past the start of this one are older than the ones before it
+    if (e->offset + e->size + n > u->budget)
+    {
+        while (u->count > 0 && entryAt(u, 0)->offset >= e->offset)
+            dropOldest(u);
+        while (u->count > 0 && entryAt(u, 0)->offset < e->size + n)
+            dropOldest(u);
+
+        memmove(u->ring, u->ring + e->offset, e->size);
+        e->offset = 0;
+    }
+    else
+    {
+        while (u->count > 0 && entryAt(u, 0)->offset >= e->offset &&
+               entryAt(u, 0)->offset < e->offset + e->size + n)
+            dropOldest(u);
+    }
+
+    return true;
+}
+
+static unsigned char* putVarint(unsigned char* p, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        *p++ = (unsigned char)(v | 0x80);
+
+    *p++ = (unsigned char)v;
+
+    return p;
+}
+
+static uint64_t getVarint(const unsigned char** p)
+{
+    uint64_t v = 0;
+
+    for (int shift = 0;; shift += 7)
+    {
+        unsigned char b = *(*p)++;
+
+        v |= (uint64_t)(b & 0x7f) << shift;
+
+        if (b < 0x80)
+            return v;
+    }
+}
+
+// the pending run out into the ring
+static void flush(Undo* u)
+{
+    if (u->runCount == 0 || u->lost)
+        return;
+
+    // the gap can go backwards, zigzag keeps small ones small
+    int64_t  gap = (int64_t)(u->runStart - u->entry.end);
+    uint64_t zig = ((uint64_t)gap << 1) ^ (uint64_t)(gap >> 63);
+
+    if (!reserve(u, RUN_BYTES))
+    {
+        u->lost = true;
+        return;
+    }
+
+    unsigned char* start = u->ring + u->entry.offset + u->entry.size;
+    unsigned char* p     = putVarint(start, zig);
+
+    p    = putVarint(p, (uint64_t)u->runCount);
+    *p++ = u->runOld;
+    *p++ = u->runNew;
+    *p   = (unsigned char)(p - start);
+
+    u->entry.size += p - start + 1;
+    u->entry.end   = u->runStart + u->runCount;
+    u->runCount    = 0;
+}
+
+void undoBegin(Undo* u, bool joined)
+{
+    if (u->recording)
+        undoEnd(u);
+
+    // without a ring nothing is recorded
+    if (u->ring == NULL)
+        return;
+
+    // a new edit ends any redoing
+    u->count = u->done;
+    u->lost  = false;
+
+    if (u->count == UNDO_ENTRIES)
+        dropOldest(u);
+
+    UndoEntry* last = u->count > 0 ? entryAt(u, u->count - 1) : NULL;
+
+    u->entry.offset = last != NULL ? last->offset + last->size : 0;
+    u->entry.size   = 0;
+    u->entry.end    = 0;
+    u->entry.joined = joined && last != NULL;
+    u->runCount     = 0;
+    u->recording    = true;
+}
+
+void undoEnd(Undo* u)
+{
+    if (!u->recording)
+        return;
+
+    flush(u);
+
+    u->recording = false;
+
+    // with part of an edit missing nothing before it can be undone either
+    if (u->lost)
+        undoClear(u);
+    else if (u->entry.size > 0)
+    {
+        *entryAt(u, u->count) = u->entry;
+        u->done = ++u->count;
+    }
+}
+
+void undoRecord(Undo* u, Map* m, int px, int py, int count, short old,
+                short id)
+{
+    if (!u->recording || u->lost || old == id || px < 0 || py < 0 ||
+        px + count > m->width << 1 || py >= m->height << 1)
+        return;
+
+    uint64_t start = (uint64_t)py * ((uint64_t)m->width << 1) + px;
+
+    if (u->runCount > 0 && start == u->runStart + u->runCount &&
+        old == u->runOld && id == u->runNew)
+    {
+        u->runCount += count;
+        return;
+    }
+
+    flush(u);
+
+    u->runStart = start;
+    u->runCount = count;
+    u->runOld   = (unsigned char)old;
+    u->runNew   = (unsigned char)id;
+}
+
+// count pieces from start set to id, a row at a time
+static void apply(Undo* u, Map* m, uint64_t start, uint64_t count,
+                  unsigned char id)
+{
+    uint64_t width = (uint64_t)m->width << 1;
+    int      px = (int)(start % width), py = (int)(start / width);
+    int      cx = -1, cy = -1;
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        mapSetPiece(m, px, py, id);
+
+        if (u->touched != NULL &&
+            (px / CHUNK_PIECES != cx || py / CHUNK_PIECES != cy))
+        {
+            cx = px / CHUNK_PIECES;
+            cy = py / CHUNK_PIECES;
+            u->touched(u->data, cx, cy);
+        }
+
+        if (++px == (int)width)
+        {
+            px = 0;
+            py++;
+        }
+    }
+}
+
+static uint64_t unzig(uint64_t zig)
+{
+    return (uint64_t)((int64_t)(zig >> 1) ^ -(int64_t)(zig & 1));
+}
+
+// every chunk an entry's runs cross may be written to
+static bool allowed(Undo* u, Map* m, const UndoEntry* e)
+{
+    if (u->allowed == NULL)
+        return true;
+
+    const unsigned char* p   = u->ring + e->offset;
+    const unsigned char* end = p + e->size;
+    uint64_t             at = 0, width = (uint64_t)m->width << 1;
+    int                  cx = -1, cy = -1;
+
+    while (p < end)
+    {
+        uint64_t zig = getVarint(&p), count = getVarint(&p);
+
+        at += unzig(zig);
+        p  += 3;
+
+        // a chunk's worth of a row at a time
+        for (uint64_t i = at; i < at + count;)
+        {
+            int px = (int)(i % width), py = (int)(i / width),
+                kx = px / CHUNK_PIECES, ky = py / CHUNK_PIECES;
+
+            if ((kx != cx || ky != cy) && !u->allowed(u->data, kx, ky))
+                return false;
+
+            cx = kx;
+            cy = ky;
+
+            uint64_t step = CHUNK_PIECES - px % CHUNK_PIECES;
+
+            i += step < width - px ? step : width - px;
+        }
+
+        at += count;
+    }
+
+    return true;
+}
+
+// entries from i back to the first of its joined group
+static int group(Undo* u, int i)
+{
+    int n = 1;
+
+    while (i - n + 1 > 0 && entryAt(u, i - n + 1)->joined)
+        n++;
+
+    return n;
+}
+
+bool undoUndo(Undo* u, Map* m)
+{
+    undoEnd(u);
+
+    if (u->done == 0)
+        return false;
+
+    int n = group(u, u->done - 1);
+
+    for (int k = 0; k < n; k++)
+        if (!allowed(u, m, entryAt(u, u->done - 1 - k)))
+            return false;
+
+    // runs are put back newest first, a piece changed twice ends up as it
+    // was before either
+    for (int k = 0; k < n; k++)
+    {
+        UndoEntry*           e     = entryAt(u, --u->done);
+        const unsigned char* start = u->ring + e->offset;
+        size_t               pos   = e->size;
+        uint64_t             end   = e->end;
+
+        while (pos > 0)
+        {
+            pos -= start[pos - 1] + 1;
+
+            const unsigned char* p   = start + pos;
+            uint64_t             zig = getVarint(&p), count = getVarint(&p);
+
+            apply(u, m, end - count, count, p[0]);
+
+            end -= count + unzig(zig);
+        }
+    }
+
+    return true;
+}
+
+bool undoRedo(Undo* u, Map* m)
+{
+    undoEnd(u);
+
+    if (u->done == u->count)
+        return false;
+
+    // the entry and any joined on after it
+    int n = 1;
+
+    while (u->done + n < u->count && entryAt(u, u->done + n)->joined)
+        n++;
+
+    for (int k = 0; k < n; k++)
+        if (!allowed(u, m, entryAt(u, u->done + k)))
+            return false;
+
+    for (int k = 0; k < n; k++)
+    {
+        UndoEntry*           e   = entryAt(u, u->done++);
+        const unsigned char* p   = u->ring + e->offset;
+        const unsigned char* end = p + e->size;
+        uint64_t             at  = 0;
+
+        while (p < end)
+        {
+            uint64_t zig = getVarint(&p), count = getVarint(&p);
+
+            at += unzig(zig);
+
+            apply(u, m, at, count, p[1]);
+
+            at += count;
+            p  += 3;
+        }
+    }
+
+    return true;
+}
+
+bool undoLost(const Undo* u)
+{
+    return u->lost;
+}
@@ -0,0 +1,77 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "map.h"
+
+// history kept by default, --undo-budget changes it (in MB); past
+// UNDO_ENTRIES edits the oldest go even if there's room
+#define UNDO_BUDGET  (32 << 20)
+#define UNDO_ENTRIES 1024
+
+typedef struct UndoEntry
+{
+    size_t   offset, size; // its records in the ring
+    uint64_t end;          // one past the last record's pieces
+    bool     joined;       // undone and redone with the one before it
+} UndoEntry;
+
+// every edit is a list of runs of pieces that went from one id to another,
+// pieces numbered along rows of the level; a run is the gap from the last
+// one and its length as varints, the two ids and its own size last, so an
+// entry reads back to front for undo and front to back for redo. Entries
+// lie one after another in a ring of budget bytes, the oldest are dropped
+// to make room, so memory never grows past it however big an edit is
+typedef struct Undo
+{
+    unsigned char* ring;
+    size_t         budget;
+
+    // oldest first, the first done of count are applied and the rest can
+    // be redone
+    UndoEntry entries[UNDO_ENTRIES];
+    int       first, count, done;
+
+    // the entry being recorded and its last run, which grows while pieces
+    // keep following on with the same ids
+    UndoEntry     entry;
+    bool          recording, lost;
+    uint64_t      runStart;
+    int           runCount;
+    unsigned char runOld, runNew;
+
+    // chunk coordinates, as for Fill: undo and redo refuse to touch chunks
+    // that aren't allowed and report those they write to
+    bool (*allowed)(void* data, int cx, int cy);
+    void (*touched)(void* data, int cx, int cy);
+    void* data;
+} Undo;
+
+bool undoInit(Undo* u, size_t budget);
+void undoFree(Undo* u);
+
+// forget everything, for when a different level is loaded
+void undoClear(Undo* u);
+
+// what's recorded from begin to end is one entry, undone in one go; a
+// joined entry also goes with the one before it. Whatever was undone can't
+// be redone once a new entry starts
+void undoBegin(Undo* u, bool joined);
+void undoEnd(Undo* u);
+
+// count pieces along row py of m from px went from old to id
+void undoRecord(Undo* u, Map* m, int px, int py, int count, short old,
+                short id);
+
+// false when there's nothing to undo or redo, or part of it is in a chunk
+// that isn't allowed
+bool undoUndo(Undo* u, Map* m);
+bool undoRedo(Undo* u, Map* m);
+
+// an entry too big for the budget lost the history along with itself,
+// cleared by the next undoBegin
+bool undoLost(const Undo* u);
+
+#endif